@@ -2,9 +2,9 @@
 # the name of the target operating system
 SET(CMAKE_SYSTEM_NAME Windows)
 
-# which compilers to use for C and C++
-SET(CMAKE_C_COMPILER x86_64-w64-mingw32-gcc)
-SET(CMAKE_CXX_COMPILER x86_64-w64-mingw32-g++)
+# which compilers to use for C and C++. The posix thread model is needed for std::thread, std::mutex and the like
+SET(CMAKE_C_COMPILER x86_64-w64-mingw32-gcc-posix)
+SET(CMAKE_CXX_COMPILER x86_64-w64-mingw32-g++-posix)
 SET(CMAKE_RC_COMPILER x86_64-w64-mingw32-windres)
 
 # here is the target environment located
@@ -0,0 +1,252 @@
+#pragma once
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+// CCSDS pseudo-randomizer sequence (1 + x3 + x5 + x7 + x8), as a per-byte XOR table for a whole CADU.
+// The ASM itself isn't randomized. From gr-poes-weather
+template <int FrameBytes, int ASMBytes>
+constexpr std::array<uint8_t, FrameBytes> makeDerandomizationTable()
+{
+    std::array<uint8_t, FrameBytes> table{};
+    uint8_t randm = 0xFF;
+    for (int i = ASMBytes; i < FrameBytes; i++)
+    {
+        for (int j = 0; j <= 7; j++)
+        {
+            table[i] = table[i] << 1;
+            if (randm & 0x80)
+                table[i]++;
+
+            // Feedback from bits 1, 3, 5 and 8
+            uint8_t feedbk = randm & 0x95;
+            randm = randm << 1;
+
+            if ((((feedbk & 0x80) ^ (0x80 & feedbk << 3)) ^ (0x80 & (feedbk << 5))) ^ (0x80 & (feedbk << 7)))
+                randm++;
+        }
+    }
+    return table;
+}
+
+// CADU frame synchronizer, shared by all CCSDS-framed downlinks.
+// Implementation of http://www.sat.cc.ua/data/CADU%20Frame%20Synchro.pdf
+// Everything that differs between satellites is a template parameter, so the hot checks are fully unrolled for each of them
+template <uint32_t ASM, int FrameBytes, bool Inverted, bool Derandomize>
+class CaduFramer
+{
+public:
+    // Frame size in bits, that is the spacing between 2 ASMs
+    static constexpr int FRAME_BITS = FrameBytes * 8;
+    static constexpr int ASM_BYTES = 4;
+    // Definitely still needs tuning
+    static constexpr int THRESOLD_STATE_3 = 12;
+    static constexpr int THRESOLD_STATE_2 = 6;
+    static constexpr int THRESOLD_STATE_1 = 2;
+    static constexpr int THRESOLD_STATE_0 = 0;
+
+private:
+    // Entire input, bit-per-bit, in the right polarity
+    std::vector<bool> bits;
+    // Bit position of every frame found
+    std::vector<long> frame_starts;
+    // Derandomization table
+    static constexpr std::array<uint8_t, FrameBytes> derandomization_table = makeDerandomizationTable<FrameBytes, ASM_BYTES>();
+
+    // Count bit mismatches against the ASM
+    static int countASMErrors(uint32_t word)
+    {
+        return std::bitset<32>(word ^ ASM).count();
+    }
+
+    // Build a 32-bit value from the bits at pos
+    uint32_t readWord(long pos)
+    {
+        uint32_t word = 0;
+        for (int i = 0; i < 32; i++)
+            word = word << 1 | bits[pos + i];
+        return word;
+    }
+
+public:
+    // Append a raw input byte, applying polarity
+    void pushByte(uint8_t byte)
+    {
+        for (int i = 7; i >= 0; i--)
+            bits.push_back(((byte >> i) & 1) ^ Inverted);
+    }
+
+    // Read an entire input stream. This may seem dumb at first, but considering decoded files are not several gigabytes...
+    // Working with a vector eases the process a lot, and using RAM is also supposedly faster?
+    void loadFile(std::istream &input)
+    {
+        uint8_t bufferByte;
+        while (input.get((char &)bufferByte))
+            pushByte(bufferByte);
+    }
+
+    // Direct access to the bit buffer, for sources that are already in the right polarity
+    std::vector<bool> &getBits()
+    {
+        return bits;
+    }
+
+    // Takes 8 bits and makes a byte
+    uint8_t readRawByte(long bitPos)
+    {
+        uint8_t value = 0;
+        for (int i = 0; i < 8; i++)
+            value = value << 1 | bits[bitPos + i];
+        return value;
+    }
+
+    // Read a byte from a frame, derandomized if needed
+    uint8_t readByte(long frameStart, int bytePos)
+    {
+        uint8_t value = readRawByte(frameStart + bytePos * 8);
+        if (Derandomize)
+            value ^= derandomization_table[bytePos];
+        return value;
+    }
+
+    // Run the sync state machine over all bits, returning frame starts. Lock changes are shown if verbose
+    std::vector<long> &findFrames(bool verbose = true)
+    {
+        frame_starts.clear();
+
+        int thresold_state = THRESOLD_STATE_0;
+        int bitsToIncrement = 1;
+        int errors = 0;
+        int sep_errors = 0;
+        int good = 0;
+        int state_2_bits_count = 0;
+        int last_state = 0;
+        if (verbose)
+            std::cout << "NO LOCK" << std::flush;
+        for (long bitPos = 0; bitPos + FRAME_BITS <= (long)bits.size(); bitPos += bitsToIncrement)
+        {
+            int asmErrors = countASMErrors(readWord(bitPos));
+
+            // State 0 : Searches bit-per-bit for a perfect sync marker. If one is found, we jump to state 6!
+            if (thresold_state == THRESOLD_STATE_0)
+            {
+                if (asmErrors <= thresold_state)
+                {
+                    frame_starts.push_back(bitPos);
+                    thresold_state = THRESOLD_STATE_1;
+                    bitsToIncrement = FRAME_BITS;
+                    errors = 0;
+                    sep_errors = 0;
+                    good = 0;
+                }
+            }
+            // State 1 : Each header is expect 1024 bytes away. Only 6 mistmatches tolerated.
+            // If 5 consecutive good frames are found, we hop to state 22, though, 5 consecutive
+            // errors (here's why errors is reset each time a frame is good) means reset to state 0
+            // 2 frame errors pushes us to state 2
+            else if (thresold_state == THRESOLD_STATE_1)
+            {
+                if (asmErrors <= thresold_state)
+                {
+                    frame_starts.push_back(bitPos);
+                    good++;
+                    errors = 0;
+
+                    if (good == 5)
+                    {
+                        thresold_state = THRESOLD_STATE_3;
+                        good = 0;
+                        errors = 0;
+                    }
+                }
+                else
+                {
+                    errors++;
+                    sep_errors++;
+
+                    if (errors == 5)
+                    {
+                        thresold_state = THRESOLD_STATE_0;
+                        bitsToIncrement = 1;
+                        errors = 0;
+                        sep_errors = 0;
+                        good = 0;
+                    }
+
+                    if (sep_errors == 2)
+                    {
+                        thresold_state = THRESOLD_STATE_2;
+                        state_2_bits_count = 0;
+                        bitsToIncrement = 1;
+                        errors = 0;
+                        sep_errors = 0;
+                        good = 0;
+                    }
+                }
+            }
+            // State 2 : Goes back to bit-per-bit syncing... 3 frame scanned and we got back to state 0, 1 good and back to 6!
+            else if (thresold_state == THRESOLD_STATE_2)
+            {
+                if (asmErrors <= thresold_state)
+                {
+                    frame_starts.push_back(bitPos);
+                    thresold_state = THRESOLD_STATE_1;
+                    bitsToIncrement = FRAME_BITS;
+                    errors = 0;
+                    sep_errors = 0;
+                    good = 0;
+                }
+                else
+                {
+                    state_2_bits_count++;
+                    errors++;
+
+                    if (state_2_bits_count >= 3 * FRAME_BITS)
+                    {
+                        thresold_state = THRESOLD_STATE_0;
+                        bitsToIncrement = 1;
+                        errors = 0;
+                        sep_errors = 0;
+                        good = 0;
+                    }
+                }
+            }
+            // State 3 : We assume perfect lock and allow very high mismatchs.
+            // 1 error and back to state 6
+            // Note : Lowering the thresold seems to yield better of a sync
+            else if (thresold_state == THRESOLD_STATE_3)
+            {
+                if (asmErrors <= thresold_state)
+                {
+                    frame_starts.push_back(bitPos);
+                }
+                else
+                {
+                    errors = 0;
+                    good = 0;
+                    sep_errors = 0;
+                    thresold_state = THRESOLD_STATE_1;
+                }
+            }
+
+            if (last_state != thresold_state)
+            {
+                if (verbose)
+                    std::cout << (thresold_state > 0 ? "\rLOCKED " : "\rNO LOCK") << std::flush;
+                last_state = thresold_state;
+            }
+        }
+        if (verbose)
+            std::cout << '\n';
+
+        return frame_starts;
+    }
+
+    // Return the number of frames found
+    int getFrameCount()
+    {
+        return frame_starts.size();
+    }
+};
@@ -0,0 +1,222 @@
+#include "clahe.h"
+#include <cmath>
+#include "parallel.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Pixels blended at once
+const int CLAHE_BLOCK = 256;
+// Rows mapped per thread, at least
+const size_t CLAHE_MIN_BAND = 64;
+
+// Tiles on both sides of a pixel, and weight of the second one, from the tile centers
+void ClaheEqualizer::tileNeighbours(int pixel, int count, int size, int &first, int &second, float &weight)
+{
+    // Last tile whose center is at or before the pixel
+    first = 0;
+    while (first + 1 < count && (tileStart(first + 1, count, size) + tileStart(first + 2, count, size)) / 2.0 <= pixel + 0.5)
+        first++;
+
+    double firstCenter = (tileStart(first, count, size) + tileStart(first + 1, count, size)) / 2.0;
+    if (first + 1 >= count || pixel + 0.5 < firstCenter)
+    {
+        // Borders only have one tile to follow
+        second = first;
+        weight = 0;
+        return;
+    }
+
+    double secondCenter = (tileStart(first + 1, count, size) + tileStart(first + 2, count, size)) / 2.0;
+    second = first + 1;
+    weight = (pixel + 0.5 - firstCenter) / (secondCenter - firstCenter);
+}
+
+// Constructor, for a width * rows plane
+ClaheEqualizer::ClaheEqualizer(int width, int rows, double clipLimit, int scale, bool ignoreZero)
+    : width{width}, rows{rows}, clip_limit{clipLimit}, scale{scale}, ignore_zero{ignoreZero}
+{
+    // Scaled samples are 10-bits counts, a bin each. Unscaled ones can take any 16-bits value
+    bin_shift = scale > 1 ? 0 : 6;
+
+    tile_columns = std::max(1, (int)std::lround((double)width / CLAHE_TILE_SIZE));
+    tile_rows = std::max(1, (int)std::lround((double)rows / CLAHE_TILE_SIZE));
+    histograms.assign((size_t)tile_columns * tile_rows * CLAHE_BINS, 0);
+    luts.assign(histograms.size(), 0);
+
+    left_tiles.resize(width);
+    right_tiles.resize(width);
+    column_weights.resize(width);
+    for (int x = 0; x < width; x++)
+        tileNeighbours(x, tile_columns, width, left_tiles[x], right_tiles[x], column_weights[x]);
+}
+
+// Number of tile rows
+int ClaheEqualizer::getTileRows() const
+{
+    return tile_rows;
+}
+
+// First row of a tile row, getTileRowStart(getTileRows()) being the plane's height
+int ClaheEqualizer::getTileRowStart(int tileRow) const
+{
+    return tileStart(tileRow, tile_rows, rows);
+}
+
+// Add a row to the histograms of its tiles. Rows of different tile rows can be added from different threads
+void ClaheEqualizer::accumulateRow(int row, const uint16_t *samples)
+{
+    int tileRow = std::min<int>((int64_t)row * tile_rows / rows, tile_rows - 1);
+    while (tileRow > 0 && row < getTileRowStart(tileRow))
+        tileRow--;
+    while (tileRow + 1 < tile_rows && row >= getTileRowStart(tileRow + 1))
+        tileRow++;
+
+    for (int tileColumn = 0; tileColumn < tile_columns; tileColumn++)
+    {
+        uint32_t *histogram = &histograms[((size_t)tileRow * tile_columns + tileColumn) * CLAHE_BINS];
+        int end = tileStart(tileColumn + 1, tile_columns, width);
+        for (int x = tileStart(tileColumn, tile_columns, width); x < end; x++)
+            if (samples[x] != 0 || !ignore_zero)
+                histogram[sampleBin(samples[x])]++;
+    }
+}
+
+// Clip the histograms and build the tile LUTs, in parallel
+void ClaheEqualizer::buildLUTs()
+{
+    parallelBands(
+        (size_t)tile_columns * tile_rows,
+        [&](size_t start, size_t end) {
+            for (size_t tile = start; tile < end; tile++)
+            {
+                uint32_t *histogram = &histograms[tile * CLAHE_BINS];
+                uint16_t *lut = &luts[tile * CLAHE_BINS];
+
+                uint64_t total = 0;
+                for (int bin = 0; bin < CLAHE_BINS; bin++)
+                    total += histogram[bin];
+
+                // Nothing to equalize, keep a plain ramp
+                if (total == 0)
+                {
+                    for (int bin = 0; bin < CLAHE_BINS; bin++)
+                        lut[bin] = bin * UINT16_MAX / (CLAHE_BINS - 1);
+                    continue;
+                }
+
+                // Clip, then spread the excess evenly, what doesn't divide going to evenly spaced bins
+                uint32_t limit = std::max<uint32_t>(1, clip_limit * total / CLAHE_BINS);
+                uint64_t excess = 0;
+                for (int bin = 0; bin < CLAHE_BINS; bin++)
+                {
+                    if (histogram[bin] > limit)
+                    {
+                        excess += histogram[bin] - limit;
+                        histogram[bin] = limit;
+                    }
+                }
+                uint32_t increment = excess / CLAHE_BINS;
+                uint32_t remainder = excess % CLAHE_BINS;
+                for (int bin = 0; bin < CLAHE_BINS; bin++)
+                    histogram[bin] += increment;
+                if (remainder > 0)
+                {
+                    int step = CLAHE_BINS / remainder;
+                    for (int bin = 0; bin < CLAHE_BINS && remainder > 0; bin += step, remainder--)
+                        histogram[bin]++;
+                }
+
+                // Cumulative histogram to the full output range
+                uint64_t cumul = 0;
+                for (int bin = 0; bin < CLAHE_BINS; bin++)
+                {
+                    cumul += histogram[bin];
+                    lut[bin] = cumul * UINT16_MAX / total;
+                }
+            }
+        },
+        1);
+}
+
+// Map a row in place, blending the LUTs around it
+void ClaheEqualizer::applyRow(int row, uint16_t *samples) const
+{
+    int topTileRow, bottomTileRow;
+    float rowWeight;
+    tileNeighbours(row, tile_rows, rows, topTileRow, bottomTileRow, rowWeight);
+    const uint16_t *topLUTs = &luts[(size_t)topTileRow * tile_columns * CLAHE_BINS];
+    const uint16_t *bottomLUTs = &luts[(size_t)bottomTileRow * tile_columns * CLAHE_BINS];
+
+    // LUT values of the 4 surrounding tiles, gathered for a block then blended
+    float topLeft[CLAHE_BLOCK], topRight[CLAHE_BLOCK], bottomLeft[CLAHE_BLOCK], bottomRight[CLAHE_BLOCK];
+    for (int block = 0; block < width; block += CLAHE_BLOCK)
+    {
+        const int count = std::min(CLAHE_BLOCK, width - block);
+        for (int i = 0; i < count; i++)
+        {
+            const int x = block + i;
+            if (samples[x] == 0 && ignore_zero)
+            {
+                topLeft[i] = topRight[i] = bottomLeft[i] = bottomRight[i] = 0;
+                continue;
+            }
+
+            const int bin = sampleBin(samples[x]);
+            const size_t left = (size_t)left_tiles[x] * CLAHE_BINS + bin, right = (size_t)right_tiles[x] * CLAHE_BINS + bin;
+            topLeft[i] = topLUTs[left];
+            topRight[i] = topLUTs[right];
+            bottomLeft[i] = bottomLUTs[left];
+            bottomRight[i] = bottomLUTs[right];
+        }
+
+        const float *weights = &column_weights[block];
+        uint16_t *output = &samples[block];
+        int i = 0;
+#if defined(__SSE2__)
+        // Results stay within [0, 65535], SSE2 can only pack signed, hence the bias
+        const __m128 verticalWeight = _mm_set1_ps(rowWeight), half = _mm_set1_ps(0.5f);
+        const __m128i bias = _mm_set1_epi32(0x8000), signBias = _mm_set1_epi16((short)0x8000);
+        auto blend = [&](int j) {
+            __m128 weight = _mm_loadu_ps(&weights[j]);
+            __m128 top = _mm_loadu_ps(&topLeft[j]), bottom = _mm_loadu_ps(&bottomLeft[j]);
+            top = _mm_add_ps(top, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&topRight[j]), top), weight));
+            bottom = _mm_add_ps(bottom, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&bottomRight[j]), bottom), weight));
+            __m128 value = _mm_add_ps(_mm_add_ps(top, _mm_mul_ps(_mm_sub_ps(bottom, top), verticalWeight)), half);
+            return _mm_sub_epi32(_mm_cvttps_epi32(value), bias);
+        };
+        for (; i + 8 <= count; i += 8)
+            _mm_storeu_si128((__m128i *)&output[i], _mm_xor_si128(_mm_packs_epi32(blend(i), blend(i + 4)), signBias));
+#endif
+        for (; i < count; i++)
+        {
+            float top = topLeft[i] + (topRight[i] - topLeft[i]) * weights[i];
+            float bottom = bottomLeft[i] + (bottomRight[i] - bottomLeft[i]) * weights[i];
+            output[i] = top + (bottom - top) * rowWeight + 0.5f;
+        }
+    }
+}
+
+// Apply CLAHE to a width * rows plane in place, in one go
+void claheSamples(uint16_t *plane, int width, int rows, double clipLimit, int scale, bool ignoreZero)
+{
+    ClaheEqualizer equalizer(width, rows, clipLimit, scale, ignoreZero);
+
+    // Each thread fills whole tile rows, no histogram is shared
+    parallelBands(
+        equalizer.getTileRows(),
+        [&](size_t start, size_t end) {
+            for (int row = equalizer.getTileRowStart(start); row < equalizer.getTileRowStart(end); row++)
+                equalizer.accumulateRow(row, &plane[(size_t)row * width]);
+        },
+        1);
+    equalizer.buildLUTs();
+
+    parallelBands(
+        rows,
+        [&](size_t start, size_t end) {
+            for (size_t row = start; row < end; row++)
+                equalizer.applyRow(row, &plane[row * width]);
+        },
+        CLAHE_MIN_BAND);
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "hrpt.h"
+
+// Target tile size, in pixels. Tiles are spread evenly, so they end up between 2/3 and 4/3 of it
+#define CLAHE_TILE_SIZE 128
+// Histogram bins of a tile, a bin per 10-bits level
+#define CLAHE_BINS 1024
+
+// Contrast-limited adaptive histogram equalization of a plane. Each tile gets its own equalization LUT,
+// from a histogram clipped at clipLimit times the average bin count (the excess being spread over every bin),
+// and pixels blend the LUTs of the 4 nearest tile centers. Histograms are taken on sample levels (10-bits
+// counts, or 64 values wide bins of calibrated samples) and LUTs map them to the full 16-bits range.
+// Rows can be fed and mapped one by one, so a pass can be streamed through it in two passes
+class ClaheEqualizer
+{
+private:
+    int width;
+    int rows;
+    // Clip limit, relative to the average bin count
+    double clip_limit;
+    // Spacing between sample levels
+    int scale;
+    // Levels per bin are 1 << bin_shift
+    int bin_shift;
+    // Samples of 0 are no-data, left out of histograms and kept at 0
+    bool ignore_zero;
+    int tile_columns;
+    int tile_rows;
+    // CLAHE_BINS counts, then LUT entries, per tile
+    std::vector<uint32_t> histograms;
+    std::vector<uint16_t> luts;
+    // Tiles and weight of the right one, for each pixel column
+    std::vector<int> left_tiles;
+    std::vector<int> right_tiles;
+    std::vector<float> column_weights;
+
+    // Histogram bin of a scaled sample
+    int sampleBin(uint16_t value) const
+    {
+        return std::min((value / scale) >> bin_shift, CLAHE_BINS - 1);
+    }
+
+    // First pixel of a tile, along a dimension of size pixels split in count tiles
+    static int tileStart(int tile, int count, int size)
+    {
+        return (int64_t)tile * size / count;
+    }
+
+    // Tiles on both sides of a pixel, and weight of the second one, from the tile centers
+    static void tileNeighbours(int pixel, int count, int size, int &first, int &second, float &weight);
+
+public:
+    // Constructor, for a width * rows plane
+    ClaheEqualizer(int width, int rows, double clipLimit, int scale = HRPT_PIXEL_SCALE, bool ignoreZero = false);
+    // Number of tile rows
+    int getTileRows() const;
+    // First row of a tile row, getTileRowStart(getTileRows()) being the plane's height
+    int getTileRowStart(int tileRow) const;
+    // Add a row to the histograms of its tiles. Rows of different tile rows can be added from different threads
+    void accumulateRow(int row, const uint16_t *samples);
+    // Clip the histograms and build the tile LUTs, in parallel
+    void buildLUTs();
+    // Map a row in place, blending the LUTs around it
+    void applyRow(int row, uint16_t *samples) const;
+};
+
+// Apply CLAHE to a width * rows plane in place, in one go
+void claheSamples(uint16_t *plane, int width, int rows, double clipLimit, int scale = HRPT_PIXEL_SCALE, bool ignoreZero = false);
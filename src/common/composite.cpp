@@ -0,0 +1,396 @@
+#include "composite.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <stdexcept>
+#include "parallel.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Pixels evaluated at once. Every stack slot holds a block of floats, a few of them fit in L1
+const int COMPOSITE_BLOCK = 1024;
+// Pixels evaluated per thread, at least
+const size_t COMPOSITE_MIN_BAND = 1 << 16;
+
+// Recursive descent parser for a single expression, emitting instructions in evaluation order
+class CompositeParser
+{
+private:
+    const std::string &text;
+    size_t position;
+    std::vector<CompositeInstruction> &program;
+
+    // Report an error at the current position
+    [[noreturn]] void fail(const std::string &message) const
+    {
+        throw std::runtime_error("Invalid composite expression '" + text + "': " + message + " at position " + std::to_string(position + 1));
+    }
+
+    void skipSpaces()
+    {
+        while (position < text.size() && std::isspace((unsigned char)text[position]))
+            position++;
+    }
+
+    // Consume a character if it comes next
+    bool accept(char c)
+    {
+        skipSpaces();
+        if (position < text.size() && text[position] == c)
+        {
+            position++;
+            return true;
+        }
+        return false;
+    }
+
+    void expect(char c)
+    {
+        if (!accept(c))
+            fail(std::string("expected '") + c + "'");
+    }
+
+    // Number, channel, function call or parenthesized expression
+    void parsePrimary()
+    {
+        skipSpaces();
+        if (accept('('))
+        {
+            parseExpression();
+            expect(')');
+            return;
+        }
+
+        if (position < text.size() && (std::isdigit((unsigned char)text[position]) || text[position] == '.'))
+        {
+            char *end;
+            float constant = std::strtof(&text[position], &end);
+            position = end - text.c_str();
+            program.push_back({COMPOSITE_CONSTANT, 0, constant});
+            return;
+        }
+
+        size_t start = position;
+        while (position < text.size() && std::isalnum((unsigned char)text[position]))
+            position++;
+        std::string word = text.substr(start, position - start);
+
+        if (word.size() > 2 && word.compare(0, 2, "ch") == 0 && std::all_of(word.begin() + 2, word.end(), [](char c) { return std::isdigit((unsigned char)c); }))
+        {
+            program.push_back({COMPOSITE_CHANNEL, std::stoi(word.substr(2)), 0});
+        }
+        else if (word == "min" || word == "max")
+        {
+            expect('(');
+            parseExpression();
+            expect(',');
+            parseExpression();
+            expect(')');
+            program.push_back({word == "min" ? COMPOSITE_MIN : COMPOSITE_MAX, 0, 0});
+        }
+        else
+        {
+            position = start;
+            fail(word.empty() ? "expected a value" : "unknown name '" + word + "'");
+        }
+    }
+
+    void parseUnary()
+    {
+        if (accept('-'))
+        {
+            parseUnary();
+            program.push_back({COMPOSITE_NEGATE, 0, 0});
+        }
+        else
+        {
+            parsePrimary();
+        }
+    }
+
+    void parseTerm()
+    {
+        parseUnary();
+        while (true)
+        {
+            if (accept('*'))
+            {
+                parseUnary();
+                program.push_back({COMPOSITE_MULTIPLY, 0, 0});
+            }
+            else if (accept('/'))
+            {
+                parseUnary();
+                program.push_back({COMPOSITE_DIVIDE, 0, 0});
+            }
+            else
+            {
+                return;
+            }
+        }
+    }
+
+    void parseExpression()
+    {
+        parseTerm();
+        while (true)
+        {
+            if (accept('+'))
+            {
+                parseTerm();
+                program.push_back({COMPOSITE_ADD, 0, 0});
+            }
+            else if (accept('-'))
+            {
+                parseTerm();
+                program.push_back({COMPOSITE_SUBTRACT, 0, 0});
+            }
+            else
+            {
+                return;
+            }
+        }
+    }
+
+public:
+    CompositeParser(const std::string &text, std::vector<CompositeInstruction> &program) : text{text}, position{0}, program{program}
+    {
+    }
+
+    // Parse the whole text as one expression
+    void parse()
+    {
+        parseExpression();
+        skipSpaces();
+        if (position < text.size())
+            fail(std::string("unexpected '") + text[position] + "'");
+    }
+};
+
+// Text with surrounding spaces removed
+static std::string trim(const std::string &text)
+{
+    size_t start = text.find_first_not_of(" \t");
+    if (start == std::string::npos)
+        return "";
+    return text.substr(start, text.find_last_not_of(" \t") - start + 1);
+}
+
+// Convert a block of samples to floats
+static void loadSamples(const uint16_t *samples, int count, float *output)
+{
+    int i = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i values = _mm_loadu_si128((const __m128i *)&samples[i]);
+        _mm_storeu_ps(&output[i], _mm_cvtepi32_ps(_mm_unpacklo_epi16(values, zero)));
+        _mm_storeu_ps(&output[i + 4], _mm_cvtepi32_ps(_mm_unpackhi_epi16(values, zero)));
+    }
+#endif
+    for (; i < count; i++)
+        output[i] = samples[i];
+}
+
+// Round and clamp a block of results to samples
+static void storeSamples(const float *values, int count, uint16_t maxValue, uint16_t *output)
+{
+    int i = 0;
+#if defined(__SSE2__)
+    // max() returns its second operand on NAN, giving 0. SSE2 can only pack signed, hence the bias
+    const __m128 zero = _mm_setzero_ps(), half = _mm_set1_ps(0.5f), maximum = _mm_set1_ps(maxValue);
+    const __m128i bias = _mm_set1_epi32(0x8000), signBias = _mm_set1_epi16((short)0x8000);
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128 low = _mm_min_ps(_mm_max_ps(_mm_add_ps(_mm_loadu_ps(&values[i]), half), zero), maximum);
+        __m128 high = _mm_min_ps(_mm_max_ps(_mm_add_ps(_mm_loadu_ps(&values[i + 4]), half), zero), maximum);
+        __m128i packed = _mm_packs_epi32(_mm_sub_epi32(_mm_cvttps_epi32(low), bias), _mm_sub_epi32(_mm_cvttps_epi32(high), bias));
+        _mm_storeu_si128((__m128i *)&output[i], _mm_xor_si128(packed, signBias));
+    }
+#endif
+    for (; i < count; i++)
+    {
+        float value = values[i] + 0.5f;
+        output[i] = value > 0 ? (uint16_t)std::min(value, (float)maxValue) : 0;
+    }
+}
+
+// a = a op b, over a block
+static void applyBinary(CompositeOperation operation, float *a, const float *b, int count)
+{
+    int i = 0;
+#if defined(__SSE2__)
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 x = _mm_loadu_ps(&a[i]), y = _mm_loadu_ps(&b[i]);
+        switch (operation)
+        {
+        case COMPOSITE_ADD:
+            x = _mm_add_ps(x, y);
+            break;
+        case COMPOSITE_SUBTRACT:
+            x = _mm_sub_ps(x, y);
+            break;
+        case COMPOSITE_MULTIPLY:
+            x = _mm_mul_ps(x, y);
+            break;
+        case COMPOSITE_DIVIDE:
+            x = _mm_div_ps(x, y);
+            break;
+        case COMPOSITE_MIN:
+            x = _mm_min_ps(x, y);
+            break;
+        default:
+            x = _mm_max_ps(x, y);
+            break;
+        }
+        _mm_storeu_ps(&a[i], x);
+    }
+#endif
+    for (; i < count; i++)
+    {
+        switch (operation)
+        {
+        case COMPOSITE_ADD:
+            a[i] += b[i];
+            break;
+        case COMPOSITE_SUBTRACT:
+            a[i] -= b[i];
+            break;
+        case COMPOSITE_MULTIPLY:
+            a[i] *= b[i];
+            break;
+        case COMPOSITE_DIVIDE:
+            a[i] /= b[i];
+            break;
+        case COMPOSITE_MIN:
+            a[i] = a[i] < b[i] ? a[i] : b[i];
+            break;
+        default:
+            a[i] = a[i] > b[i] ? a[i] : b[i];
+            break;
+        }
+    }
+}
+
+// Compile a composite definition. Throws on syntax errors
+Composite::Composite(const std::string &definition) : stack_depth{1}
+{
+    // Statements, either a single expression or one assignment per color
+    std::vector<std::string> statements;
+    size_t start = 0;
+    while (start <= definition.size())
+    {
+        size_t end = std::min(definition.find(';', start), definition.size());
+        std::string statement = trim(definition.substr(start, end - start));
+        if (!statement.empty())
+            statements.push_back(statement);
+        start = end + 1;
+    }
+
+    if (statements.size() == 1 && statements[0].find('=') == std::string::npos)
+    {
+        programs.resize(1);
+        CompositeParser(statements[0], programs[0]).parse();
+    }
+    else
+    {
+        programs.resize(3);
+        for (const std::string &statement : statements)
+        {
+            size_t equal = statement.find('=');
+            if (equal == std::string::npos)
+                throw std::runtime_error("Invalid composite statement '" + statement + "', expected r=, g= or b=");
+
+            std::string target = trim(statement.substr(0, equal));
+            int output = target == "r" ? 0 : (target == "g" ? 1 : (target == "b" ? 2 : -1));
+            if (output < 0)
+                throw std::runtime_error("Invalid composite output '" + target + "', expected r, g or b");
+            if (!programs[output].empty())
+                throw std::runtime_error("Composite output " + target + " is assigned twice");
+
+            CompositeParser(trim(statement.substr(equal + 1)), programs[output]).parse();
+        }
+
+        for (const std::vector<CompositeInstruction> &program : programs)
+            if (program.empty())
+                throw std::runtime_error("Composite '" + definition + "' needs all of r, g and b");
+    }
+
+    // Channels read, and stack needed
+    for (const std::vector<CompositeInstruction> &program : programs)
+    {
+        int depth = 0;
+        for (const CompositeInstruction &instruction : program)
+        {
+            if (instruction.operation == COMPOSITE_CHANNEL || instruction.operation == COMPOSITE_CONSTANT)
+                stack_depth = std::max(stack_depth, ++depth);
+            else if (instruction.operation != COMPOSITE_NEGATE)
+                depth--;
+
+            if (instruction.operation == COMPOSITE_CHANNEL)
+                channels.push_back(instruction.channel);
+        }
+    }
+    std::sort(channels.begin(), channels.end());
+    channels.erase(std::unique(channels.begin(), channels.end()), channels.end());
+}
+
+// Channels the composite reads
+const std::vector<int> &Composite::getChannels() const
+{
+    return channels;
+}
+
+// 1 for grayscale, 3 for RGB
+int Composite::getOutputCount() const
+{
+    return programs.size();
+}
+
+// Evaluate over size pixels. planes[channel - 1] must be valid for every channel read, results are
+// rounded and clamped to [0, maxValue], NAN giving 0
+void Composite::evaluate(const std::vector<const uint16_t *> &planes, size_t size, const std::vector<uint16_t *> &outputs, uint16_t maxValue) const
+{
+    auto evaluateBand = [&](size_t start, size_t end) {
+        std::vector<float> stack((size_t)stack_depth * COMPOSITE_BLOCK);
+        for (size_t block = start; block < end; block += COMPOSITE_BLOCK)
+        {
+            int count = std::min<size_t>(COMPOSITE_BLOCK, end - block);
+
+            // Every output of the block while its samples are still in cache
+            for (size_t output = 0; output < programs.size(); output++)
+            {
+                // Slot of the top of the stack
+                int top = -1;
+                for (const CompositeInstruction &instruction : programs[output])
+                {
+                    switch (instruction.operation)
+                    {
+                    case COMPOSITE_CHANNEL:
+                        top++;
+                        loadSamples(&planes[instruction.channel - 1][block], count, &stack[top * COMPOSITE_BLOCK]);
+                        break;
+                    case COMPOSITE_CONSTANT:
+                        top++;
+                        std::fill_n(&stack[top * COMPOSITE_BLOCK], count, instruction.constant);
+                        break;
+                    case COMPOSITE_NEGATE:
+                        for (int i = 0; i < count; i++)
+                            stack[top * COMPOSITE_BLOCK + i] = -stack[top * COMPOSITE_BLOCK + i];
+                        break;
+                    default:
+                        applyBinary(instruction.operation, &stack[(top - 1) * COMPOSITE_BLOCK], &stack[top * COMPOSITE_BLOCK], count);
+                        top--;
+                        break;
+                    }
+                }
+                storeSamples(stack.data(), count, maxValue, &outputs[output][block]);
+            }
+        }
+    };
+    parallelBands(size, evaluateBand, COMPOSITE_MIN_BAND);
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Operations of a compiled composite expression, in reverse Polish notation
+enum CompositeOperation
+{
+    COMPOSITE_CHANNEL,
+    COMPOSITE_CONSTANT,
+    COMPOSITE_ADD,
+    COMPOSITE_SUBTRACT,
+    COMPOSITE_MULTIPLY,
+    COMPOSITE_DIVIDE,
+    COMPOSITE_NEGATE,
+    COMPOSITE_MIN,
+    COMPOSITE_MAX,
+};
+
+struct CompositeInstruction
+{
+    CompositeOperation operation;
+    // Channel to push (1-based), or constant to push
+    int channel;
+    float constant;
+};
+
+// Band maths over channel planes, eg. "r=ch2;g=ch2;b=(ch4-ch5)*3", or a single expression for a grayscale
+// image. Expressions take chN, numbers, + - * /, parentheses, min(a, b) and max(a, b), working on samples as
+// decoded (10-bits counts, or calibrated values). Each output is compiled to a stack program, and evaluated
+// over blocks of pixels small enough to stay in cache, all outputs in the same pass
+class Composite
+{
+private:
+    // One program per output plane
+    std::vector<std::vector<CompositeInstruction>> programs;
+    // Channels read, sorted
+    std::vector<int> channels;
+    // Deepest stack any program needs
+    int stack_depth;
+
+public:
+    // Compile a composite definition. Throws on syntax errors
+    Composite(const std::string &definition);
+    // Channels the composite reads
+    const std::vector<int> &getChannels() const;
+    // 1 for grayscale, 3 for RGB
+    int getOutputCount() const;
+    // Evaluate over size pixels. planes[channel - 1] must be valid for every channel read, results are
+    // rounded and clamped to [0, maxValue], NAN giving 0
+    void evaluate(const std::vector<const uint16_t *> &planes, size_t size, const std::vector<uint16_t *> &outputs, uint16_t maxValue) const;
+};
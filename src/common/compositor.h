@@ -0,0 +1,14 @@
+#pragma once
+
+// Channels making up a false-color image
+struct FalseColorRecipe
+{
+    int red;
+    int green;
+    int blue;
+};
+
+// Default false-color recipes for each satellite
+const FalseColorRecipe NOAA_FALSE_COLOR = {2, 2, 1};
+const FalseColorRecipe METEOR_FALSE_COLOR = {3, 2, 1};
+const FalseColorRecipe METOP_FALSE_COLOR = {2, 2, 1};
@@ -0,0 +1,104 @@
+#include "equalizer.h"
+#include <algorithm>
+#include <mutex>
+#include <vector>
+#include "parallel.h"
+
+// Constructor
+HistogramEqualizer::HistogramEqualizer(int levels, int scale, bool ignoreZero) : nb_levels{levels}, scale{scale}, ignore_zero{ignoreZero}
+{
+    // Enough levels to cover any 16-bits value
+    level_counts.assign(UINT16_MAX / scale + 1, 0);
+
+    // Identity until a LUT gets built
+    lut.resize(level_counts.size());
+    for (size_t level = 0; level < lut.size(); level++)
+        lut[level] = level * scale;
+}
+
+// Add samples to the histogram. Can be called several times before building the LUT
+void HistogramEqualizer::accumulate(const uint16_t *data, size_t size)
+{
+    std::mutex merge_mutex;
+
+    // Each band counts into its own histogram, merged at the end
+    parallelBands(size, [&](size_t start, size_t end) {
+        std::vector<uint64_t> counts(level_counts.size(), 0);
+        for (size_t i = start; i < end; i++)
+            counts[sampleLevel(data[i])]++;
+
+        std::lock_guard<std::mutex> lock(merge_mutex);
+        for (size_t level = 0; level < level_counts.size(); level++)
+            level_counts[level] += counts[level];
+    });
+}
+
+// Build the LUT from everything accumulated so far
+void HistogramEqualizer::buildLUT()
+{
+    // Value range, from the lowest and highest levels present
+    int minLevel = 0, maxLevel = -1;
+    for (int level = ignore_zero ? 1 : 0; level < (int)level_counts.size(); level++)
+    {
+        if (level_counts[level] == 0)
+            continue;
+        if (maxLevel < 0)
+            minLevel = level;
+        maxLevel = level;
+    }
+
+    // Nothing to do on an empty or flat image, CImg leaves it untouched too
+    if (nb_levels <= 0 || maxLevel <= minLevel)
+        return;
+
+    const uint16_t vmin = minLevel * scale, vmax = maxLevel * scale;
+
+    // Fold levels into nb_levels bins, the same way CImg's get_histogram() does
+    std::vector<uint64_t> histogram(nb_levels, 0);
+    for (int level = minLevel; level <= maxLevel; level++)
+    {
+        uint16_t value = level * scale;
+        unsigned int bin = value == vmax ? nb_levels - 1 : (unsigned int)((value - (double)vmin) * nb_levels / ((double)vmax - vmin));
+        histogram[bin] += level_counts[level];
+    }
+
+    // Cumulative histogram
+    uint64_t cumul = 0;
+    for (int pos = 0; pos < nb_levels; pos++)
+    {
+        cumul += histogram[pos];
+        histogram[pos] = cumul;
+    }
+
+    // Same mapping as CImg's equalize(), down to the integer rounding
+    for (int level = minLevel; level <= maxLevel; level++)
+    {
+        uint16_t value = level * scale;
+        int pos = (int)((value - vmin) * (nb_levels - 1.) / (vmax - vmin));
+        lut[level] = (uint16_t)(vmin + (vmax - vmin) * histogram[pos] / cumul);
+    }
+}
+
+// Apply the LUT to samples, in place
+void HistogramEqualizer::apply(uint16_t *data, size_t size) const
+{
+    parallelBands(size, [&](size_t start, size_t end) {
+        for (size_t i = start; i < end; i++)
+            data[i] = lut[sampleLevel(data[i])];
+    });
+}
+
+// Map a single sample
+uint16_t HistogramEqualizer::map(uint16_t value) const
+{
+    return lut[sampleLevel(value)];
+}
+
+// Equalize samples in place, in one go
+void equalizeSamples(uint16_t *data, size_t size, int levels, int scale, bool ignoreZero)
+{
+    HistogramEqualizer equalizer(levels, scale, ignoreZero);
+    equalizer.accumulate(data, size);
+    equalizer.buildLUT();
+    equalizer.apply(data, size);
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "hrpt.h"
+
+// Histogram equalization working on sample levels (value / scale) rather than 16-bits values.
+// With the decoders' HRPT_PIXEL_SCALE, that's the 10-bits domain. Samples are expected to be
+// multiples of scale, and results are then identical to CImg's equalize(levels) on the same data
+class HistogramEqualizer
+{
+private:
+    // Number of equalization levels, as in CImg
+    int nb_levels;
+    // Spacing between sample levels
+    int scale;
+    // Samples of 0 are no-data, left out of the histogram and kept at 0
+    bool ignore_zero;
+    // Sample count for each level
+    std::vector<uint64_t> level_counts;
+    // Output value for each level
+    std::vector<uint16_t> lut;
+
+    // Level of a scaled sample
+    int sampleLevel(uint16_t value) const
+    {
+        return value / scale;
+    }
+
+public:
+    // Constructor
+    HistogramEqualizer(int levels, int scale = HRPT_PIXEL_SCALE, bool ignoreZero = false);
+    // Add samples to the histogram. Can be called several times before building the LUT
+    void accumulate(const uint16_t *data, size_t size);
+    // Build the LUT from everything accumulated so far
+    void buildLUT();
+    // Apply the LUT to samples, in place
+    void apply(uint16_t *data, size_t size) const;
+    // Map a single sample
+    uint16_t map(uint16_t value) const;
+};
+
+// Equalize samples in place, in one go
+void equalizeSamples(uint16_t *data, size_t size, int levels, int scale = HRPT_PIXEL_SCALE, bool ignoreZero = false);
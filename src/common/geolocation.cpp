@@ -0,0 +1,245 @@
+#include "geolocation.h"
+#include <algorithm>
+#include <cmath>
+#include "parallel.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// WGS-84 ellipsoid, in km
+const double WGS84_A = 6378.137;
+const double WGS84_F = 1 / 298.257223563;
+const double WGS84_B = WGS84_A * (1 - WGS84_F);
+const double WGS84_E2 = WGS84_F * (2 - WGS84_F);
+// Rows interpolated per thread, at least
+const size_t GEOLOCATION_MIN_BAND = 64;
+// Cells reaching past this latitude are interpolated as 3D vectors, longitudes being meaningless around the poles
+const float GEOLOCATION_POLAR_LATITUDE = 80;
+
+// Evenly spaced positions up to count - 1, which is always included
+static std::vector<int> tiePositions(int count, int step)
+{
+    std::vector<int> positions;
+    for (int position = 0; position < count - 1; position += step)
+        positions.push_back(position);
+    positions.push_back(std::max(count - 1, 0));
+    return positions;
+}
+
+// Bring a longitude within 180° of a reference one
+inline float unwrapLongitude(float longitude, float reference)
+{
+    return reference + std::remainder(longitude - reference, 360.0f);
+}
+
+// Unit vector of a latitude / longitude, in degrees
+inline void toVector(float latitude, float longitude, double *vector)
+{
+    double phi = latitude * ORBIT_PI / 180, lambda = longitude * ORBIT_PI / 180;
+    vector[0] = std::cos(phi) * std::cos(lambda);
+    vector[1] = std::cos(phi) * std::sin(lambda);
+    vector[2] = std::sin(phi);
+}
+
+// Linear ramp from a (included) to b (excluded) over count pixels
+static void interpolateSegment(float a, float b, int count, float *output)
+{
+    const float step = (b - a) / count;
+    int i = 0;
+#if defined(__SSE2__)
+    const __m128 ramp = _mm_set_ps(3, 2, 1, 0);
+    const __m128 base = _mm_set1_ps(a), steps = _mm_set1_ps(step);
+    for (; i + 4 <= count; i += 4)
+        _mm_storeu_ps(&output[i], _mm_add_ps(base, _mm_mul_ps(_mm_add_ps(_mm_set1_ps(i), ramp), steps)));
+#endif
+    for (; i < count; i++)
+        output[i] = a + i * step;
+}
+
+// Wrap unwrapped longitudes back to [-180, 180). They never are more than a few turns away
+static void wrapLongitudes(float *longitudes, int count)
+{
+    int i = 0;
+#if defined(__SSE2__)
+    const __m128 half = _mm_set1_ps(180), turn = _mm_set1_ps(360), offset = _mm_set1_ps(64);
+    const __m128i offsetTurns = _mm_set1_epi32(64);
+    for (; i + 4 <= count; i += 4)
+    {
+        // Truncation is a floor once made positive
+        __m128 longitude = _mm_loadu_ps(&longitudes[i]);
+        __m128i turns = _mm_sub_epi32(_mm_cvttps_epi32(_mm_add_ps(_mm_div_ps(_mm_add_ps(longitude, half), turn), offset)), offsetTurns);
+        _mm_storeu_ps(&longitudes[i], _mm_sub_ps(longitude, _mm_mul_ps(_mm_cvtepi32_ps(turns), turn)));
+    }
+#endif
+    for (; i < count; i++)
+    {
+        int turns = (int)((longitudes[i] + 180.0f) / 360.0f + 64.0f) - 64;
+        longitudes[i] -= turns * 360.0f;
+    }
+}
+
+// Constructor, locating tie points. Row r was scanned at firstLineTimestamp + r * lineDuration,
+// and the scan covers +/- scanAngle degrees over scanWidth pixels (width if 0), pixel c being scan pixel c * columnStep
+Geolocation::Geolocation(const TLE &tle, double firstLineTimestamp, double lineDuration, int width, int rows, double scanAngle, int scanWidth, int columnStep)
+    : width{width}, rows{rows}, tie_columns{tiePositions(width, std::max(GEOLOCATION_TIE_STEP / columnStep, 1))}, tie_rows{tiePositions(rows, GEOLOCATION_TIE_STEP)}
+{
+    SGP4 sgp4(tle);
+    if (scanWidth <= 0)
+        scanWidth = width;
+    const double angleStep = scanWidth > 1 ? 2 * scanAngle / (scanWidth - 1) * ORBIT_PI / 180 : 0;
+    const double center = (scanWidth - 1) / 2.0;
+    // Squash the ellipsoid into a sphere of radius A
+    const double squash = WGS84_A / WGS84_B;
+
+    tie_latitudes.resize(tie_rows.size() * tie_columns.size());
+    tie_longitudes.resize(tie_rows.size() * tie_columns.size());
+    polar_cells.assign(std::max(tie_rows.size() - 1, (size_t)1) * std::max(tie_columns.size() - 1, (size_t)1), false);
+
+    for (size_t tieRow = 0; tieRow < tie_rows.size(); tieRow++)
+    {
+        double timestamp = firstLineTimestamp + tie_rows[tieRow] * lineDuration;
+        OrbitState state = sgp4.propagate(timestamp);
+        double gmst = greenwichSiderealTime(timestamp) * 180 / ORBIT_PI;
+        const double *r = state.position, *v = state.velocity;
+
+        // Scan frame : nadir, and the right of the track, both in TEME. The ellipsoid being symmetric
+        // around the Z axis, intersections can be done in TEME too, only longitudes need the Earth's rotation
+        double radius = std::sqrt(r[0] * r[0] + r[1] * r[1] + r[2] * r[2]);
+        double nadir[3] = {-r[0] / radius, -r[1] / radius, -r[2] / radius};
+        double radial = v[0] * nadir[0] + v[1] * nadir[1] + v[2] * nadir[2];
+        double along[3] = {v[0] - radial * nadir[0], v[1] - radial * nadir[1], v[2] - radial * nadir[2]};
+        double alongNorm = std::sqrt(along[0] * along[0] + along[1] * along[1] + along[2] * along[2]);
+        for (double &component : along)
+            component /= alongNorm;
+        double right[3] = {nadir[1] * along[2] - nadir[2] * along[1],
+                           nadir[2] * along[0] - nadir[0] * along[2],
+                           nadir[0] * along[1] - nadir[1] * along[0]};
+
+        for (size_t tieColumn = 0; tieColumn < tie_columns.size(); tieColumn++)
+        {
+            double angle = (center - (double)tie_columns[tieColumn] * columnStep) * angleStep;
+            double look[3];
+            for (int i = 0; i < 3; i++)
+                look[i] = std::cos(angle) * nadir[i] + std::sin(angle) * right[i];
+
+            // Line of sight against the ellipsoid, nearest intersection
+            double p[3] = {r[0], r[1], r[2] * squash};
+            double d[3] = {look[0], look[1], look[2] * squash};
+            double a = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+            double b = 2 * (p[0] * d[0] + p[1] * d[1] + p[2] * d[2]);
+            double c = p[0] * p[0] + p[1] * p[1] + p[2] * p[2] - WGS84_A * WGS84_A;
+            double discriminant = b * b - 4 * a * c;
+
+            size_t index = tieRow * tie_columns.size() + tieColumn;
+            if (discriminant < 0)
+            {
+                tie_latitudes[index] = tie_longitudes[index] = NAN;
+                continue;
+            }
+
+            double distance = (-b - std::sqrt(discriminant)) / (2 * a);
+            double x = r[0] + distance * look[0], y = r[1] + distance * look[1], z = r[2] + distance * look[2];
+
+            double latitude = std::atan2(z, (1 - WGS84_E2) * std::sqrt(x * x + y * y)) * 180 / ORBIT_PI;
+            double longitude = std::remainder(std::atan2(y, x) * 180 / ORBIT_PI - gmst, 360.0);
+
+            tie_latitudes[index] = latitude;
+            tie_longitudes[index] = longitude;
+        }
+    }
+
+    // Flag cells with a corner close to a pole
+    const size_t cellRows = std::max(tie_rows.size() - 1, (size_t)1), cellColumns = std::max(tie_columns.size() - 1, (size_t)1);
+    for (size_t cellRow = 0; cellRow < cellRows; cellRow++)
+    {
+        for (size_t cellColumn = 0; cellColumn < cellColumns; cellColumn++)
+        {
+            for (size_t tieRow : {cellRow, std::min(cellRow + 1, tie_rows.size() - 1)})
+                for (size_t tieColumn : {cellColumn, std::min(cellColumn + 1, tie_columns.size() - 1)})
+                    if (std::abs(tie_latitudes[tieRow * tie_columns.size() + tieColumn]) > GEOLOCATION_POLAR_LATITUDE)
+                        polar_cells[cellRow * cellColumns + cellColumn] = true;
+        }
+    }
+}
+
+// Interpolate the coordinates of a row's pixels
+void Geolocation::interpolateRow(int row, float *latitudes, float *longitudes) const
+{
+    const size_t tieCount = tie_columns.size();
+    const size_t cellColumns = std::max(tieCount - 1, (size_t)1);
+
+    // Tie rows around this one
+    size_t above = std::upper_bound(tie_rows.begin(), tie_rows.end(), row) - tie_rows.begin();
+    above = std::min(std::max(above, (size_t)1), tie_rows.size()) - 1;
+    size_t below = std::min(above + 1, tie_rows.size() - 1);
+    size_t cellRow = std::min(above, std::max(tie_rows.size(), (size_t)2) - 2);
+    float weight = below > above ? (float)(row - tie_rows[above]) / (tie_rows[below] - tie_rows[above]) : 0;
+
+    // Along track first, giving a row of tie points. Longitudes get unwrapped so neighbours are never more than 180° apart
+    std::vector<float> rowLatitudes(tieCount), rowLongitudes(tieCount);
+    for (size_t i = 0; i < tieCount; i++)
+    {
+        float latitudeAbove = tie_latitudes[above * tieCount + i], latitudeBelow = tie_latitudes[below * tieCount + i];
+        float longitudeAbove = tie_longitudes[above * tieCount + i];
+        float longitudeBelow = unwrapLongitude(tie_longitudes[below * tieCount + i], longitudeAbove);
+        rowLatitudes[i] = latitudeAbove + (latitudeBelow - latitudeAbove) * weight;
+        rowLongitudes[i] = longitudeAbove + (longitudeBelow - longitudeAbove) * weight;
+        if (i > 0)
+            rowLongitudes[i] = unwrapLongitude(rowLongitudes[i], rowLongitudes[i - 1]);
+    }
+
+    // Then along scan
+    for (size_t i = 0; i + 1 < tieCount; i++)
+    {
+        int start = tie_columns[i], count = tie_columns[i + 1] - start;
+        if (!polar_cells[cellRow * cellColumns + i])
+        {
+            interpolateSegment(rowLatitudes[i], rowLatitudes[i + 1], count, &latitudes[start]);
+            interpolateSegment(rowLongitudes[i], rowLongitudes[i + 1], count, &longitudes[start]);
+            continue;
+        }
+
+        // Close to a pole, interpolate the cell's corners as vectors
+        double corners[4][3];
+        toVector(tie_latitudes[above * tieCount + i], tie_longitudes[above * tieCount + i], corners[0]);
+        toVector(tie_latitudes[above * tieCount + i + 1], tie_longitudes[above * tieCount + i + 1], corners[1]);
+        toVector(tie_latitudes[below * tieCount + i], tie_longitudes[below * tieCount + i], corners[2]);
+        toVector(tie_latitudes[below * tieCount + i + 1], tie_longitudes[below * tieCount + i + 1], corners[3]);
+        for (int pixel = 0; pixel < count; pixel++)
+        {
+            double u = (double)pixel / count, vector[3];
+            for (int axis = 0; axis < 3; axis++)
+            {
+                double left = corners[0][axis] + (corners[2][axis] - corners[0][axis]) * weight;
+                double right = corners[1][axis] + (corners[3][axis] - corners[1][axis]) * weight;
+                vector[axis] = left + (right - left) * u;
+            }
+            latitudes[start + pixel] = std::atan2(vector[2], std::hypot(vector[0], vector[1])) * 180 / ORBIT_PI;
+            longitudes[start + pixel] = std::atan2(vector[1], vector[0]) * 180 / ORBIT_PI;
+        }
+    }
+    latitudes[width - 1] = rowLatitudes[tieCount - 1];
+    longitudes[width - 1] = rowLongitudes[tieCount - 1];
+
+    wrapLongitudes(longitudes, width);
+}
+
+// Interpolate whole width * rows latitude and longitude planes, in parallel
+void Geolocation::interpolatePlanes(float *latitudes, float *longitudes) const
+{
+    auto interpolateBand = [&](size_t start, size_t end) {
+        for (size_t row = start; row < end; row++)
+            interpolateRow(row, &latitudes[row * width], &longitudes[row * width]);
+    };
+    parallelBands(rows, interpolateBand, GEOLOCATION_MIN_BAND);
+}
+
+int Geolocation::getWidth() const
+{
+    return width;
+}
+
+int Geolocation::getRows() const
+{
+    return rows;
+}
@@ -0,0 +1,40 @@
+#pragma once
+#include <vector>
+#include "orbit.h"
+
+// Pixels between geolocation tie points, both along scan and along track. Along scan, that is scan pixels, so previews
+// thinning columns out keep tie points as close on the ground
+#define GEOLOCATION_TIE_STEP 16
+// Half scan angles, in degrees
+#define AVHRR_SCAN_ANGLE 55.37
+#define MSUMR_SCAN_ANGLE 55.4
+
+// Latitude / longitude of every pixel of a pass, in degrees. Only a sparse grid of tie points is located
+// exactly (SGP4, then the line of sight against the WGS-84 ellipsoid), the rest is bilinearly interpolated,
+// as vectors around the poles. Pixel 0 is assumed to be on the right of the ground track, scanning right to left.
+// Pixels looking past the horizon, if any, get NAN
+class Geolocation
+{
+private:
+    int width;
+    int rows;
+    // Pixel columns and rows of the tie points, always including the last ones
+    std::vector<int> tie_columns;
+    std::vector<int> tie_rows;
+    // Tie point coordinates, tie_rows x tie_columns
+    std::vector<float> tie_latitudes;
+    std::vector<float> tie_longitudes;
+    // Cells between tie points that are close to a pole, and can't be interpolated in latitude / longitude
+    std::vector<bool> polar_cells;
+
+public:
+    // Constructor, locating tie points. Row r was scanned at firstLineTimestamp + r * lineDuration,
+    // and the scan covers +/- scanAngle degrees over scanWidth pixels (width if 0), pixel c being scan pixel c * columnStep
+    Geolocation(const TLE &tle, double firstLineTimestamp, double lineDuration, int width, int rows, double scanAngle, int scanWidth = 0, int columnStep = 1);
+    // Interpolate the coordinates of a row's pixels
+    void interpolateRow(int row, float *latitudes, float *longitudes) const;
+    // Interpolate whole width * rows latitude and longitude planes, in parallel
+    void interpolatePlanes(float *latitudes, float *longitudes) const;
+    int getWidth() const;
+    int getRows() const;
+};
@@ -0,0 +1,28 @@
+#pragma once
+#include <cmath>
+
+// AVHRR and MSU-MR samples are 10-bits wide
+#define HRPT_PIXEL_LEVELS 1024
+// Scale applied to samples so they span the 16-bits output range
+#define HRPT_PIXEL_SCALE 60
+
+// Lines of a pass to decode : every step-th one of [first, last), last < 0 meaning up to the end. Times, unless NAN,
+// narrow that down to lines scanned within [startTime, endTime] (UNIX timestamps), for decoders with line timecodes.
+// Decoders seek straight to the first line needed and stop after the last one
+struct LineSelection
+{
+    int first;
+    int last;
+    int step;
+    double startTime;
+    double endTime;
+};
+
+// The whole pass, line after line
+const LineSelection HRPT_WHOLE_PASS = {0, -1, 1, NAN, NAN};
+
+// Whether a selection keeps every line
+inline bool selectsWholePass(const LineSelection &selection)
+{
+    return selection.first <= 0 && selection.last < 0 && selection.step == 1 && std::isnan(selection.startTime) && std::isnan(selection.endTime);
+}
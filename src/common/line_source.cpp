@@ -0,0 +1,39 @@
+#include "line_source.h"
+#include <algorithm>
+#include <vector>
+
+// Read a whole channel (1-based) of a source into a width * rows plane, multiplying samples by scale.
+// Missing rows are left blank
+void readPlane(const LineSource &source, int channel, uint16_t *plane, int scale)
+{
+    std::vector<uint16_t> line(source.width * source.channels);
+    for (int row = 0; row < source.rows; row++)
+    {
+        uint16_t *output = &plane[(size_t)row * source.width];
+        if (!source.readLine(row, line.data()))
+        {
+            std::fill_n(output, source.width, 0);
+            continue;
+        }
+
+        for (int pixel = 0; pixel < source.width; pixel++)
+            output[pixel] = line[pixel * source.channels + channel - 1] * scale;
+    }
+}
+
+// Keep every step-th pixel of a source's rows, for quick looks. Decoders thin rows out themselves, as they can skip reading them
+LineSource decimateColumns(const LineSource &source, int step)
+{
+    const int width = (source.width + step - 1) / step;
+    return {width, source.rows, source.channels, source.scale, [source, step, width](int row, uint16_t *samples) {
+                // Full rows are read into a buffer of each thread's own
+                thread_local std::vector<uint16_t> line;
+                line.resize(source.width * source.channels);
+                if (!source.readLine(row, line.data()))
+                    return false;
+
+                for (int pixel = 0; pixel < width; pixel++)
+                    std::copy_n(&line[(size_t)pixel * step * source.channels], source.channels, &samples[pixel * source.channels]);
+                return true;
+            }};
+}
@@ -0,0 +1,23 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+
+// A decoded pass seen as rows of raw, channel-interleaved samples (10-bits levels, or calibrated values).
+// Lets outputs walk a pass line by line rather than holding entire images
+struct LineSource
+{
+    int width;
+    int rows;
+    int channels;
+    // Multiplier bringing samples to the 16-bits output range
+    int scale;
+    // Read a row into width * channels samples. Returns false if that row holds no data
+    std::function<bool(int row, uint16_t *samples)> readLine;
+};
+
+// Read a whole channel (1-based) of a source into a width * rows plane, multiplying samples by scale.
+// Missing rows are left blank
+void readPlane(const LineSource &source, int channel, uint16_t *plane, int scale);
+
+// Keep every step-th pixel of a source's rows, for quick looks. Decoders thin rows out themselves, as they can skip reading them
+LineSource decimateColumns(const LineSource &source, int step);
@@ -0,0 +1,68 @@
+#include "mapped_file.h"
+#include <stdexcept>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+// Create (or truncate) a file of size bytes and map it. With keepContents, an existing file is opened
+// as is instead, and grown to size if needed
+MappedFile::MappedFile(const std::string &path, size_t size, bool keepContents) : mapping{nullptr}, size{size}
+{
+#ifdef _WIN32
+    file_handle = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, keepContents ? OPEN_ALWAYS : CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file_handle == INVALID_HANDLE_VALUE)
+        throw std::runtime_error("Could not open " + path + " for writing");
+
+    // Creating the mapping also sets the file size
+    mapping_handle = CreateFileMappingA(file_handle, nullptr, PAGE_READWRITE, (DWORD)((uint64_t)size >> 32), (DWORD)(size & 0xFFFFFFFF), nullptr);
+    if (mapping_handle != nullptr)
+        mapping = (uint8_t *)MapViewOfFile(mapping_handle, FILE_MAP_WRITE, 0, 0, size);
+    if (mapping == nullptr)
+    {
+        if (mapping_handle != nullptr)
+            CloseHandle(mapping_handle);
+        CloseHandle(file_handle);
+        throw std::runtime_error("Could not map " + path);
+    }
+#else
+    file_descriptor = open(path.c_str(), O_RDWR | O_CREAT | (keepContents ? 0 : O_TRUNC), 0644);
+    if (file_descriptor < 0)
+        throw std::runtime_error("Could not open " + path + " for writing");
+
+    void *address = MAP_FAILED;
+    if (ftruncate(file_descriptor, size) == 0)
+        address = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, file_descriptor, 0);
+    if (address == MAP_FAILED)
+    {
+        close(file_descriptor);
+        throw std::runtime_error("Could not map " + path);
+    }
+    mapping = (uint8_t *)address;
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+#ifdef _WIN32
+    UnmapViewOfFile(mapping);
+    CloseHandle(mapping_handle);
+    CloseHandle(file_handle);
+#else
+    munmap(mapping, size);
+    close(file_descriptor);
+#endif
+}
+
+uint8_t *MappedFile::data()
+{
+    return mapping;
+}
+
+size_t MappedFile::getSize()
+{
+    return size;
+}
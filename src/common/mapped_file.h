@@ -0,0 +1,28 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Output file of a fixed size, mapped in memory so it can be filled in place
+class MappedFile
+{
+private:
+    uint8_t *mapping;
+    size_t size;
+#ifdef _WIN32
+    void *file_handle;
+    void *mapping_handle;
+#else
+    int file_descriptor;
+#endif
+
+public:
+    // Create (or truncate) a file of size bytes and map it. With keepContents, an existing file is opened
+    // as is instead, and grown to size if needed
+    MappedFile(const std::string &path, size_t size, bool keepContents = false);
+    ~MappedFile();
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    uint8_t *data();
+    size_t getSize();
+};
@@ -0,0 +1,249 @@
+#include "mosaic.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include "orbit.h"
+
+// Bytes before the first tile, a whole page
+const size_t MOSAIC_HEADER_SIZE = 4096;
+const char MOSAIC_MAGIC[8] = {'H', 'R', 'P', 'T', 'M', 'O', 'S', '1'};
+
+// Header at the start of a mosaic file
+struct MosaicHeader
+{
+    char magic[8];
+    int32_t projection;
+    int32_t northPole;
+    double resolution;
+    int32_t channels;
+    int32_t scale;
+    int32_t merge;
+    int32_t passes;
+    // Tiles touched so far, min > max while there are none
+    int32_t minTileX;
+    int32_t minTileY;
+    int32_t maxTileX;
+    int32_t maxTileY;
+};
+
+// Read the settings of an existing mosaic. Returns false if there's none at path
+bool readMosaicSettings(const std::string &path, MosaicSettings &settings)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return false;
+
+    MosaicHeader header;
+    if (!file.read((char *)&header, sizeof(header)) || std::memcmp(header.magic, MOSAIC_MAGIC, sizeof(MOSAIC_MAGIC)) != 0)
+        throw std::runtime_error(path + " isn't a mosaic!");
+
+    settings = {(MapProjection)header.projection, header.northPole != 0, header.resolution, header.channels, header.scale, (MosaicMerge)header.merge};
+    return true;
+}
+
+// Open a mosaic, creating it if needed. Throws if an existing one was made from other channels or merge rule
+Mosaic::Mosaic(const std::string &path, const MosaicSettings &settings) : settings{settings}
+{
+    MosaicSettings existing;
+    bool exists = readMosaicSettings(path, existing);
+    if (exists)
+    {
+        if (existing.channels != settings.channels || existing.scale != settings.scale || existing.merge != settings.merge)
+            throw std::runtime_error(path + " was made from other channels, calibration or merge rule!");
+        this->settings = existing;
+    }
+    if (this->settings.merge == MERGE_NDVI && this->settings.channels < 2)
+        throw std::runtime_error("NDVI merging needs channels 1 and 2!");
+
+    grid = worldGrid(this->settings.projection, this->settings.northPole, this->settings.resolution);
+    tiles_across = (grid.width + MOSAIC_TILE_SIZE - 1) / MOSAIC_TILE_SIZE;
+    tiles_down = (grid.rows + MOSAIC_TILE_SIZE - 1) / MOSAIC_TILE_SIZE;
+    tile_bytes = (size_t)MOSAIC_TILE_SIZE * MOSAIC_TILE_SIZE * (this->settings.channels * sizeof(uint16_t) + sizeof(float));
+    file = std::make_unique<MappedFile>(path, MOSAIC_HEADER_SIZE + (size_t)tiles_across * tiles_down * tile_bytes, true);
+
+    if (!exists)
+    {
+        MosaicHeader *header = (MosaicHeader *)file->data();
+        std::memcpy(header->magic, MOSAIC_MAGIC, sizeof(MOSAIC_MAGIC));
+        header->projection = this->settings.projection;
+        header->northPole = this->settings.northPole;
+        header->resolution = this->settings.resolution;
+        header->channels = this->settings.channels;
+        header->scale = this->settings.scale;
+        header->merge = this->settings.merge;
+        header->passes = 0;
+        header->minTileX = header->minTileY = INT32_MAX;
+        header->maxTileX = header->maxTileY = -1;
+    }
+}
+
+uint16_t *Mosaic::tilePlane(int tileX, int tileY, int channel) const
+{
+    uint8_t *tile = file->data() + MOSAIC_HEADER_SIZE + ((size_t)tileY * tiles_across + tileX) * tile_bytes;
+    return (uint16_t *)tile + (size_t)(channel - 1) * MOSAIC_TILE_SIZE * MOSAIC_TILE_SIZE;
+}
+
+float *Mosaic::tileKeys(int tileX, int tileY) const
+{
+    return (float *)(tilePlane(tileX, tileY, settings.channels + 1));
+}
+
+// Merge a reprojected pass, from the pass' unscaled channel planes, every channel being needed. Row r of the
+// pass was scanned at firstLineTimestamp + r * lineDuration. Works on the tiles under the pass only
+void Mosaic::addPass(const Reprojection &reprojection, const std::vector<const uint16_t *> &planes, Resampling resampling,
+                     double firstLineTimestamp, double lineDuration, ThreadPool &pool)
+{
+    const MapGrid &passGrid = reprojection.getGrid();
+    if (passGrid.projection != grid.projection || passGrid.northPole != grid.northPole || passGrid.resolution != grid.resolution)
+        throw std::runtime_error("Pass and mosaic grids don't match!");
+
+    // Pass pixel (x, y) is mosaic pixel (x + offsetX, y + offsetY), both grids being aligned
+    const int offsetX = std::lround((passGrid.originX - grid.originX) / grid.resolution);
+    const int offsetY = std::lround((grid.originY - passGrid.originY) / grid.resolution);
+
+    std::vector<std::vector<uint16_t>> resampled(settings.channels);
+    for (int channel = 0; channel < settings.channels; channel++)
+    {
+        resampled[channel].resize((size_t)passGrid.width * passGrid.rows);
+        reprojection.resample(planes[channel], resampled[channel].data(), resampling, pool);
+    }
+    const std::vector<float> &sourceRows = reprojection.getSourceRows();
+
+    // The Sun only moves west during a pass, as far as we're concerned
+    double sunLatitude, sunLongitude;
+    subsolarPoint(firstLineTimestamp, sunLatitude, sunLongitude);
+    const double sinSun = std::sin(sunLatitude * ORBIT_PI / 180), cosSun = std::cos(sunLatitude * ORBIT_PI / 180);
+
+    // Merge key of a pass pixel, higher wins. Keys are offset to stay positive, 0 marking pixels no pass went to
+    auto pixelKey = [&](size_t index, int mosaicX, int mosaicY) -> float {
+        double timestamp = firstLineTimestamp + sourceRows[index] * lineDuration;
+        if (settings.merge == MERGE_NEWEST)
+            return timestamp / 60;
+
+        if (settings.merge == MERGE_NDVI)
+        {
+            float red = resampled[0][index], nearInfrared = resampled[1][index];
+            return 2 + (red + nearInfrared > 0 ? (nearInfrared - red) / (nearInfrared + red) : -1);
+        }
+
+        double latitude, longitude;
+        unproject(grid, grid.originX + mosaicX * grid.resolution, grid.originY - mosaicY * grid.resolution, latitude, longitude);
+        double hourAngle = (longitude - sunLongitude + (timestamp - firstLineTimestamp) * 360 / 86400) * ORBIT_PI / 180;
+        double phi = latitude * ORBIT_PI / 180;
+        return 100 + std::asin(std::sin(phi) * sinSun + std::cos(phi) * cosSun * std::cos(hourAngle)) * 180 / ORBIT_PI;
+    };
+
+    // One task per row of tiles, tasks never sharing a tile
+    MosaicHeader *header = (MosaicHeader *)file->data();
+    std::mutex header_mutex;
+    auto mergeTileRow = [&](int tileY) {
+        int start = std::max(tileY * MOSAIC_TILE_SIZE, offsetY);
+        int end = std::min({(tileY + 1) * MOSAIC_TILE_SIZE, offsetY + passGrid.rows, grid.rows});
+        int minTileX = INT32_MAX, maxTileX = -1;
+        for (int mosaicY = start; mosaicY < end; mosaicY++)
+        {
+            size_t passRow = (size_t)(mosaicY - offsetY) * passGrid.width;
+            for (int x = 0; x < passGrid.width; x++)
+            {
+                if (std::isnan(sourceRows[passRow + x]))
+                    continue;
+
+                // Pixels 0 in every channel are no data, like lines lost in a gap, and never cover older passes
+                bool noData = true;
+                for (int channel = 0; channel < settings.channels && noData; channel++)
+                    noData = resampled[channel][passRow + x] == 0;
+                if (noData)
+                    continue;
+
+                // Equirectangular grids wrap around
+                int mosaicX = x + offsetX;
+                if (grid.projection == PROJECTION_EQUIRECTANGULAR)
+                    mosaicX = ((mosaicX % grid.width) + grid.width) % grid.width;
+                else if (mosaicX < 0 || mosaicX >= grid.width)
+                    continue;
+
+                int tileX = mosaicX / MOSAIC_TILE_SIZE;
+                size_t offset = (size_t)(mosaicY % MOSAIC_TILE_SIZE) * MOSAIC_TILE_SIZE + mosaicX % MOSAIC_TILE_SIZE;
+                float *keys = tileKeys(tileX, tileY);
+                float key = pixelKey(passRow + x, mosaicX, mosaicY);
+                if (keys[offset] != 0 && key <= keys[offset])
+                    continue;
+
+                keys[offset] = key;
+                for (int channel = 0; channel < settings.channels; channel++)
+                    tilePlane(tileX, tileY, channel + 1)[offset] = resampled[channel][passRow + x];
+                minTileX = std::min(minTileX, tileX);
+                maxTileX = std::max(maxTileX, tileX);
+            }
+        }
+
+        if (maxTileX < 0)
+            return;
+        std::lock_guard<std::mutex> lock(header_mutex);
+        header->minTileX = std::min(header->minTileX, minTileX);
+        header->maxTileX = std::max(header->maxTileX, maxTileX);
+        header->minTileY = std::min(header->minTileY, tileY);
+        header->maxTileY = std::max(header->maxTileY, tileY);
+    };
+
+    int firstTileRow = std::max(offsetY, 0) / MOSAIC_TILE_SIZE;
+    int lastTileRow = (std::min(offsetY + passGrid.rows, grid.rows) - 1) / MOSAIC_TILE_SIZE;
+    std::vector<std::future<void>> results;
+    for (int tileY = firstTileRow; tileY <= lastTileRow; tileY++)
+        results.push_back(pool.submit([&, tileY] { mergeTileRow(tileY); }));
+    for (std::future<void> &result : results)
+        result.get();
+
+    header->passes++;
+}
+
+// Grid covering every tile touched so far, empty (0 x 0) if none
+MapGrid Mosaic::getExtent() const
+{
+    const MosaicHeader *header = (const MosaicHeader *)file->data();
+    MapGrid extent = grid;
+    if (header->maxTileX < header->minTileX)
+    {
+        extent.width = extent.rows = 0;
+        return extent;
+    }
+
+    extent.originX = grid.originX + header->minTileX * MOSAIC_TILE_SIZE * grid.resolution;
+    extent.originY = grid.originY - header->minTileY * MOSAIC_TILE_SIZE * grid.resolution;
+    extent.width = std::min((header->maxTileX + 1) * MOSAIC_TILE_SIZE, grid.width) - header->minTileX * MOSAIC_TILE_SIZE;
+    extent.rows = std::min((header->maxTileY + 1) * MOSAIC_TILE_SIZE, grid.rows) - header->minTileY * MOSAIC_TILE_SIZE;
+    return extent;
+}
+
+// Read a channel over the extent, 0 where no pass went
+void Mosaic::readPlane(int channel, uint16_t *plane) const
+{
+    const MosaicHeader *header = (const MosaicHeader *)file->data();
+    MapGrid extent = getExtent();
+    const int startX = header->minTileX * MOSAIC_TILE_SIZE, startY = header->minTileY * MOSAIC_TILE_SIZE;
+
+    for (int y = 0; y < extent.rows; y++)
+    {
+        int mosaicY = startY + y;
+        for (int x = 0; x < extent.width; x += MOSAIC_TILE_SIZE)
+        {
+            int mosaicX = startX + x;
+            const uint16_t *tile = tilePlane(mosaicX / MOSAIC_TILE_SIZE, mosaicY / MOSAIC_TILE_SIZE, channel);
+            std::copy_n(&tile[(size_t)(mosaicY % MOSAIC_TILE_SIZE) * MOSAIC_TILE_SIZE], std::min(MOSAIC_TILE_SIZE, extent.width - x), &plane[(size_t)y * extent.width + x]);
+        }
+    }
+}
+
+const MosaicSettings &Mosaic::getSettings() const
+{
+    return settings;
+}
+
+// Number of passes merged so far
+int Mosaic::getPassCount() const
+{
+    return ((const MosaicHeader *)file->data())->passes;
+}
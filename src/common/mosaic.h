@@ -0,0 +1,68 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "mapped_file.h"
+#include "reprojection.h"
+#include "thread_pool.h"
+
+// Pixels along a side of a mosaic tile
+#define MOSAIC_TILE_SIZE 256
+
+// Rules deciding which pass a mosaic pixel is taken from
+enum MosaicMerge
+{
+    MERGE_NEWEST,    // Most recent pass
+    MERGE_SUN_ANGLE, // Highest Sun elevation
+    MERGE_NDVI,      // Greenest, (ch2 - ch1) / (ch2 + ch1)
+};
+
+// What a mosaic is made of, fixed when it's created
+struct MosaicSettings
+{
+    MapProjection projection;
+    bool northPole;
+    // km per pixel, as given to Reprojection
+    double resolution;
+    int channels;
+    // Sample scale of the passes
+    int scale;
+    MosaicMerge merge;
+};
+
+// Read the settings of an existing mosaic. Returns false if there's none at path
+bool readMosaicSettings(const std::string &path, MosaicSettings &settings);
+
+// Map grid accumulator persisted in a memory-mapped file, passes being merged into it one at a time.
+// The file is tile-major, each tile holding its channel planes then a merge key per pixel, so a pass
+// only touches the tiles under it, and tiles nothing ever touched stay sparse on disk
+class Mosaic
+{
+private:
+    MosaicSettings settings;
+    // Grid of the whole mosaic
+    MapGrid grid;
+    int tiles_across;
+    int tiles_down;
+    size_t tile_bytes;
+    std::unique_ptr<MappedFile> file;
+
+    uint16_t *tilePlane(int tileX, int tileY, int channel) const;
+    float *tileKeys(int tileX, int tileY) const;
+
+public:
+    // Open a mosaic, creating it if needed. Throws if an existing one was made from other channels or merge rule
+    Mosaic(const std::string &path, const MosaicSettings &settings);
+    // Merge a reprojected pass, from the pass' unscaled channel planes, every channel being needed. Row r of the
+    // pass was scanned at firstLineTimestamp + r * lineDuration. Works on the tiles under the pass only
+    void addPass(const Reprojection &reprojection, const std::vector<const uint16_t *> &planes, Resampling resampling,
+                 double firstLineTimestamp, double lineDuration, ThreadPool &pool);
+    // Grid covering every tile touched so far, empty (0 x 0) if none
+    MapGrid getExtent() const;
+    // Read a channel over the extent, 0 where no pass went
+    void readPlane(int channel, uint16_t *plane) const;
+    const MosaicSettings &getSettings() const;
+    // Number of passes merged so far
+    int getPassCount() const;
+};
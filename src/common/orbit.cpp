@@ -0,0 +1,337 @@
+#include "orbit.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <stdexcept>
+#include <vector>
+
+// WGS-72 constants, as SGP4 expects them
+const double SGP4_EARTH_RADIUS = 6378.135;
+const double SGP4_XKE = 0.0743669161331734132;
+const double SGP4_J2 = 0.001082616;
+const double SGP4_J3 = -0.00000253881;
+const double SGP4_J4 = -0.00000165597;
+const double SGP4_J3OJ2 = SGP4_J3 / SGP4_J2;
+const double TWO_PI = 2 * ORBIT_PI;
+// Orbits slower than this need the deep-space model
+const double SGP4_DEEP_SPACE_PERIOD = 225;
+// UNIX epoch as a Julian date
+const double UNIX_EPOCH_JD = 2440587.5;
+
+// Days since 1970-01-01 of a civil date
+static long daysFromCivil(long year, int month, int day)
+{
+    year -= month <= 2;
+    long era = (year >= 0 ? year : year - 399) / 400;
+    long yoe = year - era * 400;
+    long doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+// UNIX timestamp of the start of a day of year (1-based)
+double dayOfYearTimestamp(int year, int dayOfYear)
+{
+    return (daysFromCivil(year, 1, 1) + dayOfYear - 1) * 86400.0;
+}
+
+// Year a UNIX timestamp falls in
+int timestampYear(double timestamp)
+{
+    long z = (long)std::floor(timestamp / 86400) + 719468;
+    long era = (z >= 0 ? z : z - 146096) / 146097;
+    long doe = z - era * 146097;
+    long yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    long doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    long mp = (5 * doy + 2) / 153;
+    return yoe + era * 400 + (mp >= 10);
+}
+
+// Greenwich mean sidereal time at a UNIX timestamp, in radians
+double greenwichSiderealTime(double timestamp)
+{
+    double tut1 = (timestamp / 86400.0 + UNIX_EPOCH_JD - 2451545.0) / 36525.0;
+    double gmst = -6.2e-6 * tut1 * tut1 * tut1 + 0.093104 * tut1 * tut1 + (876600.0 * 3600 + 8640184.812866) * tut1 + 67310.54841;
+    gmst = std::fmod(gmst * ORBIT_PI / 180 / 240.0, TWO_PI);
+    return gmst < 0 ? gmst + TWO_PI : gmst;
+}
+
+// Point where the Sun is at the zenith at a UNIX timestamp, in degrees. Low precision (0.01°) almanac formulas
+void subsolarPoint(double timestamp, double &latitude, double &longitude)
+{
+    double days = timestamp / 86400.0 + UNIX_EPOCH_JD - 2451545.0;
+    double meanLongitude = (280.460 + 0.9856474 * days) * ORBIT_PI / 180;
+    double meanAnomaly = (357.528 + 0.9856003 * days) * ORBIT_PI / 180;
+    double eclipticLongitude = meanLongitude + (1.915 * std::sin(meanAnomaly) + 0.020 * std::sin(2 * meanAnomaly)) * ORBIT_PI / 180;
+    double obliquity = (23.439 - 0.0000004 * days) * ORBIT_PI / 180;
+
+    double rightAscension = std::atan2(std::cos(obliquity) * std::sin(eclipticLongitude), std::cos(eclipticLongitude));
+    latitude = std::asin(std::sin(obliquity) * std::sin(eclipticLongitude)) * 180 / ORBIT_PI;
+    longitude = std::remainder((rightAscension - greenwichSiderealTime(timestamp)) * 180 / ORBIT_PI, 360.0);
+}
+
+// Parse a TLE field, throwing on malformed lines
+static double parseField(const std::string &line, size_t start, size_t length)
+{
+    if (line.size() < start + length)
+        throw std::runtime_error("Truncated TLE line : " + line);
+    return std::stod(line.substr(start, length));
+}
+
+// Parse the "assumed decimal point" exponential fields, eg " 12345-3"
+static double parseExponential(const std::string &line, size_t start)
+{
+    double mantissa = parseField(line, start + 1, 5) * 1e-5;
+    int exponent = parseField(line, start + 6, 2);
+    return (line[start] == '-' ? -mantissa : mantissa) * std::pow(10.0, exponent);
+}
+
+// Read a TLE from a file holding one or more of them, with or without name lines.
+// An empty name takes the first one, otherwise the first whose name contains it. Throws if none matches
+TLE readTLE(const std::string &path, const std::string &name)
+{
+    std::ifstream file(path);
+    if (!file)
+        throw std::runtime_error("Could not open TLE file " + path);
+
+    std::vector<std::string> lines;
+    std::string line;
+    while (std::getline(file, line))
+    {
+        while (!line.empty() && (line.back() == '\r' || line.back() == ' '))
+            line.pop_back();
+        lines.push_back(line);
+    }
+
+    for (size_t i = 0; i + 1 < lines.size(); i++)
+    {
+        const std::string &line1 = lines[i], &line2 = lines[i + 1];
+        if (line1.compare(0, 2, "1 ") != 0 || line2.compare(0, 2, "2 ") != 0)
+            continue;
+
+        // Name line, possibly in the 3LE "0 NAME" form
+        std::string tleName = i > 0 ? lines[i - 1] : "";
+        if (tleName.compare(0, 2, "0 ") == 0)
+            tleName = tleName.substr(2);
+        if (!name.empty() && tleName.find(name) == std::string::npos)
+            continue;
+
+        TLE tle;
+        tle.name = tleName;
+
+        int year = parseField(line1, 18, 2);
+        double day = parseField(line1, 20, 12);
+        tle.epoch = dayOfYearTimestamp(year < 57 ? 2000 + year : 1900 + year, 1) + (day - 1) * 86400;
+        tle.bstar = parseExponential(line1, 53);
+
+        tle.inclination = parseField(line2, 8, 8) * ORBIT_PI / 180;
+        tle.ascendingNode = parseField(line2, 17, 8) * ORBIT_PI / 180;
+        tle.eccentricity = parseField(line2, 26, 7) * 1e-7;
+        tle.argumentOfPerigee = parseField(line2, 34, 8) * ORBIT_PI / 180;
+        tle.meanAnomaly = parseField(line2, 43, 8) * ORBIT_PI / 180;
+        tle.meanMotion = parseField(line2, 52, 11);
+        return tle;
+    }
+
+    throw std::runtime_error(name.empty() ? "No TLE found in " + path : "No TLE matching " + name + " in " + path);
+}
+
+// Constructor, initializing the propagator from elements. Throws on deep-space orbits
+SGP4::SGP4(const TLE &tle) : bstar{tle.bstar}, ecco{tle.eccentricity}, argpo{tle.argumentOfPerigee}, inclo{tle.inclination},
+                             mo{tle.meanAnomaly}, nodeo{tle.ascendingNode}, epoch{tle.epoch}
+{
+    const double x2o3 = 2.0 / 3.0;
+    const double noKozai = tle.meanMotion * TWO_PI / 1440.0;
+
+    // Recover the original mean motion and semi-major axis from the Kozai elements
+    double eccsq = ecco * ecco;
+    double omeosq = 1 - eccsq;
+    double rteosq = std::sqrt(omeosq);
+    double cosio = std::cos(inclo);
+    double cosio2 = cosio * cosio;
+    double ak = std::pow(SGP4_XKE / noKozai, x2o3);
+    double d1 = 0.75 * SGP4_J2 * (3 * cosio2 - 1) / (rteosq * omeosq);
+    double del = d1 / (ak * ak);
+    double adel = ak * (1 - del * del - del * (1.0 / 3.0 + 134 * del * del / 81));
+    del = d1 / (adel * adel);
+    no_unkozai = noKozai / (1 + del);
+
+    if (TWO_PI / no_unkozai >= SGP4_DEEP_SPACE_PERIOD)
+        throw std::runtime_error("Deep-space orbits aren't supported");
+
+    double ao = std::pow(SGP4_XKE / no_unkozai, x2o3);
+    double sinio = std::sin(inclo);
+    double po = ao * omeosq;
+    double con42 = 1 - 5 * cosio2;
+    con41 = -con42 - cosio2 - cosio2;
+    double posq = po * po;
+    double rp = ao * (1 - ecco);
+
+    // Low perigees use a simplified drag model
+    isimp = rp < 220 / SGP4_EARTH_RADIUS + 1;
+
+    double sfour = 78 / SGP4_EARTH_RADIUS + 1;
+    double qzms24 = std::pow((120 - 78) / SGP4_EARTH_RADIUS, 4);
+    double perige = (rp - 1) * SGP4_EARTH_RADIUS;
+    if (perige < 156)
+    {
+        sfour = perige < 98 ? 20 : perige - 78;
+        qzms24 = std::pow((120 - sfour) / SGP4_EARTH_RADIUS, 4);
+        sfour = sfour / SGP4_EARTH_RADIUS + 1;
+    }
+
+    double pinvsq = 1 / posq;
+    double tsi = 1 / (ao - sfour);
+    eta = ao * ecco * tsi;
+    double etasq = eta * eta;
+    double eeta = ecco * eta;
+    double psisq = std::fabs(1 - etasq);
+    double coef = qzms24 * std::pow(tsi, 4);
+    double coef1 = coef / std::pow(psisq, 3.5);
+    double cc2 = coef1 * no_unkozai * (ao * (1 + 1.5 * etasq + eeta * (4 + etasq)) + 0.375 * SGP4_J2 * tsi / psisq * con41 * (8 + 3 * etasq * (8 + etasq)));
+    cc1 = bstar * cc2;
+    double cc3 = ecco > 1e-4 ? -2 * coef * tsi * SGP4_J3OJ2 * no_unkozai * sinio / ecco : 0;
+    x1mth2 = 1 - cosio2;
+    cc4 = 2 * no_unkozai * coef1 * ao * omeosq *
+          (eta * (2 + 0.5 * etasq) + ecco * (0.5 + 2 * etasq) -
+           SGP4_J2 * tsi / (ao * psisq) * (-3 * con41 * (1 - 2 * eeta + etasq * (1.5 - 0.5 * eeta)) + 0.75 * x1mth2 * (2 * etasq - eeta * (1 + etasq)) * std::cos(2 * argpo)));
+    cc5 = 2 * coef1 * ao * omeosq * (1 + 2.75 * (etasq + eeta) + eeta * etasq);
+
+    // Secular rates
+    double cosio4 = cosio2 * cosio2;
+    double temp1 = 1.5 * SGP4_J2 * pinvsq * no_unkozai;
+    double temp2 = 0.5 * temp1 * SGP4_J2 * pinvsq;
+    double temp3 = -0.46875 * SGP4_J4 * pinvsq * pinvsq * no_unkozai;
+    mdot = no_unkozai + 0.5 * temp1 * rteosq * con41 + 0.0625 * temp2 * rteosq * (13 - 78 * cosio2 + 137 * cosio4);
+    argpdot = -0.5 * temp1 * con42 + 0.0625 * temp2 * (7 - 114 * cosio2 + 395 * cosio4) + temp3 * (3 - 36 * cosio2 + 49 * cosio4);
+    double xhdot1 = -temp1 * cosio;
+    nodedot = xhdot1 + (0.5 * temp2 * (4 - 19 * cosio2) + 2 * temp3 * (3 - 7 * cosio2)) * cosio;
+    omgcof = bstar * cc3 * std::cos(argpo);
+    xmcof = ecco > 1e-4 ? -x2o3 * coef * bstar / eeta : 0;
+    nodecf = 3.5 * omeosq * xhdot1 * cc1;
+    t2cof = 1.5 * cc1;
+    xlcof = -0.25 * SGP4_J3OJ2 * sinio * (3 + 5 * cosio) / (std::fabs(cosio + 1) > 1.5e-12 ? 1 + cosio : 1.5e-12);
+    aycof = -0.5 * SGP4_J3OJ2 * sinio;
+    delmo = std::pow(1 + eta * std::cos(mo), 3);
+    sinmao = std::sin(mo);
+    x7thm1 = 7 * cosio2 - 1;
+
+    d2 = d3 = d4 = t3cof = t4cof = t5cof = 0;
+    if (!isimp)
+    {
+        double cc1sq = cc1 * cc1;
+        d2 = 4 * ao * tsi * cc1sq;
+        double temp = d2 * tsi * cc1 / 3;
+        d3 = (17 * ao + sfour) * temp;
+        d4 = 0.5 * temp * ao * tsi * (221 * ao + 31 * sfour) * cc1;
+        t3cof = d2 + 2 * cc1sq;
+        t4cof = 0.25 * (3 * d3 + cc1 * (12 * d2 + 10 * cc1sq));
+        t5cof = 0.2 * (3 * d4 + 12 * cc1 * d3 + 6 * d2 * d2 + 15 * cc1sq * (2 * d2 + cc1sq));
+    }
+}
+
+// Satellite state at a UNIX timestamp
+OrbitState SGP4::propagate(double timestamp) const
+{
+    const double t = (timestamp - epoch) / 60.0;
+
+    // Secular gravity and atmospheric drag
+    double xmdf = mo + mdot * t;
+    double argpdf = argpo + argpdot * t;
+    double nodedf = nodeo + nodedot * t;
+    double argpm = argpdf;
+    double mm = xmdf;
+    double t2 = t * t;
+    double nodem = nodedf + nodecf * t2;
+    double tempa = 1 - cc1 * t;
+    double tempe = bstar * cc4 * t;
+    double templ = t2cof * t2;
+
+    if (!isimp)
+    {
+        double delomg = omgcof * t;
+        double delm = xmcof * (std::pow(1 + eta * std::cos(xmdf), 3) - delmo);
+        mm = xmdf + delomg + delm;
+        argpm = argpdf - delomg - delm;
+        double t3 = t2 * t, t4 = t3 * t;
+        tempa = tempa - d2 * t2 - d3 * t3 - d4 * t4;
+        tempe = tempe + bstar * cc5 * (std::sin(mm) - sinmao);
+        templ = templ + t3cof * t3 + t4 * (t4cof + t * t5cof);
+    }
+
+    double am = std::pow(SGP4_XKE / no_unkozai, 2.0 / 3.0) * tempa * tempa;
+    double nm = SGP4_XKE / std::pow(am, 1.5);
+    double em = std::max(ecco - tempe, 1e-6);
+    mm = mm + no_unkozai * templ;
+    double xlm = mm + argpm + nodem;
+    nodem = std::fmod(nodem, TWO_PI);
+    argpm = std::fmod(argpm, TWO_PI);
+    xlm = std::fmod(xlm, TWO_PI);
+    mm = std::fmod(xlm - argpm - nodem, TWO_PI);
+
+    // Long period periodics
+    double sinip = std::sin(inclo), cosip = std::cos(inclo);
+    double axnl = em * std::cos(argpm);
+    double temp = 1 / (am * (1 - em * em));
+    double aynl = em * std::sin(argpm) + temp * aycof;
+    double xl = mm + argpm + nodem + temp * xlcof * axnl;
+
+    // Kepler's equation
+    double u = std::fmod(xl - nodem, TWO_PI);
+    double eo1 = u, tem5 = 9999.9, sineo1 = 0, coseo1 = 0;
+    for (int ktr = 1; std::fabs(tem5) >= 1e-12 && ktr <= 10; ktr++)
+    {
+        sineo1 = std::sin(eo1);
+        coseo1 = std::cos(eo1);
+        tem5 = (u - aynl * coseo1 + axnl * sineo1 - eo1) / (1 - coseo1 * axnl - sineo1 * aynl);
+        tem5 = std::max(std::min(tem5, 0.95), -0.95);
+        eo1 += tem5;
+    }
+
+    // Short period periodics
+    double ecose = axnl * coseo1 + aynl * sineo1;
+    double esine = axnl * sineo1 - aynl * coseo1;
+    double el2 = axnl * axnl + aynl * aynl;
+    double pl = am * (1 - el2);
+    if (pl < 0)
+        throw std::runtime_error("SGP4 diverged, the TLE is probably too old");
+
+    double rl = am * (1 - ecose);
+    double rdotl = std::sqrt(am) * esine / rl;
+    double rvdotl = std::sqrt(pl) / rl;
+    double betal = std::sqrt(1 - el2);
+    temp = esine / (1 + betal);
+    double sinu = am / rl * (sineo1 - aynl - axnl * temp);
+    double cosu = am / rl * (coseo1 - axnl + aynl * temp);
+    double su = std::atan2(sinu, cosu);
+    double sin2u = (cosu + cosu) * sinu;
+    double cos2u = 1 - 2 * sinu * sinu;
+    temp = 1 / pl;
+    double temp1 = 0.5 * SGP4_J2 * temp;
+    double temp2 = temp1 * temp;
+
+    double mrt = rl * (1 - 1.5 * temp2 * betal * con41) + 0.5 * temp1 * x1mth2 * cos2u;
+    su = su - 0.25 * temp2 * x7thm1 * sin2u;
+    double xnode = nodem + 1.5 * temp2 * cosip * sin2u;
+    double xinc = inclo + 1.5 * temp2 * cosip * sinip * cos2u;
+    double mvt = rdotl - nm * temp1 * x1mth2 * sin2u / SGP4_XKE;
+    double rvdot = rvdotl + nm * temp1 * (x1mth2 * cos2u + 1.5 * con41) / SGP4_XKE;
+
+    // Orientation vectors
+    double sinsu = std::sin(su), cossu = std::cos(su);
+    double snod = std::sin(xnode), cnod = std::cos(xnode);
+    double sini = std::sin(xinc), cosi = std::cos(xinc);
+    double xmx = -snod * cosi, xmy = cnod * cosi;
+    double ux = xmx * sinsu + cnod * cossu, uy = xmy * sinsu + snod * cossu, uz = sini * sinsu;
+    double vx = xmx * cossu - cnod * sinsu, vy = xmy * cossu - snod * sinsu, vz = sini * cossu;
+
+    const double velocityUnit = SGP4_EARTH_RADIUS * SGP4_XKE / 60.0;
+    OrbitState state;
+    state.position[0] = mrt * ux * SGP4_EARTH_RADIUS;
+    state.position[1] = mrt * uy * SGP4_EARTH_RADIUS;
+    state.position[2] = mrt * uz * SGP4_EARTH_RADIUS;
+    state.velocity[0] = (mvt * ux + rvdot * vx) * velocityUnit;
+    state.velocity[1] = (mvt * uy + rvdot * vy) * velocityUnit;
+    state.velocity[2] = (mvt * uz + rvdot * vz) * velocityUnit;
+    return state;
+}
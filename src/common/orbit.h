@@ -0,0 +1,61 @@
+#pragma once
+#include <string>
+
+// Pi, M_PI not being standard C++
+const double ORBIT_PI = 3.14159265358979323846;
+
+// Two-line element set, angles in radians
+struct TLE
+{
+    std::string name;
+    // Epoch, as a UNIX timestamp
+    double epoch;
+    double inclination;
+    double ascendingNode;
+    double eccentricity;
+    double argumentOfPerigee;
+    double meanAnomaly;
+    // Revolutions per day
+    double meanMotion;
+    double bstar;
+};
+
+// Read a TLE from a file holding one or more of them, with or without name lines.
+// An empty name takes the first one, otherwise the first whose name contains it. Throws if none matches
+TLE readTLE(const std::string &path, const std::string &name = "");
+
+// Position and velocity in the TEME frame, in km and km/s
+struct OrbitState
+{
+    double position[3];
+    double velocity[3];
+};
+
+// SGP4 propagator (Vallado's revision, WGS-72 constants), near-Earth orbits only.
+// That covers every LEO weather satellite, deep-space SDP4 isn't implemented
+class SGP4
+{
+private:
+    // Initialized elements
+    double bstar, ecco, argpo, inclo, mo, no_unkozai, nodeo;
+    double epoch;
+    // Secular rates and drag coefficients
+    bool isimp;
+    double aycof, con41, cc1, cc4, cc5, d2, d3, d4, delmo, eta, argpdot, omgcof, sinmao;
+    double t2cof, t3cof, t4cof, t5cof, x1mth2, x7thm1, mdot, nodedot, xlcof, xmcof, nodecf;
+
+public:
+    // Constructor, initializing the propagator from elements. Throws on deep-space orbits
+    SGP4(const TLE &tle);
+    // Satellite state at a UNIX timestamp
+    OrbitState propagate(double timestamp) const;
+};
+
+// Greenwich mean sidereal time at a UNIX timestamp, in radians
+double greenwichSiderealTime(double timestamp);
+// Point where the Sun is at the zenith at a UNIX timestamp, in degrees. Low precision (0.01°) almanac formulas
+void subsolarPoint(double timestamp, double &latitude, double &longitude);
+// UNIX timestamp of the start of a day of year (1-based)
+double dayOfYearTimestamp(int year, int dayOfYear);
+// Year a UNIX timestamp falls in
+int timestampYear(double timestamp);
@@ -0,0 +1,60 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <future>
+#include <thread>
+#include <vector>
+#include "thread_pool.h"
+
+// Smallest band worth its own thread
+const size_t PARALLEL_MIN_BAND = 1 << 16;
+
+// Split [0, count) in contiguous bands, one per hardware thread, and process them in parallel.
+// function(start, end) is called once per band, and everything is joined before returning.
+// Pool tasks are already spread over every core, so from a pool worker everything runs inline
+template <typename Function>
+void parallelBands(size_t count, Function function, size_t minBandSize = PARALLEL_MIN_BAND)
+{
+    size_t threadCount = std::max(1u, std::thread::hardware_concurrency());
+    threadCount = std::min(threadCount, (count + minBandSize - 1) / std::max<size_t>(minBandSize, 1));
+
+    // Not worth spawning anything
+    if (threadCount <= 1 || ThreadPool::onWorkerThread())
+    {
+        if (count > 0)
+            function((size_t)0, count);
+        return;
+    }
+
+    std::vector<std::thread> threads;
+    size_t bandSize = (count + threadCount - 1) / threadCount;
+    for (size_t start = 0; start < count; start += bandSize)
+        threads.emplace_back(function, start, std::min(start + bandSize, count));
+
+    for (std::thread &thread : threads)
+        thread.join();
+}
+
+// Same, bands being tasks of pool. The caller helps with them while it waits, so this is safe from the pool's own tasks too
+template <typename Function>
+void parallelBands(size_t count, Function function, ThreadPool &pool, size_t minBandSize = PARALLEL_MIN_BAND)
+{
+    size_t bandCount = std::min<size_t>(pool.getThreadCount(), (count + minBandSize - 1) / std::max<size_t>(minBandSize, 1));
+    if (bandCount <= 1)
+    {
+        if (count > 0)
+            function((size_t)0, count);
+        return;
+    }
+
+    std::vector<std::future<void>> results;
+    size_t bandSize = (count + bandCount - 1) / bandCount;
+    for (size_t start = 0; start < count; start += bandSize)
+        results.push_back(pool.submit([=] { function(start, std::min(start + bandSize, count)); }));
+
+    // Bands use the caller's data, let them all finish before reporting errors
+    for (std::future<void> &result : results)
+        pool.wait(result);
+    for (std::future<void> &result : results)
+        result.get();
+}
@@ -0,0 +1,95 @@
+#include "plane_cache.h"
+#include <algorithm>
+#include "parallel.h"
+
+// Rows read per thread, at least
+const size_t PLANE_CACHE_MIN_BAND = 256;
+
+// Read the requested channels from a source, in a single parallel pass over its lines. Statistics of
+// every channel, if given, are gathered along the way
+PlaneCache::PlaneCache(const LineSource &source, const std::vector<int> &neededChannels, PassStatistics *statistics)
+    : width{source.width}, rows{source.rows}, channels{source.channels}, scale{source.scale}
+{
+    planes.resize(channels);
+    for (int channel : neededChannels)
+        if (channel >= 1 && channel <= channels)
+            planes[channel - 1].resize((size_t)width * rows);
+
+    // Each band deinterleaves its own rows, with its own accumulators
+    auto readBand = [&](size_t start, size_t end) {
+        std::vector<uint16_t> line(width * channels);
+        std::vector<ChannelStatistics> accumulators;
+        if (statistics != nullptr)
+            accumulators = statistics->makeAccumulators();
+
+        for (size_t row = start; row < end; row++)
+        {
+            // Missing rows stay blank, and are left out of statistics
+            if (!source.readLine(row, line.data()))
+                std::fill(line.begin(), line.end(), 0);
+            else if (statistics != nullptr)
+                statistics->accumulateLine(accumulators, line.data(), width);
+
+            for (int channel = 0; channel < channels; channel++)
+            {
+                if (planes[channel].empty())
+                    continue;
+
+                uint16_t *plane = &planes[channel][row * width];
+                for (int pixel = 0; pixel < width; pixel++)
+                    plane[pixel] = line[pixel * channels + channel];
+            }
+        }
+
+        if (statistics != nullptr)
+            statistics->merge(accumulators);
+    };
+    parallelBands(rows, readBand, PLANE_CACHE_MIN_BAND);
+}
+
+// Take ready-made width * rows planes, one per channel, empty for those that aren't needed
+PlaneCache::PlaneCache(int width, int rows, int scale, std::vector<std::vector<uint16_t>> planes)
+    : width{width}, rows{rows}, channels{(int)planes.size()}, scale{scale}, planes{std::move(planes)}
+{
+}
+
+// Source reading back from the cache. Channels that weren't cached read as 0
+LineSource PlaneCache::getLineSource()
+{
+    return {width, rows, channels, scale, [this](int row, uint16_t *samples) {
+                for (int channel = 0; channel < channels; channel++)
+                {
+                    if (planes[channel].empty())
+                    {
+                        for (int pixel = 0; pixel < width; pixel++)
+                            samples[pixel * channels + channel] = 0;
+                        continue;
+                    }
+
+                    const uint16_t *plane = &planes[channel][(size_t)row * width];
+                    for (int pixel = 0; pixel < width; pixel++)
+                        samples[pixel * channels + channel] = plane[pixel];
+                }
+                return true;
+            }};
+}
+
+// Copy a cached plane, multiplying samples by scale
+void PlaneCache::decodePlane(int channel, uint16_t *plane, int scale)
+{
+    const std::vector<uint16_t> &cached = planes[channel - 1];
+    if (cached.empty())
+    {
+        std::fill_n(plane, (size_t)width * rows, 0);
+        return;
+    }
+
+    for (size_t i = 0; i < cached.size(); i++)
+        plane[i] = cached[i] * scale;
+}
+
+// Cached plane of a channel, nullptr if it wasn't asked for
+const uint16_t *PlaneCache::getPlane(int channel) const
+{
+    return planes[channel - 1].empty() ? nullptr : planes[channel - 1].data();
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+#include "line_source.h"
+#include "statistics.h"
+
+// Unscaled channel planes, decoded once and kept in memory so several products can be rendered from them
+class PlaneCache
+{
+private:
+    int width;
+    int rows;
+    int channels;
+    // Scale of the source samples
+    int scale;
+    // One plane per channel, empty if that channel wasn't asked for
+    std::vector<std::vector<uint16_t>> planes;
+
+public:
+    // Read the requested channels from a source, in a single parallel pass over its lines. Statistics of
+    // every channel, if given, are gathered along the way
+    PlaneCache(const LineSource &source, const std::vector<int> &neededChannels, PassStatistics *statistics = nullptr);
+    // Take ready-made width * rows planes, one per channel, empty for those that aren't needed
+    PlaneCache(int width, int rows, int scale, std::vector<std::vector<uint16_t>> planes);
+    // Source reading back from the cache. Channels that weren't cached read as 0
+    LineSource getLineSource();
+    // Copy a cached plane, multiplying samples by scale
+    void decodePlane(int channel, uint16_t *plane, int scale);
+    // Cached plane of a channel, nullptr if it wasn't asked for
+    const uint16_t *getPlane(int channel) const;
+};
@@ -0,0 +1,165 @@
+#include "png_writer.h"
+#include <csetjmp>
+#include <stdexcept>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Does this orientation output the last row first?
+bool orientationReversesRows(Orientation orientation)
+{
+    return orientation == ORIENTATION_ROTATE_180 || orientation == ORIENTATION_FLIP_VERTICAL;
+}
+
+// Does this orientation reverse pixels within rows?
+bool orientationReversesPixels(Orientation orientation)
+{
+    return orientation == ORIENTATION_ROTATE_180 || orientation == ORIENTATION_FLIP_HORIZONTAL;
+}
+
+// Swap a sample to big-endian, as PNG wants it
+inline uint16_t swapBytes(uint16_t value)
+{
+    return value << 8 | value >> 8;
+}
+
+// Reverse a row of samples
+void reverseSamples(const uint16_t *input, uint16_t *output, int width)
+{
+    int pixel = 0;
+
+#if defined(__SSE2__)
+    // 8 samples at a time, read from the end
+    for (; pixel + 8 <= width; pixel += 8)
+    {
+        __m128i samples = _mm_loadu_si128((const __m128i *)&input[width - pixel - 8]);
+        samples = _mm_shuffle_epi32(samples, _MM_SHUFFLE(0, 1, 2, 3));
+        samples = _mm_shufflelo_epi16(samples, _MM_SHUFFLE(2, 3, 0, 1));
+        samples = _mm_shufflehi_epi16(samples, _MM_SHUFFLE(2, 3, 0, 1));
+        _mm_storeu_si128((__m128i *)&output[pixel], samples);
+    }
+#endif
+
+    for (; pixel < width; pixel++)
+        output[pixel] = input[width - pixel - 1];
+}
+
+// Constructor, channels being 1 (grayscale) or 3 (RGB)
+PNGWriter::PNGWriter(const std::string &path, int width, int height, int channels, Orientation orientation) : png_ptr{nullptr},
+                                                                                                            info_ptr{nullptr},
+                                                                                                            width{width},
+                                                                                                            height{height},
+                                                                                                            channels{channels},
+                                                                                                            orientation{orientation},
+                                                                                                            rows_written{0}
+{
+    if (channels != 1 && channels != 3)
+        throw std::runtime_error("PNG output needs 1 or 3 channels");
+
+    output_file = std::fopen(path.c_str(), "wb");
+    if (output_file == nullptr)
+        throw std::runtime_error("Could not open " + path + " for writing");
+
+    png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    if (png_ptr != nullptr)
+        info_ptr = png_create_info_struct(png_ptr);
+    if (info_ptr == nullptr)
+    {
+        png_destroy_write_struct(&png_ptr, nullptr);
+        std::fclose(output_file);
+        throw std::runtime_error("Could not initialize PNG output");
+    }
+
+    // libpng errors jump back here
+    if (setjmp(png_jmpbuf(png_ptr)))
+    {
+        png_destroy_write_struct(&png_ptr, &info_ptr);
+        std::fclose(output_file);
+        throw std::runtime_error("Could not write PNG header");
+    }
+
+    png_init_io(png_ptr, output_file);
+    png_set_IHDR(png_ptr, info_ptr, width, height, 16, channels == 3 ? PNG_COLOR_TYPE_RGB : PNG_COLOR_TYPE_GRAY,
+                 PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(png_ptr, info_ptr);
+
+    row_buffer.resize(width * channels);
+    if (orientationReversesPixels(orientation))
+        reverse_buffer.resize(width);
+}
+
+PNGWriter::~PNGWriter()
+{
+    try
+    {
+        close();
+    }
+    catch (std::runtime_error &)
+    {
+    }
+}
+
+// Write the next output row, one pointer per channel. Rows must be fed in output order,
+// that is starting from the last one if orientationReversesRows() is true
+void PNGWriter::writeRow(const uint16_t *const *planes)
+{
+    for (int channel = 0; channel < channels; channel++)
+    {
+        const uint16_t *samples = planes[channel];
+        if (orientationReversesPixels(orientation))
+        {
+            reverseSamples(samples, reverse_buffer.data(), width);
+            samples = reverse_buffer.data();
+        }
+
+        // Interleave channels, in big-endian
+        for (int pixel = 0; pixel < width; pixel++)
+            row_buffer[pixel * channels + channel] = swapBytes(samples[pixel]);
+    }
+
+    if (setjmp(png_jmpbuf(png_ptr)))
+        throw std::runtime_error("Failed writing PNG row");
+    png_write_row(png_ptr, (png_const_bytep)row_buffer.data());
+    rows_written++;
+}
+
+// Write an entire planar image, picking rows in the right order
+void PNGWriter::writeImage(const uint16_t *data)
+{
+    const uint16_t *planes[3];
+    for (int outputRow = 0; outputRow < height; outputRow++)
+    {
+        int row = orientationReversesRows(orientation) ? height - outputRow - 1 : outputRow;
+        for (int channel = 0; channel < channels; channel++)
+            planes[channel] = &data[((size_t)channel * height + row) * width];
+        writeRow(planes);
+    }
+}
+
+// Finish the file. Called by the destructor if needed
+void PNGWriter::close()
+{
+    if (output_file == nullptr)
+        return;
+
+    bool complete = rows_written == height;
+    if (complete)
+    {
+        if (setjmp(png_jmpbuf(png_ptr)) == 0)
+            png_write_end(png_ptr, nullptr);
+    }
+    png_destroy_write_struct(&png_ptr, &info_ptr);
+    std::fclose(output_file);
+    output_file = nullptr;
+
+    if (!complete)
+        throw std::runtime_error("PNG closed before all rows were written");
+}
+
+// Write a planar image in one go
+void savePNG(const std::string &path, const uint16_t *data, int width, int height, int channels, Orientation orientation)
+{
+    PNGWriter writer(path, width, height, channels, orientation);
+    writer.writeImage(data);
+    writer.close();
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <png.h>
+
+// Orientation applied while writing, so the image never has to be transformed in memory
+enum Orientation
+{
+    ORIENTATION_NORMAL,
+    ORIENTATION_ROTATE_180,      // Southbound passes
+    ORIENTATION_FLIP_HORIZONTAL, // Pixels reversed within each row
+    ORIENTATION_FLIP_VERTICAL,   // Rows in reverse order
+};
+
+// Does this orientation output the last row first?
+bool orientationReversesRows(Orientation orientation);
+// Does this orientation reverse pixels within rows?
+bool orientationReversesPixels(Orientation orientation);
+
+// 16-bits PNG writer taking planar rows, as stored by CImg
+class PNGWriter
+{
+private:
+    std::FILE *output_file;
+    png_structp png_ptr;
+    png_infop info_ptr;
+    int width;
+    int height;
+    int channels;
+    Orientation orientation;
+    int rows_written;
+    // Interleaved big-endian output row
+    std::vector<uint16_t> row_buffer;
+    // Reversed channel row, when flipping horizontally
+    std::vector<uint16_t> reverse_buffer;
+
+public:
+    // Constructor, channels being 1 (grayscale) or 3 (RGB)
+    PNGWriter(const std::string &path, int width, int height, int channels, Orientation orientation = ORIENTATION_NORMAL);
+    ~PNGWriter();
+    // Write the next output row, one pointer per channel. Rows must be fed in output order,
+    // that is starting from the last one if orientationReversesRows() is true
+    void writeRow(const uint16_t *const *planes);
+    // Write an entire planar image, picking rows in the right order
+    void writeImage(const uint16_t *data);
+    // Finish the file. Called by the destructor if needed
+    void close();
+};
+
+// Write a planar image in one go
+void savePNG(const std::string &path, const uint16_t *data, int width, int height, int channels, Orientation orientation = ORIENTATION_NORMAL);
@@ -0,0 +1,394 @@
+#include "products.h"
+#include <algorithm>
+#include <cctype>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#define cimg_use_png
+#define cimg_display 0
+#include "CImg.h"
+#include "clahe.h"
+#include "equalizer.h"
+#include "plane_cache.h"
+#include "raster_output.h"
+#include "statistics.h"
+#include "stretch.h"
+#include "stream_output.h"
+#include "thread_pool.h"
+#include "tiff_writer.h"
+#include "tile_pyramid.h"
+
+// Parse a product name. Returns false if it's invalid for this satellite
+bool parseProduct(const std::string &name, const FalseColorRecipe &defaultRecipe, int channelCount, Product &product)
+{
+    product = {name, {}, false, nullptr};
+
+    if (name.compare(0, 10, "composite:") == 0)
+    {
+        try
+        {
+            product.name = "composite";
+            product.composite = std::make_shared<Composite>(name.substr(10));
+            product.channels = product.composite->getChannels();
+        }
+        catch (std::runtime_error &e)
+        {
+            std::cout << e.what() << '\n';
+            return false;
+        }
+    }
+    else if (name == "dump")
+    {
+        product.dump = true;
+        for (int channel = 1; channel <= channelCount; channel++)
+            product.channels.push_back(channel);
+        return true;
+    }
+    else if (name == "rgb")
+    {
+        product.channels = {defaultRecipe.red, defaultRecipe.green, defaultRecipe.blue};
+        return true;
+    }
+    else if (name.size() == 6 && name.compare(0, 3, "rgb") == 0)
+    {
+        for (int i = 3; i < 6; i++)
+            product.channels.push_back(name[i] - '0');
+    }
+    else if (name.size() > 2 && name.compare(0, 2, "ch") == 0 && std::all_of(name.begin() + 2, name.end(), [](char c) { return std::isdigit((unsigned char)c); }))
+    {
+        product.channels.push_back(std::stoi(name.substr(2)));
+    }
+    else
+    {
+        return false;
+    }
+
+    return std::all_of(product.channels.begin(), product.channels.end(), [=](int channel) { return channel >= 1 && channel <= channelCount; });
+}
+
+// Output path of a product, when several are written
+std::string productPath(const std::string &path, const std::string &name)
+{
+    size_t extension = path.find_last_of('.');
+    size_t directory = path.find_last_of("/\\");
+    if (extension == std::string::npos || (directory != std::string::npos && extension < directory))
+        return path + "-" + name;
+    return path.substr(0, extension) + "-" + name + path.substr(extension);
+}
+
+// Evaluate a composite, then render its planes like a channel or rgb product
+static void writeComposite(const Product &product, const std::string &path, const LineSource &source, const PlaneDecoder &decodePlane, const ProductSettings &settings, ThreadPool &pool)
+{
+    const size_t size = (size_t)source.width * source.rows;
+    std::vector<std::vector<uint16_t>> inputs(source.channels);
+    std::vector<const uint16_t *> inputPlanes(source.channels);
+    for (int channel : product.channels)
+    {
+        inputs[channel - 1].resize(size);
+        decodePlane(channel, inputs[channel - 1].data(), 1);
+        inputPlanes[channel - 1] = inputs[channel - 1].data();
+    }
+
+    // Results stay in sample units, and must not overflow once scaled
+    const int outputCount = product.composite->getOutputCount();
+    std::vector<std::vector<uint16_t>> outputs(outputCount, std::vector<uint16_t>(size));
+    std::vector<uint16_t *> outputPlanes;
+    for (std::vector<uint16_t> &output : outputs)
+        outputPlanes.push_back(output.data());
+    product.composite->evaluate(inputPlanes, size, outputPlanes, UINT16_MAX / source.scale);
+
+    // Pixels outside of a map stay blank
+    if (settings.noData && !product.channels.empty())
+        for (size_t i = 0; i < size; i++)
+            if (inputPlanes[product.channels[0] - 1][i] == 0)
+                for (uint16_t *output : outputPlanes)
+                    output[i] = 0;
+
+    inputs.clear();
+    PlaneCache cache(source.width, source.rows, source.scale, std::move(outputs));
+    std::vector<int> channels = outputCount == 3 ? std::vector<int>{1, 2, 3} : std::vector<int>{1};
+    writeProduct({product.name, channels, false, nullptr}, path, cache.getLineSource(),
+                 [&](int channel, uint16_t *plane, int scale) { cache.decodePlane(channel, plane, scale); }, settings, pool);
+}
+
+// Equalize, stretch or adaptively equalize whole width * rows planes in place, as settings ask
+static void enhancePlanes(uint16_t *planes, int width, int rows, int planeCount, int equalization, bool enhance, int scale, const ProductSettings &settings)
+{
+    const size_t size = (size_t)width * rows * planeCount;
+    if (enhance && settings.claheClip > 0)
+    {
+        for (int plane = 0; plane < planeCount; plane++)
+            claheSamples(&planes[(size_t)plane * width * rows], width, rows, settings.claheClip, scale, settings.noData);
+    }
+    else if (enhance && settings.stretchHigh > settings.stretchLow)
+    {
+        stretchSamples(planes, size, settings.stretchLow, settings.stretchHigh, scale, settings.noData);
+    }
+    else
+    {
+        equalizeSamples(planes, size, equalization, scale, settings.noData);
+    }
+}
+
+// Render a single product from a decoded pass, parallel work going to pool
+void writeProduct(const Product &product, const std::string &path, const LineSource &source, const PlaneDecoder &decodePlane, const ProductSettings &settings, ThreadPool &pool)
+{
+    if (product.composite)
+    {
+        writeComposite(product, path, source, decodePlane, settings, pool);
+        return;
+    }
+
+    // Dumps are raw, neither equalized, stretched nor rotated
+    int equalization = product.dump ? 0 : settings.equalization;
+    bool enhance = !product.dump;
+    Orientation orientation = product.dump ? ORIENTATION_NORMAL : settings.orientation;
+
+    // Tiled TIFF, dumps being a single multi-sample file
+    if (settings.format == "tiff")
+    {
+        cimg_library::CImg<unsigned short> planes(source.width, source.rows, 1, product.channels.size());
+        for (size_t i = 0; i < product.channels.size(); i++)
+            decodePlane(product.channels[i], planes.data(0, 0, 0, i), source.scale);
+
+        enhancePlanes(planes.data(), planes.width(), planes.height(), planes.spectrum(), equalization, enhance, source.scale, settings);
+
+        saveTIFF(path, planes.data(), planes.width(), planes.height(), planes.spectrum(), pool, orientation);
+    }
+    // Tile pyramid, PNG tiles only taking 1 or 3 channels
+    else if (settings.format == "tiles" || settings.format == "rawtiles")
+    {
+        TileFormat format = settings.format == "tiles" ? TILE_PNG : TILE_RAW;
+        std::vector<std::vector<int>> pyramids = {product.channels};
+        if (format == TILE_PNG && product.channels.size() != 1 && product.channels.size() != 3)
+        {
+            pyramids.clear();
+            for (int channel : product.channels)
+                pyramids.push_back({channel});
+        }
+
+        for (const std::vector<int> &channels : pyramids)
+        {
+            std::vector<uint16_t> planes((size_t)source.width * source.rows * channels.size());
+            for (size_t i = 0; i < channels.size(); i++)
+                decodePlane(channels[i], &planes[i * source.width * source.rows], source.scale);
+
+            enhancePlanes(planes.data(), source.width, source.rows, channels.size(), equalization, enhance, source.scale, settings);
+            orientPlanes(planes.data(), source.width, source.rows, channels.size(), orientation);
+
+            std::string directory = pyramids.size() > 1 ? path + "-" + std::to_string(channels[0]) : path;
+            writeTilePyramid(directory, std::move(planes), source.width, source.rows, channels, format, settings.satellite, pool);
+        }
+    }
+    // Raw planes, decoded straight into the output file
+    else if (settings.format != "png")
+    {
+        RasterFormat format = settings.format == "npy" ? RASTER_NPY : (settings.format == "envi" ? RASTER_ENVI : RASTER_RAW);
+        writeRaster(format, path, {settings.satellite, source.width, source.rows, product.channels, settings.orientation == ORIENTATION_ROTATE_180, settings.calibrated},
+                    [&](int channel, uint16_t *plane) { decodePlane(channel, plane, 1); });
+    }
+    else if (product.dump)
+    {
+        streamDumpPNGs(source, path, pool);
+    }
+    else
+    {
+        streamPNG(source, product.channels, equalization, orientation, path, settings.noData, settings.stretchLow, settings.stretchHigh, settings.claheClip);
+    }
+}
+
+// Parse product names, skipping (and reporting) invalid ones. Composites get numbered from the second one on
+static std::vector<Product> parseProducts(const std::vector<std::string> &productNames, const FalseColorRecipe &defaultRecipe, int channelCount)
+{
+    std::vector<Product> products;
+    int composites = 0;
+    for (const std::string &name : productNames)
+    {
+        Product product;
+        if (!parseProduct(name, defaultRecipe, channelCount, product))
+        {
+            std::cout << "Invalid product " << name << ", skipping!" << '\n';
+            continue;
+        }
+
+        if (product.composite && ++composites > 1)
+            product.name += std::to_string(composites);
+        products.push_back(product);
+    }
+    return products;
+}
+
+// Every channel some product needs
+static std::vector<int> neededChannels(const std::vector<Product> &products)
+{
+    std::vector<int> channels;
+    for (const Product &product : products)
+        channels.insert(channels.end(), product.channels.begin(), product.channels.end());
+    return channels;
+}
+
+// Render products from cached planes on pool. A single product is written to path, several get their name appended to it
+static void writeCachedProducts(const std::vector<Product> &products, const std::string &path, PlaneCache &cache, const ProductSettings &settings, ThreadPool &pool)
+{
+    LineSource cachedSource = cache.getLineSource();
+    PlaneDecoder cachedDecodePlane = [&](int channel, uint16_t *plane, int scale) { cache.decodePlane(channel, plane, scale); };
+
+    // TIFFs and tiles copy whole planes and already spread over the pool, so they go one product at a time
+    if (settings.format == "tiff" || settings.format == "tiles" || settings.format == "rawtiles")
+    {
+        for (const Product &product : products)
+            writeProduct(product, products.size() > 1 ? productPath(path, product.name) : path, cachedSource, cachedDecodePlane, settings, pool);
+        return;
+    }
+
+    // Other formats stream lines from the cache, which is read-only from here, so products can go in parallel
+    std::vector<std::future<void>> results;
+    for (const Product &product : products)
+        results.push_back(pool.submit([&, product] {
+            writeProduct(product, products.size() > 1 ? productPath(path, product.name) : path, cachedSource, cachedDecodePlane, settings, pool);
+        }));
+    for (std::future<void> &result : results)
+    {
+        pool.wait(result);
+        result.get();
+    }
+}
+
+// Replace the extension of a path, if it has one
+static std::string replaceExtension(const std::string &path, const std::string &extension)
+{
+    size_t dot = path.find_last_of('.');
+    size_t directory = path.find_last_of("/\\");
+    if (dot == std::string::npos || (directory != std::string::npos && dot < directory))
+        return path + extension;
+    return path.substr(0, dot) + extension;
+}
+
+// Decode the needed channels of a pass once, writing its statistics to path-stats.json on the way if asked for
+static std::unique_ptr<PlaneCache> cachePass(const LineSource &source, const std::vector<int> &channels, const std::string &path, const ProductSettings &settings)
+{
+    if (!settings.statistics)
+        return std::unique_ptr<PlaneCache>(new PlaneCache(source, channels));
+
+    PassStatistics statistics(source.channels, settings.calibrated ? 16 : 10);
+    std::unique_ptr<PlaneCache> cache(new PlaneCache(source, channels, &statistics));
+    statistics.writeJSON(replaceExtension(productPath(path, "stats"), ".json"), settings.satellite, source.width, source.rows);
+    return cache;
+}
+
+// Render products from map planes. Maps are north-up already, and blank around the passes
+static void writeMapProducts(const std::vector<Product> &products, const std::string &path, PlaneCache &cache, const MapGrid &grid, const ProductSettings &settings, ThreadPool &pool)
+{
+    ProductSettings mapSettings = settings;
+    mapSettings.orientation = ORIENTATION_NORMAL;
+    mapSettings.noData = true;
+    writeCachedProducts(products, path, cache, mapSettings, pool);
+
+    if (settings.format == "png" || settings.format == "tiff")
+        for (const Product &product : products)
+            writeWorldFile(replaceExtension(products.size() > 1 ? productPath(path, product.name) : path, ".wld"), grid);
+}
+
+// Render a set of products. A single one is rendered straight from the decoder, several are rendered in parallel
+// from a shared cache of the planes they need, so the pass is only decoded once. Each gets its name appended to the output path
+void writeProducts(const std::vector<std::string> &productNames, const FalseColorRecipe &defaultRecipe, const std::string &path,
+                   const LineSource &source, const PlaneDecoder &decodePlane, const ProductSettings &settings, ThreadPool &pool)
+{
+    std::vector<Product> products = parseProducts(productNames, defaultRecipe, source.channels);
+    if (products.empty())
+        return;
+
+    if (products.size() == 1 && !settings.statistics)
+    {
+        writeProduct(products[0], path, source, decodePlane, settings, pool);
+        return;
+    }
+
+    // Decode every channel needed, once
+    std::unique_ptr<PlaneCache> cache = cachePass(source, neededChannels(products), path, settings);
+    writeCachedProducts(products, path, *cache, settings, pool);
+}
+
+// Render a set of products on a map grid. The pass is decoded once, each channel needed is resampled once,
+// and products are rendered from the resampled planes like writeProducts does. Image outputs get a world file
+void writeReprojectedProducts(const std::vector<std::string> &productNames, const FalseColorRecipe &defaultRecipe, const std::string &path,
+                              const LineSource &source, const ProductSettings &settings, const Reprojection &reprojection, Resampling resampling, ThreadPool &pool)
+{
+    std::vector<Product> products = parseProducts(productNames, defaultRecipe, source.channels);
+    if (products.empty())
+        return;
+
+    std::vector<int> channels = neededChannels(products);
+    std::unique_ptr<PlaneCache> cache = cachePass(source, channels, path, settings);
+
+    // Resample every needed channel through the same inverse mapping
+    std::vector<std::vector<uint16_t>> mapPlanes(source.channels);
+    for (int channel : channels)
+    {
+        if (!mapPlanes[channel - 1].empty())
+            continue;
+        mapPlanes[channel - 1].resize((size_t)reprojection.getWidth() * reprojection.getRows());
+        reprojection.resample(cache->getPlane(channel), mapPlanes[channel - 1].data(), resampling, pool);
+    }
+
+    PlaneCache mapCache(reprojection.getWidth(), reprojection.getRows(), source.scale, std::move(mapPlanes));
+    writeMapProducts(products, path, mapCache, reprojection.getGrid(), settings, pool);
+}
+
+// Merge a pass into a mosaic, then render products from everything the mosaic holds. Merging only costs
+// as much as the pass, rendering as much as the mosaic's extent. Image outputs get a world file
+void writeMosaicProducts(const std::vector<std::string> &productNames, const FalseColorRecipe &defaultRecipe, const std::string &path,
+                         const LineSource &source, const ProductSettings &settings, const Reprojection &reprojection, Resampling resampling,
+                         Mosaic &mosaic, double firstLineTimestamp, double lineDuration, ThreadPool &pool)
+{
+    // Mosaics keep every channel
+    std::vector<int> channels;
+    for (int channel = 1; channel <= source.channels; channel++)
+        channels.push_back(channel);
+    {
+        std::unique_ptr<PlaneCache> cache = cachePass(source, channels, path, settings);
+        std::vector<const uint16_t *> planes;
+        for (int channel : channels)
+            planes.push_back(cache->getPlane(channel));
+        mosaic.addPass(reprojection, planes, resampling, firstLineTimestamp, lineDuration, pool);
+    }
+
+    std::vector<Product> products = parseProducts(productNames, defaultRecipe, source.channels);
+    MapGrid extent = mosaic.getExtent();
+    if (products.empty() || extent.width == 0)
+        return;
+
+    std::vector<std::vector<uint16_t>> mosaicPlanes(source.channels);
+    for (int channel : neededChannels(products))
+    {
+        if (!mosaicPlanes[channel - 1].empty())
+            continue;
+        mosaicPlanes[channel - 1].resize((size_t)extent.width * extent.rows);
+        mosaic.readPlane(channel, mosaicPlanes[channel - 1].data());
+    }
+
+    PlaneCache mosaicCache(extent.width, extent.rows, source.scale, std::move(mosaicPlanes));
+    writeMapProducts(products, path, mosaicCache, extent, settings, pool);
+}
+
+// Write latitude and longitude planes (float degrees) to path-geo, in the raw format asked for, NPY otherwise.
+// Like raw outputs, they follow the data as received whatever the orientation
+void writeGeolocation(const std::string &path, const Geolocation &geolocation, const ProductSettings &settings)
+{
+    RasterFormat format = settings.format == "raw" ? RASTER_RAW : (settings.format == "envi" ? RASTER_ENVI : RASTER_NPY);
+
+    // Image outputs get a sibling .npy file
+    std::string geolocationPath = productPath(path, "geo");
+    if (format == RASTER_NPY && settings.format != "npy")
+        geolocationPath = replaceExtension(geolocationPath, ".npy");
+
+    // Both planes come out of the same interpolation, longitudes wait for their turn
+    std::vector<float> longitudes((size_t)geolocation.getWidth() * geolocation.getRows());
+    RasterInfo info = {settings.satellite, geolocation.getWidth(), geolocation.getRows(), {1, 2}, settings.orientation == ORIENTATION_ROTATE_180, false, {"Latitude", "Longitude"}};
+    writeFloatRaster(format, geolocationPath, info, [&](int band, float *plane) {
+        if (band == 1)
+            geolocation.interpolatePlanes(plane, longitudes.data());
+        else
+            std::copy(longitudes.begin(), longitudes.end(), plane);
+    });
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "composite.h"
+#include "compositor.h"
+#include "geolocation.h"
+#include "line_source.h"
+#include "mosaic.h"
+#include "png_writer.h"
+#include "reprojection.h"
+#include "thread_pool.h"
+
+// Decode a full channel plane into a buffer, multiplying samples by scale
+typedef std::function<void(int channel, uint16_t *plane, int scale)> PlaneDecoder;
+
+// An output product : chN (a single channel), rgbXYZ (false color, rgb alone being the satellite's default), dump (all channels)
+// or composite:<definition> (band maths, see Composite)
+struct Product
+{
+    std::string name;
+    // Channels read
+    std::vector<int> channels;
+    bool dump;
+    std::shared_ptr<const Composite> composite;
+};
+
+// Output settings shared by all products
+struct ProductSettings
+{
+    std::string format;
+    int equalization;
+    // Percentile stretch bounds in %, replacing equalization when stretchHigh > stretchLow
+    double stretchLow;
+    double stretchHigh;
+    // CLAHE clip limit, replacing equalization when > 0
+    double claheClip;
+    Orientation orientation;
+    std::string satellite;
+    // Samples are calibrated values rather than 10-bits counts
+    bool calibrated;
+    // Samples of 0 are no-data (outside of a reprojected pass), kept black and left out of equalization
+    bool noData;
+    // Write per-channel statistics of the pass to a JSON file next to the products
+    bool statistics;
+};
+
+// Parse a product name. Returns false if it's invalid for this satellite
+bool parseProduct(const std::string &name, const FalseColorRecipe &defaultRecipe, int channelCount, Product &product);
+
+// Render a single product from a decoded pass, parallel work going to pool
+void writeProduct(const Product &product, const std::string &path, const LineSource &source, const PlaneDecoder &decodePlane, const ProductSettings &settings, ThreadPool &pool);
+
+// Render a set of products. A single one is rendered straight from the decoder, several are rendered in parallel
+// from a shared cache of the planes they need, so the pass is only decoded once. Each gets its name appended to the output path.
+// Statistics, if asked for, are gathered while filling that cache
+void writeProducts(const std::vector<std::string> &productNames, const FalseColorRecipe &defaultRecipe, const std::string &path,
+                   const LineSource &source, const PlaneDecoder &decodePlane, const ProductSettings &settings, ThreadPool &pool);
+
+// Render a set of products on a map grid. The pass is decoded once, each channel needed is resampled once,
+// and products are rendered from the resampled planes like writeProducts does. Image outputs get a world file
+void writeReprojectedProducts(const std::vector<std::string> &productNames, const FalseColorRecipe &defaultRecipe, const std::string &path,
+                              const LineSource &source, const ProductSettings &settings, const Reprojection &reprojection, Resampling resampling, ThreadPool &pool);
+
+// Merge a pass into a mosaic, then render products from everything the mosaic holds. Merging only costs
+// as much as the pass, rendering as much as the mosaic's extent. Image outputs get a world file
+void writeMosaicProducts(const std::vector<std::string> &productNames, const FalseColorRecipe &defaultRecipe, const std::string &path,
+                         const LineSource &source, const ProductSettings &settings, const Reprojection &reprojection, Resampling resampling,
+                         Mosaic &mosaic, double firstLineTimestamp, double lineDuration, ThreadPool &pool);
+
+// Write latitude and longitude planes (float degrees) to path-geo, in the raw format asked for, NPY otherwise.
+// Like raw outputs, they follow the data as received whatever the orientation
+void writeGeolocation(const std::string &path, const Geolocation &geolocation, const ProductSettings &settings);
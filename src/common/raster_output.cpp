@@ -0,0 +1,135 @@
+#include "raster_output.h"
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <type_traits>
+#include "mapped_file.h"
+
+// NPY header are padded so data starts 64-bytes aligned
+const int NPY_ALIGNMENT = 64;
+// Magic, version, and header length
+const int NPY_PREAMBLE_SIZE = 10;
+
+// Samples are written in native byte order
+bool isLittleEndian()
+{
+    const uint16_t probe = 1;
+    return *(const uint8_t *)&probe == 1;
+}
+
+// NPY v1.0 header, for a (channels, rows, width) uint16 or float32 array
+std::string buildNPYHeader(const RasterInfo &info, bool floatSamples)
+{
+    std::ostringstream dict;
+    dict << "{'descr': '" << (isLittleEndian() ? '<' : '>') << (floatSamples ? "f4" : "u2") << "', 'fortran_order': False, 'shape': ("
+         << info.channels.size() << ", " << info.rows << ", " << info.width << "), }";
+
+    // Pad with spaces, the header ends with a newline
+    std::string header = dict.str();
+    int padding = NPY_ALIGNMENT - (NPY_PREAMBLE_SIZE + header.size() + 1) % NPY_ALIGNMENT;
+    header.append(padding % NPY_ALIGNMENT, ' ');
+    header += '\n';
+
+    std::string preamble = "\x93NUMPY";
+    preamble += (char)1;
+    preamble += (char)0;
+    preamble += (char)(header.size() & 0xFF);
+    preamble += (char)(header.size() >> 8);
+    return preamble + header;
+}
+
+// JSON sidecar, for raw and NPY outputs
+void writeJSONSidecar(const std::string &path, const RasterInfo &info, RasterFormat format, bool floatSamples)
+{
+    std::ofstream sidecar(path + ".json");
+    sidecar << "{\n";
+    sidecar << "    \"satellite\": \"" << info.satellite << "\",\n";
+    sidecar << "    \"format\": \"" << (format == RASTER_NPY ? "npy" : "raw") << "\",\n";
+    sidecar << "    \"width\": " << info.width << ",\n";
+    sidecar << "    \"rows\": " << info.rows << ",\n";
+    if (info.bandNames.empty())
+    {
+        sidecar << "    \"channels\": [";
+        for (size_t i = 0; i < info.channels.size(); i++)
+            sidecar << (i > 0 ? ", " : "") << info.channels[i];
+    }
+    else
+    {
+        sidecar << "    \"bands\": [";
+        for (size_t i = 0; i < info.bandNames.size(); i++)
+            sidecar << (i > 0 ? ", " : "") << "\"" << info.bandNames[i] << "\"";
+    }
+    sidecar << "],\n";
+    if (floatSamples)
+    {
+        sidecar << "    \"sample_type\": \"float32\",\n";
+    }
+    else
+    {
+        sidecar << "    \"sample_type\": \"uint16\",\n";
+        sidecar << "    \"sample_bits\": " << (info.calibrated ? 16 : 10) << ",\n";
+        sidecar << "    \"calibrated\": " << (info.calibrated ? "true" : "false") << ",\n";
+    }
+    sidecar << "    \"byte_order\": \"" << (isLittleEndian() ? "little" : "big") << "\",\n";
+    sidecar << "    \"interleave\": \"planar\",\n";
+    sidecar << "    \"southbound\": " << (info.southbound ? "true" : "false") << "\n";
+    sidecar << "}\n";
+}
+
+// ENVI header sidecar
+void writeENVIHeader(const std::string &path, const RasterInfo &info, bool floatSamples)
+{
+    std::ofstream header(path + ".hdr");
+    header << "ENVI\n";
+    header << "description = {HRPT Decoder, " << info.satellite << (info.southbound ? ", southbound" : "") << (info.calibrated ? ", calibrated" : "") << "}\n";
+    header << "samples = " << info.width << "\n";
+    header << "lines = " << info.rows << "\n";
+    header << "bands = " << info.channels.size() << "\n";
+    header << "header offset = 0\n";
+    header << "file type = ENVI Standard\n";
+    header << "data type = " << (floatSamples ? 4 : 12) << "\n";
+    header << "interleave = bsq\n";
+    header << "byte order = " << (isLittleEndian() ? 0 : 1) << "\n";
+    header << "band names = {";
+    for (size_t i = 0; i < info.channels.size(); i++)
+        header << (i > 0 ? ", " : "") << (info.bandNames.empty() ? "Channel " + std::to_string(info.channels[i]) : info.bandNames[i]);
+    header << "}\n";
+}
+
+// Map the output file and let decodePlane fill each plane, then write sidecars
+template <typename Sample>
+void writeRasterPlanes(RasterFormat format, const std::string &path, const RasterInfo &info,
+                       const std::function<void(int channel, Sample *plane)> &decodePlane)
+{
+    const bool floatSamples = std::is_floating_point<Sample>::value;
+    std::string header = format == RASTER_NPY ? buildNPYHeader(info, floatSamples) : "";
+    size_t planeSize = (size_t)info.width * info.rows;
+
+    MappedFile output(path, header.size() + planeSize * info.channels.size() * sizeof(Sample));
+    std::memcpy(output.data(), header.data(), header.size());
+
+    // Headers are 64-bytes padded, so planes are always aligned
+    Sample *planes = (Sample *)(output.data() + header.size());
+    for (size_t i = 0; i < info.channels.size(); i++)
+        decodePlane(info.channels[i], &planes[i * planeSize]);
+
+    if (format == RASTER_ENVI)
+        writeENVIHeader(path, info, floatSamples);
+    else
+        writeJSONSidecar(path, info, format, floatSamples);
+}
+
+// Write planes to a memory-mapped file. decodePlane(channel, plane) is called for each channel,
+// and has to fill width * rows unscaled samples straight into the mapping
+void writeRaster(RasterFormat format, const std::string &path, const RasterInfo &info,
+                 const std::function<void(int channel, uint16_t *plane)> &decodePlane)
+{
+    writeRasterPlanes<uint16_t>(format, path, info, decodePlane);
+}
+
+// Same with 32-bits float planes, eg geolocation
+void writeFloatRaster(RasterFormat format, const std::string &path, const RasterInfo &info,
+                      const std::function<void(int channel, float *plane)> &decodePlane)
+{
+    writeRasterPlanes<float>(format, path, info, decodePlane);
+}
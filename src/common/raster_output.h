@@ -0,0 +1,37 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Planar formats holding the raw 10-bits (or calibrated) samples, for further processing
+enum RasterFormat
+{
+    RASTER_RAW,  // Bare planes, JSON sidecar
+    RASTER_NPY,  // NumPy array of shape (channels, rows, width), JSON sidecar
+    RASTER_ENVI, // Band-sequential planes, ENVI .hdr sidecar
+};
+
+// What goes in headers / sidecars
+struct RasterInfo
+{
+    std::string satellite;
+    int width;
+    int rows;
+    // Channel numbers, in plane order
+    std::vector<int> channels;
+    // Data is stored as received, a southbound pass needs to be rotated by the reader
+    bool southbound;
+    // Samples are albedos (0.01 %) and brightness temperatures (0.01 K) rather than counts
+    bool calibrated;
+    // Plane names, "Channel N" if empty
+    std::vector<std::string> bandNames = {};
+};
+
+// Write planes to a memory-mapped file. decodePlane(channel, plane) is called for each channel,
+// and has to fill width * rows unscaled samples straight into the mapping
+void writeRaster(RasterFormat format, const std::string &path, const RasterInfo &info,
+                 const std::function<void(int channel, uint16_t *plane)> &decodePlane);
+// Same with 32-bits float planes, eg geolocation
+void writeFloatRaster(RasterFormat format, const std::string &path, const RasterInfo &info,
+                      const std::function<void(int channel, float *plane)> &decodePlane);
@@ -0,0 +1,263 @@
+#include "reedsolomon.h"
+#include <cstring>
+
+// Field generator polynomial, x^8 + x^7 + x^2 + x + 1
+const int RS_GF_POLY = 0x187;
+// Marker for log(0)
+const int RS_A0 = RS_BLOCK_SIZE;
+// Dual-basis transformation matrix from the CCSDS blue book
+static const uint8_t RS_TAL[8] = {0x8d, 0xef, 0xec, 0x86, 0xfa, 0x99, 0xaf, 0x7b};
+
+// Constructor
+ReedSolomon::ReedSolomon() : fcr{112}, prim{11}
+{
+    // Build the Galois-field log / antilog tables
+    index_of[0] = RS_A0;
+    alpha_to[RS_A0] = 0;
+    int sr = 1;
+    for (int i = 0; i < RS_BLOCK_SIZE; i++)
+    {
+        index_of[sr] = i;
+        alpha_to[i] = sr;
+        sr <<= 1;
+        if (sr & 256)
+            sr ^= RS_GF_POLY;
+        sr &= 255;
+    }
+
+    // prim-th root of 1, used in decoding
+    for (iprim = 1; (iprim % prim) != 0; iprim += RS_BLOCK_SIZE)
+        ;
+    iprim /= prim;
+
+    // Dual-basis conversion tables
+    for (int i = 0; i < 256; i++)
+    {
+        taltab[i] = 0;
+        for (int j = 0; j < 8; j++)
+            for (int k = 0; k < 8; k++)
+                if (i & (1 << k))
+                    taltab[i] ^= RS_TAL[7 - k] & (1 << j);
+        tal1tab[taltab[i]] = i;
+    }
+
+    // Syndrome multiplication tables, x * alpha^((fcr + i) * prim)
+    for (int i = 0; i < RS_PARITY_SIZE; i++)
+        for (int x = 0; x < 256; x++)
+            root_mul[i][x] = x == 0 ? 0 : alpha_to[modnn(index_of[x] + (fcr + i) * prim)];
+}
+
+int ReedSolomon::modnn(int x)
+{
+    while (x >= RS_BLOCK_SIZE)
+    {
+        x -= RS_BLOCK_SIZE;
+        x = (x >> 8) + (x & RS_BLOCK_SIZE);
+    }
+    return x;
+}
+
+// Decode a single dual-basis codeword in place. Returns the corrected byte count, or -1 if uncorrectable
+int ReedSolomon::decode(uint8_t *data)
+{
+    // Convert to conventional representation and compute syndromes on the fly
+    uint8_t syndromes[RS_PARITY_SIZE];
+    uint8_t first = tal1tab[data[0]];
+    for (int i = 0; i < RS_PARITY_SIZE; i++)
+        syndromes[i] = first;
+
+    for (int j = 1; j < RS_BLOCK_SIZE; j++)
+    {
+        uint8_t value = tal1tab[data[j]];
+        for (int i = 0; i < RS_PARITY_SIZE; i++)
+            syndromes[i] = root_mul[i][syndromes[i]] ^ value;
+    }
+
+    // Fast path : no error, nothing else to do!
+    uint8_t syn_error = 0;
+    for (int i = 0; i < RS_PARITY_SIZE; i++)
+        syn_error |= syndromes[i];
+    if (syn_error == 0)
+        return 0;
+
+    // Slow path, we need a conventional copy to correct
+    uint8_t conventional[RS_BLOCK_SIZE];
+    for (int j = 0; j < RS_BLOCK_SIZE; j++)
+        conventional[j] = tal1tab[data[j]];
+
+    int count = correct(conventional, syndromes);
+
+    // Convert back to dual-basis, only touching the data if it was corrected
+    if (count > 0)
+        for (int j = 0; j < RS_BLOCK_SIZE; j++)
+            data[j] = taltab[conventional[j]];
+
+    return count;
+}
+
+// Full Berlekamp-Massey / Chien / Forney decoding, only called when syndromes aren't all zero
+int ReedSolomon::correct(uint8_t *data, uint8_t *syndromes)
+{
+    int lambda[RS_PARITY_SIZE + 1], b[RS_PARITY_SIZE + 1], t[RS_PARITY_SIZE + 1], omega[RS_PARITY_SIZE + 1];
+    int s[RS_PARITY_SIZE], root[RS_PARITY_SIZE], loc[RS_PARITY_SIZE], reg[RS_PARITY_SIZE + 1];
+
+    // Syndromes in index form
+    for (int i = 0; i < RS_PARITY_SIZE; i++)
+        s[i] = index_of[syndromes[i]];
+
+    // Berlekamp-Massey, finding the error locator polynomial
+    std::memset(lambda, 0, sizeof(lambda));
+    lambda[0] = 1;
+    for (int i = 0; i < RS_PARITY_SIZE + 1; i++)
+        b[i] = index_of[lambda[i]];
+
+    int r = 0, el = 0;
+    while (++r <= RS_PARITY_SIZE)
+    {
+        // Compute discrepancy at the r-th step in poly-form
+        int discr_r = 0;
+        for (int i = 0; i < r; i++)
+            if ((lambda[i] != 0) && (s[r - i - 1] != RS_A0))
+                discr_r ^= alpha_to[modnn(index_of[lambda[i]] + s[r - i - 1])];
+        discr_r = index_of[discr_r];
+
+        if (discr_r == RS_A0)
+        {
+            // B(x) <-- x*B(x)
+            std::memmove(&b[1], b, RS_PARITY_SIZE * sizeof(b[0]));
+            b[0] = RS_A0;
+        }
+        else
+        {
+            // T(x) <-- lambda(x) - discr_r*x*b(x)
+            t[0] = lambda[0];
+            for (int i = 0; i < RS_PARITY_SIZE; i++)
+            {
+                if (b[i] != RS_A0)
+                    t[i + 1] = lambda[i + 1] ^ alpha_to[modnn(discr_r + b[i])];
+                else
+                    t[i + 1] = lambda[i + 1];
+            }
+
+            if (2 * el <= r - 1)
+            {
+                el = r - el;
+                // B(x) <-- inv(discr_r) * lambda(x)
+                for (int i = 0; i <= RS_PARITY_SIZE; i++)
+                    b[i] = (lambda[i] == 0) ? RS_A0 : modnn(index_of[lambda[i]] - discr_r + RS_BLOCK_SIZE);
+            }
+            else
+            {
+                // B(x) <-- x*B(x)
+                std::memmove(&b[1], b, RS_PARITY_SIZE * sizeof(b[0]));
+                b[0] = RS_A0;
+            }
+            std::memcpy(lambda, t, (RS_PARITY_SIZE + 1) * sizeof(t[0]));
+        }
+    }
+
+    // Convert lambda to index form and compute deg(lambda(x))
+    int deg_lambda = 0;
+    for (int i = 0; i < RS_PARITY_SIZE + 1; i++)
+    {
+        lambda[i] = index_of[lambda[i]];
+        if (lambda[i] != RS_A0)
+            deg_lambda = i;
+    }
+
+    // Chien search, finding the roots of the error locator polynomial
+    std::memcpy(&reg[1], &lambda[1], RS_PARITY_SIZE * sizeof(reg[0]));
+    int count = 0;
+    for (int i = 1, k = iprim - 1; i <= RS_BLOCK_SIZE; i++, k = modnn(k + iprim))
+    {
+        int q = 1; // lambda[0] is always 0
+        for (int j = deg_lambda; j > 0; j--)
+        {
+            if (reg[j] != RS_A0)
+            {
+                reg[j] = modnn(reg[j] + j);
+                q ^= alpha_to[reg[j]];
+            }
+        }
+        if (q != 0)
+            continue; // Not a root
+
+        // Store root (index-form) and error location number
+        root[count] = i;
+        loc[count] = k;
+        // If we've already found max possible roots, abort the search to save time
+        if (++count == deg_lambda)
+            break;
+    }
+
+    // deg(lambda) unequal to number of roots => uncorrectable error detected
+    if (deg_lambda == 0 || deg_lambda != count)
+        return -1;
+
+    // Compute err evaluator poly omega(x) = s(x)*lambda(x) (modulo x**nroots), in index form
+    int deg_omega = deg_lambda - 1;
+    for (int i = 0; i <= deg_omega; i++)
+    {
+        int tmp = 0;
+        for (int j = i; j >= 0; j--)
+            if ((s[i - j] != RS_A0) && (lambda[j] != RS_A0))
+                tmp ^= alpha_to[modnn(s[i - j] + lambda[j])];
+        omega[i] = index_of[tmp];
+    }
+
+    // Forney algorithm, computing error values
+    for (int j = count - 1; j >= 0; j--)
+    {
+        int num1 = 0;
+        for (int i = deg_omega; i >= 0; i--)
+            if (omega[i] != RS_A0)
+                num1 ^= alpha_to[modnn(omega[i] + i * root[j])];
+
+        int num2 = alpha_to[modnn(root[j] * (fcr - 1) + RS_BLOCK_SIZE)];
+        int den = 0;
+
+        // lambda[i+1] for i even is the formal derivative lambda_pr of lambda[i]
+        for (int i = (deg_lambda < RS_PARITY_SIZE - 1 ? deg_lambda : RS_PARITY_SIZE - 1) & ~1; i >= 0; i -= 2)
+            if (lambda[i + 1] != RS_A0)
+                den ^= alpha_to[modnn(lambda[i + 1] + i * root[j])];
+
+        // Apply error to data
+        if (num1 != 0)
+            data[loc[j]] ^= alpha_to[modnn(index_of[num1] + index_of[num2] + RS_BLOCK_SIZE - index_of[den])];
+    }
+
+    return count;
+}
+
+// Decode an interleaved block (eg, a 1020 bytes CADU with interleave 4) in place
+RSFrameReport ReedSolomon::decodeInterleaved(uint8_t *data, int interleave)
+{
+    RSFrameReport report;
+
+    for (int i = 0; i < interleave; i++)
+    {
+        // De-interleave this codeword
+        for (int j = 0; j < RS_BLOCK_SIZE; j++)
+            codeword[j] = data[i + j * interleave];
+
+        int result = decode(codeword);
+
+        if (result != 0)
+            report.clean = false;
+
+        if (result < 0)
+        {
+            report.corrected = -1;
+        }
+        else if (result > 0)
+        {
+            // Re-interleave corrected bytes
+            for (int j = 0; j < RS_BLOCK_SIZE; j++)
+                data[i + j * interleave] = codeword[j];
+            if (report.corrected >= 0)
+                report.corrected += result;
+        }
+    }
+
+    return report;
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+// CCSDS Reed-Solomon (255,223) parameters
+#define RS_BLOCK_SIZE 255
+#define RS_PARITY_SIZE 32
+#define RS_DATA_SIZE (RS_BLOCK_SIZE - RS_PARITY_SIZE)
+
+// Result of a single interleaved CADU correction
+struct RSFrameReport
+{
+    // Corrected byte count over all codewords, -1 if any of them was uncorrectable
+    int corrected = 0;
+    // True if all codewords had zero syndromes (no work done)
+    bool clean = true;
+};
+
+// Reed-Solomon (255,223) decoder as used by CCSDS, with the dual-basis representation
+// Based on Phil Karn's decode_rs, with table-driven syndromes and a fast path for error-free codewords
+class ReedSolomon
+{
+private:
+    // Galois-field tables, conventional representation
+    uint8_t alpha_to[256];
+    uint8_t index_of[256];
+    // Dual-basis <-> conventional conversion tables
+    uint8_t taltab[256];
+    uint8_t tal1tab[256];
+    // Multiplication tables for each root, used to compute syndromes with a single lookup per byte and root
+    uint8_t root_mul[RS_PARITY_SIZE][256];
+    // Generator polynomial roots related constants
+    int fcr, prim, iprim;
+    // Codeword buffer used for de-interleaving
+    uint8_t codeword[RS_BLOCK_SIZE];
+
+    int modnn(int x);
+    // Full Berlekamp-Massey / Chien / Forney decoding, only called when syndromes aren't all zero
+    int correct(uint8_t *data, uint8_t *syndromes);
+
+public:
+    // Constructor
+    ReedSolomon();
+    // Decode a single dual-basis codeword in place. Returns the corrected byte count, or -1 if uncorrectable
+    int decode(uint8_t *data);
+    // Decode an interleaved block (eg, a 1020 bytes CADU with interleave 4) in place
+    RSFrameReport decodeInterleaved(uint8_t *data, int interleave);
+};
@@ -0,0 +1,315 @@
+#include "reprojection.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+
+// Pass pixels between the vertices of the mesh rasterized onto the map grid
+const int REPROJECTION_MESH_STEP = 4;
+// Map rows per band, at least
+const int REPROJECTION_MIN_BAND = 64;
+// Largest map grid we'll allocate, in pixels
+const size_t REPROJECTION_MAX_PIXELS = (size_t)1 << 28;
+// Sphere of the stereographic projection, in meters
+const double STEREOGRAPHIC_RADIUS = 6371000;
+// Length of a degree of longitude at the equator (WGS-84), in km
+const double KM_PER_DEGREE = 6378.137 * ORBIT_PI / 180;
+
+// Evenly spaced positions up to count - 1, which is always included
+static std::vector<int> meshPositions(int count)
+{
+    std::vector<int> positions;
+    for (int position = 0; position < count - 1; position += REPROJECTION_MESH_STEP)
+        positions.push_back(position);
+    positions.push_back(std::max(count - 1, 0));
+    return positions;
+}
+
+// Mesh vertex, in map pixels, along with the pass pixel it comes from
+struct MeshVertex
+{
+    double x, y;
+    float sourceX, sourceY;
+};
+
+// Rasterize a triangle of the mesh into the inverse mapping, between map rows start and end.
+// Map pixel centers inside it get their pass position interpolated from the vertices
+static void rasterizeTriangle(const MeshVertex &a, const MeshVertex &b, const MeshVertex &c, int width, int start, int end,
+                              float *sourceX, float *sourceY)
+{
+    double area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+    if (area == 0)
+        return;
+
+    int top = std::max<int>(std::ceil(std::min({a.y, b.y, c.y})), start);
+    int bottom = std::min<int>(std::floor(std::max({a.y, b.y, c.y})), end - 1);
+    int left = std::max<int>(std::ceil(std::min({a.x, b.x, c.x})), 0);
+    int right = std::min<int>(std::floor(std::max({a.x, b.x, c.x})), width - 1);
+
+    // Shared edges belong to both triangles, rounding must not open gaps between them
+    const double epsilon = -1e-9;
+    for (int y = top; y <= bottom; y++)
+    {
+        for (int x = left; x <= right; x++)
+        {
+            double wa = ((b.x - x) * (c.y - y) - (b.y - y) * (c.x - x)) / area;
+            double wb = ((c.x - x) * (a.y - y) - (c.y - y) * (a.x - x)) / area;
+            double wc = 1 - wa - wb;
+            if (wa < epsilon || wb < epsilon || wc < epsilon)
+                continue;
+
+            size_t index = (size_t)y * width + x;
+            sourceX[index] = wa * a.sourceX + wb * b.sourceX + wc * c.sourceX;
+            sourceY[index] = wa * a.sourceY + wb * b.sourceY + wc * c.sourceY;
+        }
+    }
+}
+
+// Run function(start, end) over bands of rows on a pool, waiting for all of them
+template <typename Function>
+static void poolBands(int rows, Function function, ThreadPool &pool)
+{
+    int bandCount = std::max(1, std::min(pool.getThreadCount() * 4, rows / REPROJECTION_MIN_BAND));
+    int bandSize = (rows + bandCount - 1) / bandCount;
+
+    std::vector<std::future<void>> results;
+    for (int start = 0; start < rows; start += bandSize)
+        results.push_back(pool.submit([=] { function(start, std::min(start + bandSize, rows)); }));
+    for (std::future<void> &result : results)
+        result.get();
+}
+
+// Map units per pixel of a projection, for a resolution in km per pixel at the equator or the pole.
+// Equirectangular resolutions are rounded so a whole number of pixels spans 180°
+double mapResolution(MapProjection projection, double resolution)
+{
+    if (resolution <= 0)
+        throw std::runtime_error("Invalid map resolution!");
+    if (projection == PROJECTION_EQUIRECTANGULAR)
+        return 180 / std::max(std::round(180 * KM_PER_DEGREE / resolution), 1.0);
+    return resolution * 1000;
+}
+
+// Grid covering the whole Earth, or the hemisphere of the pole for polar stereographic. resolution is in km per pixel
+MapGrid worldGrid(MapProjection projection, bool northPole, double resolution)
+{
+    MapGrid grid = {projection, northPole, mapResolution(projection, resolution), 0, 0, 0, 0};
+    if (projection == PROJECTION_EQUIRECTANGULAR)
+    {
+        // The last column would be the first one again
+        grid.originX = -180;
+        grid.width = std::round(360 / grid.resolution);
+        grid.originY = std::floor(90 / grid.resolution) * grid.resolution;
+        grid.rows = 2 * (int)std::floor(90 / grid.resolution) + 1;
+    }
+    else
+    {
+        // Out to the equator
+        int half = std::floor(2 * STEREOGRAPHIC_RADIUS / grid.resolution);
+        grid.originX = -half * grid.resolution;
+        grid.originY = half * grid.resolution;
+        grid.width = grid.rows = 2 * half + 1;
+    }
+    return grid;
+}
+
+// Latitude / longitude of map coordinates, in degrees
+void unproject(const MapGrid &grid, double x, double y, double &latitude, double &longitude)
+{
+    if (grid.projection == PROJECTION_EQUIRECTANGULAR)
+    {
+        latitude = y;
+        longitude = std::remainder(x, 360.0);
+        return;
+    }
+
+    double colatitude = 2 * std::atan(std::hypot(x, y) / (2 * STEREOGRAPHIC_RADIUS)) * 180 / ORBIT_PI;
+    latitude = grid.northPole ? 90 - colatitude : colatitude - 90;
+    longitude = std::atan2(x, grid.northPole ? -y : y) * 180 / ORBIT_PI;
+}
+
+// Write an ESRI world file locating images of a grid
+void writeWorldFile(const std::string &path, const MapGrid &grid)
+{
+    std::ofstream file(path);
+    file << std::setprecision(12) << grid.resolution << '\n'
+         << 0 << '\n'
+         << 0 << '\n'
+         << -grid.resolution << '\n'
+         << grid.originX << '\n'
+         << grid.originY << '\n';
+}
+
+// Project a latitude / longitude to map coordinates
+void Reprojection::project(double latitude, double longitude, double &x, double &y) const
+{
+    if (grid.projection == PROJECTION_EQUIRECTANGULAR)
+    {
+        x = center_longitude + std::remainder(longitude - center_longitude, 360.0);
+        y = latitude;
+        return;
+    }
+
+    double phi = latitude * ORBIT_PI / 180, lambda = longitude * ORBIT_PI / 180;
+    double distance = 2 * STEREOGRAPHIC_RADIUS * std::tan(ORBIT_PI / 4 - (grid.northPole ? phi : -phi) / 2);
+    x = distance * std::sin(lambda);
+    y = grid.northPole ? -distance * std::cos(lambda) : distance * std::cos(lambda);
+}
+
+// Constructor, building the inverse mapping. resolution is in km per pixel, at the equator or the pole
+Reprojection::Reprojection(const Geolocation &geolocation, MapProjection projection, double resolution, ThreadPool &pool, MapPole pole)
+    : center_longitude{0}, source_width{geolocation.getWidth()}, source_rows{geolocation.getRows()}
+{
+    grid.projection = projection;
+    grid.resolution = mapResolution(projection, resolution);
+
+    // Locate a coarse mesh of the pass
+    std::vector<int> meshColumns = meshPositions(source_width), meshRows = meshPositions(source_rows);
+    std::vector<float> latitudes(meshColumns.size() * meshRows.size()), longitudes(meshColumns.size() * meshRows.size());
+    std::vector<float> rowLatitudes(source_width), rowLongitudes(source_width);
+    for (size_t meshRow = 0; meshRow < meshRows.size(); meshRow++)
+    {
+        geolocation.interpolateRow(meshRows[meshRow], rowLatitudes.data(), rowLongitudes.data());
+        for (size_t meshColumn = 0; meshColumn < meshColumns.size(); meshColumn++)
+        {
+            latitudes[meshRow * meshColumns.size() + meshColumn] = rowLatitudes[meshColumns[meshColumn]];
+            longitudes[meshRow * meshColumns.size() + meshColumn] = rowLongitudes[meshColumns[meshColumn]];
+        }
+    }
+
+    // Pick the pole, or the central longitude, the pass is closest to
+    double latitudeSum = 0, sinSum = 0, cosSum = 0;
+    for (size_t i = 0; i < latitudes.size(); i++)
+    {
+        if (std::isnan(latitudes[i]))
+            continue;
+        latitudeSum += latitudes[i];
+        sinSum += std::sin(longitudes[i] * ORBIT_PI / 180);
+        cosSum += std::cos(longitudes[i] * ORBIT_PI / 180);
+    }
+    grid.northPole = pole == POLE_NEAREST ? latitudeSum >= 0 : pole == POLE_NORTH;
+    center_longitude = std::atan2(sinSum, cosSum) * 180 / ORBIT_PI;
+
+    // Project the mesh, and snap the grid to whole pixels so grids of different passes line up
+    std::vector<MeshVertex> vertices(latitudes.size());
+    double minX = INFINITY, maxX = -INFINITY, minY = INFINITY, maxY = -INFINITY;
+    for (size_t i = 0; i < vertices.size(); i++)
+    {
+        if (std::isnan(latitudes[i]))
+        {
+            vertices[i].x = vertices[i].y = NAN;
+            continue;
+        }
+        project(latitudes[i], longitudes[i], vertices[i].x, vertices[i].y);
+        minX = std::min(minX, vertices[i].x);
+        maxX = std::max(maxX, vertices[i].x);
+        minY = std::min(minY, vertices[i].y);
+        maxY = std::max(maxY, vertices[i].y);
+    }
+    if (!std::isfinite(minX))
+        throw std::runtime_error("Nothing of the pass is on the ground, can't reproject it!");
+
+    grid.originX = std::floor(minX / grid.resolution) * grid.resolution;
+    grid.originY = std::ceil(maxY / grid.resolution) * grid.resolution;
+    grid.width = std::floor((maxX - grid.originX) / grid.resolution) + 1;
+    grid.rows = std::floor((grid.originY - minY) / grid.resolution) + 1;
+    if ((size_t)grid.width * grid.rows > REPROJECTION_MAX_PIXELS)
+        throw std::runtime_error("Map grid too large (" + std::to_string(grid.width) + "x" + std::to_string(grid.rows) + "), use a coarser resolution!");
+
+    for (size_t meshRow = 0; meshRow < meshRows.size(); meshRow++)
+    {
+        for (size_t meshColumn = 0; meshColumn < meshColumns.size(); meshColumn++)
+        {
+            MeshVertex &vertex = vertices[meshRow * meshColumns.size() + meshColumn];
+            vertex.x = (vertex.x - grid.originX) / grid.resolution;
+            vertex.y = (grid.originY - vertex.y) / grid.resolution;
+            vertex.sourceX = meshColumns[meshColumn];
+            vertex.sourceY = meshRows[meshRow];
+        }
+    }
+
+    // Equirectangular cells straddling the antimeridian of the central longitude would cover the whole map
+    const double maxSpan = projection == PROJECTION_EQUIRECTANGULAR ? 180 / grid.resolution : INFINITY;
+
+    // Rasterize the mesh, two triangles per cell. Each band of map rows only keeps what falls in it,
+    // so bands are independent and the result doesn't depend on how many there are
+    source_x.assign((size_t)grid.width * grid.rows, NAN);
+    source_y.assign((size_t)grid.width * grid.rows, NAN);
+    auto rasterizeBand = [&](int start, int end) {
+        for (size_t meshRow = 0; meshRow + 1 < meshRows.size(); meshRow++)
+        {
+            for (size_t meshColumn = 0; meshColumn + 1 < meshColumns.size(); meshColumn++)
+            {
+                const MeshVertex &topLeft = vertices[meshRow * meshColumns.size() + meshColumn];
+                const MeshVertex &topRight = vertices[meshRow * meshColumns.size() + meshColumn + 1];
+                const MeshVertex &bottomLeft = vertices[(meshRow + 1) * meshColumns.size() + meshColumn];
+                const MeshVertex &bottomRight = vertices[(meshRow + 1) * meshColumns.size() + meshColumn + 1];
+
+                double minCellX = std::min({topLeft.x, topRight.x, bottomLeft.x, bottomRight.x});
+                double maxCellX = std::max({topLeft.x, topRight.x, bottomLeft.x, bottomRight.x});
+                double minCellY = std::min({topLeft.y, topRight.y, bottomLeft.y, bottomRight.y});
+                double maxCellY = std::max({topLeft.y, topRight.y, bottomLeft.y, bottomRight.y});
+                // NAN corners fail every comparison, and get skipped here too
+                if (!(maxCellY >= start && minCellY < end && maxCellX - minCellX < maxSpan))
+                    continue;
+
+                rasterizeTriangle(topLeft, topRight, bottomLeft, grid.width, start, end, source_x.data(), source_y.data());
+                rasterizeTriangle(topRight, bottomRight, bottomLeft, grid.width, start, end, source_x.data(), source_y.data());
+            }
+        }
+    };
+    poolBands(grid.rows, rasterizeBand, pool);
+}
+
+// Resample a plane of the pass into a getWidth() * getRows() map plane, 0 outside of the pass
+void Reprojection::resample(const uint16_t *plane, uint16_t *output, Resampling resampling, ThreadPool &pool) const
+{
+    auto resampleBand = [&](int start, int end) {
+        for (size_t i = (size_t)start * grid.width; i < (size_t)end * grid.width; i++)
+        {
+            float x = source_x[i], y = source_y[i];
+            if (std::isnan(x))
+            {
+                output[i] = 0;
+                continue;
+            }
+
+            if (resampling == RESAMPLING_NEAREST)
+            {
+                output[i] = plane[(size_t)(y + 0.5f) * source_width + (size_t)(x + 0.5f)];
+                continue;
+            }
+
+            int x0 = std::min<int>(x, std::max(source_width - 2, 0)), y0 = std::min<int>(y, std::max(source_rows - 2, 0));
+            int x1 = std::min(x0 + 1, source_width - 1), y1 = std::min(y0 + 1, source_rows - 1);
+            float fx = x - x0, fy = y - y0;
+            const uint16_t *above = &plane[(size_t)y0 * source_width], *below = &plane[(size_t)y1 * source_width];
+            float top = above[x0] + (above[x1] - above[x0]) * fx;
+            float bottom = below[x0] + (below[x1] - below[x0]) * fx;
+            output[i] = top + (bottom - top) * fy + 0.5f;
+        }
+    };
+    poolBands(grid.rows, resampleBand, pool);
+}
+
+// Pass row each map pixel comes from, NAN where the pass doesn't cover it
+const std::vector<float> &Reprojection::getSourceRows() const
+{
+    return source_y;
+}
+
+const MapGrid &Reprojection::getGrid() const
+{
+    return grid;
+}
+
+int Reprojection::getWidth() const
+{
+    return grid.width;
+}
+
+int Reprojection::getRows() const
+{
+    return grid.rows;
+}
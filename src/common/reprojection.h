@@ -0,0 +1,83 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "geolocation.h"
+#include "thread_pool.h"
+
+// Map grids a pass can be reprojected to
+enum MapProjection
+{
+    PROJECTION_EQUIRECTANGULAR,     // Plate carrée, in degrees
+    PROJECTION_POLAR_STEREOGRAPHIC, // Spherical, centered on a pole, in meters
+};
+
+// Pole a stereographic grid is centered on
+enum MapPole
+{
+    POLE_NEAREST, // The one closest to the pass
+    POLE_NORTH,
+    POLE_SOUTH,
+};
+
+// How output pixels are sampled from the pass
+enum Resampling
+{
+    RESAMPLING_NEAREST,
+    RESAMPLING_BILINEAR,
+};
+
+// Regular, north-up grid on a map projection. Pixel centers all fall on multiples of the resolution,
+// so grids of the same projection and resolution line up
+struct MapGrid
+{
+    MapProjection projection;
+    bool northPole;
+    // Map units per pixel, degrees or meters
+    double resolution;
+    // Map coordinates of the center of the top-left pixel
+    double originX;
+    double originY;
+    int width;
+    int rows;
+};
+
+// Map units per pixel of a projection, for a resolution in km per pixel at the equator or the pole.
+// Equirectangular resolutions are rounded so a whole number of pixels spans 180°
+double mapResolution(MapProjection projection, double resolution);
+// Grid covering the whole Earth, or the hemisphere of the pole for polar stereographic. resolution is in km per pixel
+MapGrid worldGrid(MapProjection projection, bool northPole, double resolution);
+// Latitude / longitude of map coordinates, in degrees
+void unproject(const MapGrid &grid, double x, double y, double &latitude, double &longitude);
+// Write an ESRI world file locating images of a grid
+void writeWorldFile(const std::string &path, const MapGrid &grid);
+
+// Reprojection of a pass to a map grid covering it. The inverse mapping, from each map pixel back
+// to a position in the pass, is built once and reused for every channel
+class Reprojection
+{
+private:
+    MapGrid grid;
+    // Center longitude, equirectangular longitudes being unwrapped around it
+    double center_longitude;
+    // Size of the pass
+    int source_width;
+    int source_rows;
+    // Position in the pass of each map pixel, NAN where the pass doesn't cover it
+    std::vector<float> source_x;
+    std::vector<float> source_y;
+
+    // Project a latitude / longitude to map coordinates
+    void project(double latitude, double longitude, double &x, double &y) const;
+
+public:
+    // Constructor, building the inverse mapping. resolution is in km per pixel, at the equator or the pole
+    Reprojection(const Geolocation &geolocation, MapProjection projection, double resolution, ThreadPool &pool, MapPole pole = POLE_NEAREST);
+    // Resample a plane of the pass into a getWidth() * getRows() map plane, 0 outside of the pass
+    void resample(const uint16_t *plane, uint16_t *output, Resampling resampling, ThreadPool &pool) const;
+    // Pass row each map pixel comes from, NAN where the pass doesn't cover it
+    const std::vector<float> &getSourceRows() const;
+    const MapGrid &getGrid() const;
+    int getWidth() const;
+    int getRows() const;
+};
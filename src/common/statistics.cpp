@@ -0,0 +1,121 @@
+#include "statistics.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+
+// Constructor, for 10-bits counts or 16-bits calibrated values
+PassStatistics::PassStatistics(int channels, int sampleBits) : channels{channels}, sample_bits{sampleBits}
+{
+    // STATISTICS_BINS being 1 << 10, 10-bits counts get a bin each
+    bin_shift = std::max(sampleBits - 10, 0);
+    statistics = makeAccumulators();
+}
+
+// Empty accumulators for a thread
+std::vector<ChannelStatistics> PassStatistics::makeAccumulators() const
+{
+    return std::vector<ChannelStatistics>(channels, {UINT16_MAX, 0, 0, 0, 0, 0, 0, std::vector<uint64_t>(STATISTICS_BINS, 0)});
+}
+
+// Add a line of width channel-interleaved samples to accumulators
+void PassStatistics::accumulateLine(std::vector<ChannelStatistics> &accumulators, const uint16_t *line, int width) const
+{
+    const uint16_t topValue = (1 << sample_bits) - 1;
+    for (int channel = 0; channel < channels; channel++)
+    {
+        ChannelStatistics &channelStatistics = accumulators[channel];
+        uint16_t min = channelStatistics.min, max = channelStatistics.max;
+        uint64_t sum = 0, sumSquares = 0, zero = 0, saturated = 0;
+        uint64_t *histogram = channelStatistics.histogram.data();
+
+        for (int pixel = 0; pixel < width; pixel++)
+        {
+            // 10-bits counts may carry garbage above their 10 bits
+            uint16_t value = std::min(line[pixel * channels + channel], topValue);
+            min = std::min(min, value);
+            max = std::max(max, value);
+            sum += value;
+            sumSquares += (uint32_t)value * value;
+            zero += value == 0;
+            saturated += value == topValue;
+            histogram[value >> bin_shift]++;
+        }
+
+        channelStatistics.min = min;
+        channelStatistics.max = max;
+        channelStatistics.count += width;
+        channelStatistics.sum += sum;
+        channelStatistics.sumSquares += sumSquares;
+        channelStatistics.zero += zero;
+        channelStatistics.saturated += saturated;
+    }
+}
+
+// Merge a thread's accumulators, safe to call from several threads
+void PassStatistics::merge(const std::vector<ChannelStatistics> &accumulators)
+{
+    std::lock_guard<std::mutex> lock(merge_mutex);
+    for (int channel = 0; channel < channels; channel++)
+    {
+        ChannelStatistics &total = statistics[channel];
+        const ChannelStatistics &part = accumulators[channel];
+        total.min = std::min(total.min, part.min);
+        total.max = std::max(total.max, part.max);
+        total.count += part.count;
+        total.sum += part.sum;
+        total.sumSquares += part.sumSquares;
+        total.zero += part.zero;
+        total.saturated += part.saturated;
+        for (int bin = 0; bin < STATISTICS_BINS; bin++)
+            total.histogram[bin] += part.histogram[bin];
+    }
+}
+
+// Statistics of a channel (1-based), once everything is merged
+const ChannelStatistics &PassStatistics::getChannel(int channel) const
+{
+    return statistics[channel - 1];
+}
+
+// Samples per histogram bin
+int PassStatistics::getBinWidth() const
+{
+    return 1 << bin_shift;
+}
+
+// Write everything to a JSON file
+void PassStatistics::writeJSON(const std::string &path, const std::string &satellite, int width, int rows) const
+{
+    std::ofstream json(path);
+    json << "{\n";
+    json << "    \"satellite\": \"" << satellite << "\",\n";
+    json << "    \"width\": " << width << ",\n";
+    json << "    \"rows\": " << rows << ",\n";
+    json << "    \"sample_bits\": " << sample_bits << ",\n";
+    json << "    \"calibrated\": " << (sample_bits > 10 ? "true" : "false") << ",\n";
+    json << "    \"histogram_bin_width\": " << getBinWidth() << ",\n";
+    json << "    \"channels\": [\n";
+    for (int channel = 0; channel < channels; channel++)
+    {
+        const ChannelStatistics &channelStatistics = statistics[channel];
+        double mean = channelStatistics.count > 0 ? (double)channelStatistics.sum / channelStatistics.count : 0;
+        double variance = channelStatistics.count > 0 ? (double)channelStatistics.sumSquares / channelStatistics.count - mean * mean : 0;
+
+        json << "        {\n";
+        json << "            \"channel\": " << channel + 1 << ",\n";
+        json << "            \"count\": " << channelStatistics.count << ",\n";
+        json << "            \"min\": " << (channelStatistics.count > 0 ? channelStatistics.min : 0) << ",\n";
+        json << "            \"max\": " << channelStatistics.max << ",\n";
+        json << "            \"mean\": " << mean << ",\n";
+        json << "            \"stddev\": " << std::sqrt(std::max(variance, 0.0)) << ",\n";
+        json << "            \"zero\": " << channelStatistics.zero << ",\n";
+        json << "            \"saturated\": " << channelStatistics.saturated << ",\n";
+        json << "            \"histogram\": [";
+        for (int bin = 0; bin < STATISTICS_BINS; bin++)
+            json << (bin > 0 ? ", " : "") << channelStatistics.histogram[bin];
+        json << "]\n";
+        json << "        }" << (channel + 1 < channels ? "," : "") << "\n";
+    }
+    json << "    ]\n";
+    json << "}\n";
+}
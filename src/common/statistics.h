@@ -0,0 +1,51 @@
+#pragma once
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Bins of a channel histogram, evenly covering the sample range
+#define STATISTICS_BINS 1024
+
+// Running statistics of a channel's samples
+struct ChannelStatistics
+{
+    uint16_t min;
+    uint16_t max;
+    uint64_t count;
+    uint64_t sum;
+    uint64_t sumSquares;
+    // Samples of 0, and at the top of the range
+    uint64_t zero;
+    uint64_t saturated;
+    std::vector<uint64_t> histogram;
+};
+
+// Per-channel statistics of a pass, gathered while its lines go by. Threads each fill their own
+// accumulators, merged once they're done, so lines can be walked in parallel
+class PassStatistics
+{
+private:
+    int channels;
+    // Samples are sample_bits wide, histogram bins are 1 << bin_shift samples wide
+    int sample_bits;
+    int bin_shift;
+    std::vector<ChannelStatistics> statistics;
+    std::mutex merge_mutex;
+
+public:
+    // Constructor, for 10-bits counts or 16-bits calibrated values
+    PassStatistics(int channels, int sampleBits);
+    // Empty accumulators for a thread
+    std::vector<ChannelStatistics> makeAccumulators() const;
+    // Add a line of width channel-interleaved samples to accumulators
+    void accumulateLine(std::vector<ChannelStatistics> &accumulators, const uint16_t *line, int width) const;
+    // Merge a thread's accumulators, safe to call from several threads
+    void merge(const std::vector<ChannelStatistics> &accumulators);
+    // Statistics of a channel (1-based), once everything is merged
+    const ChannelStatistics &getChannel(int channel) const;
+    // Samples per histogram bin
+    int getBinWidth() const;
+    // Write everything to a JSON file
+    void writeJSON(const std::string &path, const std::string &satellite, int width, int rows) const;
+};
@@ -0,0 +1,196 @@
+#include "stream_output.h"
+#include <algorithm>
+#include <future>
+#include <memory>
+#include "clahe.h"
+#include "equalizer.h"
+#include "parallel.h"
+#include "stretch.h"
+
+// Pull one channel out of an interleaved line, scaled for output
+void extractChannel(const std::vector<uint16_t> &line, int channels, int channel, int width, int scale, uint16_t *output)
+{
+    for (int pixel = 0; pixel < width; pixel++)
+        output[pixel] = line[pixel * channels + channel - 1] * scale;
+}
+
+// Write channels of a pass to a PNG line by line, so memory use doesn't grow with pass length.
+// 1 channel gives a grayscale image, 3 an RGB one. Equalization takes a first pass over the
+// lines to build its histogram, and is skipped if equalization <= 0. With noData, samples of 0 are left out of it.
+// A percentile stretch (stretchHigh > stretchLow, in %) replaces equalization, and takes a single pass : its
+// histogram grows as rows go by, bounds being refreshed every STREAM_STRETCH_REFRESH rows. CLAHE (claheClip > 0)
+// replaces both, its first pass filling tile histograms a tile row per thread
+void streamPNG(const LineSource &source, const std::vector<int> &channels, int equalization, Orientation orientation, const std::string &path, bool noData,
+               double stretchLow, double stretchHigh, double claheClip)
+{
+    const int outputChannels = channels.size();
+
+    // One raw line, and one output row per channel
+    std::vector<uint16_t> line(source.width * source.channels);
+    std::vector<uint16_t> rows(source.width * outputChannels);
+    std::vector<const uint16_t *> planes(outputChannels);
+    for (int channel = 0; channel < outputChannels; channel++)
+        planes[channel] = &rows[channel * source.width];
+
+    // Read and scale a row, missing ones being left blank
+    auto readRow = [&](int row) {
+        if (!source.readLine(row, line.data()))
+        {
+            std::fill(rows.begin(), rows.end(), 0);
+            return;
+        }
+
+        for (int channel = 0; channel < outputChannels; channel++)
+            extractChannel(line, source.channels, channels[channel], source.width, source.scale, &rows[channel * source.width]);
+    };
+
+    // Rows in output order
+    auto sourceRow = [&](int outputRow) { return orientationReversesRows(orientation) ? source.rows - outputRow - 1 : outputRow; };
+
+    // CLAHE first pass, tile histograms of each output channel
+    const bool adaptive = claheClip > 0;
+    std::vector<std::unique_ptr<ClaheEqualizer>> adaptiveEqualizers;
+    if (adaptive)
+    {
+        for (int channel = 0; channel < outputChannels; channel++)
+            adaptiveEqualizers.emplace_back(new ClaheEqualizer(source.width, source.rows, claheClip, source.scale, noData));
+
+        // Each thread reads whole tile rows, no histogram is shared. Missing rows are left out
+        const ClaheEqualizer &tiling = *adaptiveEqualizers[0];
+        parallelBands(
+            tiling.getTileRows(),
+            [&](size_t start, size_t end) {
+                std::vector<uint16_t> bandLine(source.width * source.channels);
+                std::vector<uint16_t> bandRow(source.width);
+                for (int row = tiling.getTileRowStart(start); row < tiling.getTileRowStart(end); row++)
+                {
+                    if (!source.readLine(row, bandLine.data()))
+                        continue;
+                    for (int channel = 0; channel < outputChannels; channel++)
+                    {
+                        extractChannel(bandLine, source.channels, channels[channel], source.width, source.scale, bandRow.data());
+                        adaptiveEqualizers[channel]->accumulateRow(row, bandRow.data());
+                    }
+                }
+            },
+            1);
+
+        for (std::unique_ptr<ClaheEqualizer> &adaptiveEqualizer : adaptiveEqualizers)
+            adaptiveEqualizer->buildLUTs();
+        equalization = 0;
+    }
+
+    // Stretch bounds start from the first rows only, read twice rather than held
+    const bool stretching = !adaptive && stretchHigh > stretchLow;
+    const int preroll = std::min(source.rows, STREAM_STRETCH_PREROLL);
+    PercentileStretch stretch(stretchLow, stretchHigh, source.scale, noData);
+    if (stretching)
+    {
+        for (int outputRow = 0; outputRow < preroll; outputRow++)
+        {
+            readRow(sourceRow(outputRow));
+            stretch.accumulate(rows.data(), rows.size());
+        }
+        stretch.update();
+        equalization = 0;
+    }
+
+    // First pass, histogram of everything we'll output
+    HistogramEqualizer equalizer(equalization, source.scale, noData);
+    if (equalization > 0)
+    {
+        for (int row = 0; row < source.rows; row++)
+        {
+            readRow(row);
+            equalizer.accumulate(rows.data(), rows.size());
+        }
+        equalizer.buildLUT();
+    }
+
+    // Second pass, rows go straight to the file in output order
+    PNGWriter writer(path, source.width, source.rows, outputChannels, orientation);
+    for (int outputRow = 0; outputRow < source.rows; outputRow++)
+    {
+        const int row = sourceRow(outputRow);
+        readRow(row);
+        if (adaptive)
+        {
+            for (int channel = 0; channel < outputChannels; channel++)
+                adaptiveEqualizers[channel]->applyRow(row, &rows[channel * source.width]);
+        }
+        else if (stretching)
+        {
+            if (outputRow >= preroll)
+            {
+                stretch.accumulate(rows.data(), rows.size());
+                if ((outputRow - preroll) % STREAM_STRETCH_REFRESH == STREAM_STRETCH_REFRESH - 1)
+                    stretch.update();
+            }
+            stretch.apply(rows.data(), rows.size());
+        }
+        else if (equalization > 0)
+        {
+            equalizer.apply(rows.data(), rows.size());
+        }
+        writer.writeRow(planes.data());
+    }
+    writer.close();
+}
+
+// Write each channel of a pass to its own grayscale PNG, path-N, neither equalized nor rotated. Lines are only read once,
+// a block of STREAM_DUMP_BLOCK at a time, and a block's rows are encoded into every file in parallel while the next one is read
+void streamDumpPNGs(const LineSource &source, const std::string &path, ThreadPool &pool)
+{
+    std::vector<std::unique_ptr<PNGWriter>> writers;
+    for (int channel = 1; channel <= source.channels; channel++)
+        writers.emplace_back(new PNGWriter(path + "-" + std::to_string(channel), source.width, source.rows, 1));
+
+    // Two blocks of planes, one channel after the other, one being encoded while the other is filled
+    const size_t blockSize = (size_t)STREAM_DUMP_BLOCK * source.width;
+    std::vector<uint16_t> blocks[2] = {std::vector<uint16_t>(blockSize * source.channels), std::vector<uint16_t>(blockSize * source.channels)};
+    std::vector<uint16_t> line(source.width * source.channels);
+
+    // Encoding tasks use the blocks, let them all finish before reporting errors
+    std::vector<std::future<void>> encoding;
+    auto finishEncoding = [&]() {
+        for (std::future<void> &result : encoding)
+            pool.wait(result);
+        for (std::future<void> &result : encoding)
+            result.get();
+        encoding.clear();
+    };
+
+    for (int blockStart = 0, block = 0; blockStart < source.rows; blockStart += STREAM_DUMP_BLOCK, block ^= 1)
+    {
+        const int blockRows = std::min(STREAM_DUMP_BLOCK, source.rows - blockStart);
+        uint16_t *planes = blocks[block].data();
+        for (int row = 0; row < blockRows; row++)
+        {
+            // Missing rows are left blank
+            if (!source.readLine(blockStart + row, line.data()))
+            {
+                for (int channel = 0; channel < source.channels; channel++)
+                    std::fill_n(&planes[channel * blockSize + row * source.width], source.width, 0);
+                continue;
+            }
+
+            for (int channel = 0; channel < source.channels; channel++)
+                extractChannel(line, source.channels, channel + 1, source.width, source.scale, &planes[channel * blockSize + row * source.width]);
+        }
+
+        // Files take rows in order, the previous block has to be out first
+        finishEncoding();
+        for (int channel = 0; channel < source.channels; channel++)
+            encoding.push_back(pool.submit([&, planes, channel, blockRows] {
+                for (int row = 0; row < blockRows; row++)
+                {
+                    const uint16_t *plane = &planes[channel * blockSize + row * source.width];
+                    writers[channel]->writeRow(&plane);
+                }
+            }));
+    }
+    finishEncoding();
+
+    for (std::unique_ptr<PNGWriter> &writer : writers)
+        writer->close();
+}
@@ -0,0 +1,25 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "line_source.h"
+#include "png_writer.h"
+#include "thread_pool.h"
+
+// Rows read ahead to get first stretch bounds, then rows between bound refreshes
+#define STREAM_STRETCH_PREROLL 256
+#define STREAM_STRETCH_REFRESH 64
+// Rows read at once by dumps
+#define STREAM_DUMP_BLOCK 64
+
+// Write channels of a pass to a PNG line by line, so memory use doesn't grow with pass length.
+// 1 channel gives a grayscale image, 3 an RGB one. Equalization takes a first pass over the
+// lines to build its histogram, and is skipped if equalization <= 0. With noData, samples of 0 are left out of it.
+// A percentile stretch (stretchHigh > stretchLow, in %) replaces equalization, and takes a single pass : its
+// histogram grows as rows go by, bounds being refreshed every STREAM_STRETCH_REFRESH rows. CLAHE (claheClip > 0)
+// replaces both, its first pass filling tile histograms a tile row per thread
+void streamPNG(const LineSource &source, const std::vector<int> &channels, int equalization, Orientation orientation, const std::string &path, bool noData = false,
+               double stretchLow = 0, double stretchHigh = 0, double claheClip = 0);
+
+// Write each channel of a pass to its own grayscale PNG, path-N, neither equalized nor rotated. Lines are only read once,
+// a block of STREAM_DUMP_BLOCK at a time, and a block's rows are encoded into every file in parallel while the next one is read
+void streamDumpPNGs(const LineSource &source, const std::string &path, ThreadPool &pool);
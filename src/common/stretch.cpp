@@ -0,0 +1,98 @@
+#include "stretch.h"
+#include <algorithm>
+#include <mutex>
+#include "parallel.h"
+
+// Constructor
+PercentileStretch::PercentileStretch(double lowPercent, double highPercent, int scale, bool ignoreZero)
+    : low_percent{lowPercent}, high_percent{highPercent}, scale{scale}, ignore_zero{ignoreZero}, histogram(STRETCH_BINS, 0)
+{
+    // Scaled samples are 10-bits counts, a bin each. Unscaled ones can take any 16-bits value
+    bin_shift = scale > 1 ? 0 : 6;
+
+    // Identity until the first update
+    lut.resize(UINT16_MAX / scale + 1);
+    for (size_t level = 0; level < lut.size(); level++)
+        lut[level] = level * scale;
+}
+
+// Add samples to the histogram. Can be called at any time, the LUT only changes on update()
+void PercentileStretch::accumulate(const uint16_t *data, size_t size)
+{
+    std::mutex merge_mutex;
+
+    // Each band counts into its own histogram, merged at the end
+    parallelBands(size, [&](size_t start, size_t end) {
+        std::vector<uint64_t> counts(STRETCH_BINS, 0);
+        for (size_t i = start; i < end; i++)
+            if (data[i] != 0 || !ignore_zero)
+                counts[sampleBin(data[i])]++;
+
+        std::lock_guard<std::mutex> lock(merge_mutex);
+        for (int bin = 0; bin < STRETCH_BINS; bin++)
+            histogram[bin] += counts[bin];
+    });
+}
+
+// Add another stretch's histogram to this one
+void PercentileStretch::merge(const PercentileStretch &other)
+{
+    for (int bin = 0; bin < STRETCH_BINS; bin++)
+        histogram[bin] += other.histogram[bin];
+}
+
+// Rebuild the LUT from the percentiles of everything accumulated so far
+void PercentileStretch::update()
+{
+    uint64_t total = 0;
+    for (int bin = 0; bin < STRETCH_BINS; bin++)
+        total += histogram[bin];
+    if (total == 0)
+        return;
+
+    // First bins reaching each percentile
+    const double lowCount = total * low_percent / 100, highCount = total * high_percent / 100;
+    int lowBin = -1, highBin = -1;
+    uint64_t cumul = 0;
+    for (int bin = 0; bin < STRETCH_BINS && highBin < 0; bin++)
+    {
+        cumul += histogram[bin];
+        if (lowBin < 0 && cumul > lowCount)
+            lowBin = bin;
+        if (cumul >= highCount && cumul > 0)
+            highBin = bin;
+    }
+    if (highBin < 0)
+        highBin = STRETCH_BINS - 1;
+
+    // From the bottom of the low bin to the top of the high one
+    const int lowLevel = lowBin << bin_shift, highLevel = ((highBin + 1) << bin_shift) - 1;
+    if (highLevel <= lowLevel)
+        return;
+
+    for (int level = 0; level < (int)lut.size(); level++)
+    {
+        int value = (int64_t)(level - lowLevel) * UINT16_MAX / (highLevel - lowLevel);
+        lut[level] = std::min(std::max(value, 0), (int)UINT16_MAX);
+    }
+    if (ignore_zero)
+        lut[0] = 0;
+}
+
+// Apply the LUT to samples, in place
+void PercentileStretch::apply(uint16_t *data, size_t size) const
+{
+    parallelBands(size, [&](size_t start, size_t end) {
+        for (size_t i = start; i < end; i++)
+            data[i] = lut[data[i] / scale];
+    });
+}
+
+// Stretch samples in place, in one go
+void stretchSamples(uint16_t *data, size_t size, double lowPercent, double highPercent, int scale, bool ignoreZero)
+{
+    PercentileStretch stretch(lowPercent, highPercent, scale, ignoreZero);
+    stretch.accumulate(data, size);
+    stretch.update();
+    stretch.apply(data, size);
+}
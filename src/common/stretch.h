@@ -0,0 +1,50 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "hrpt.h"
+
+// Histogram bins percentiles are picked from
+#define STRETCH_BINS 1024
+
+// Linear contrast stretch between two percentiles of the samples, eg. 0.5 % and 99.5 %, mapped to the full
+// 16-bits range. Percentiles come from a fixed 1024-bin histogram (a bin per 10-bits level, 64 values wide for
+// calibrated samples), so it can be fed as lines arrive, refreshed at any point and merged across threads
+class PercentileStretch
+{
+private:
+    // Percentiles, in %
+    double low_percent;
+    double high_percent;
+    // Spacing between sample levels
+    int scale;
+    // Levels per bin are 1 << bin_shift
+    int bin_shift;
+    // Samples of 0 are no-data, left out of the histogram and kept at 0
+    bool ignore_zero;
+    std::vector<uint64_t> histogram;
+    // Output value for each level
+    std::vector<uint16_t> lut;
+
+    // Histogram bin of a scaled sample
+    int sampleBin(uint16_t value) const
+    {
+        return std::min((value / scale) >> bin_shift, STRETCH_BINS - 1);
+    }
+
+public:
+    // Constructor
+    PercentileStretch(double lowPercent, double highPercent, int scale = HRPT_PIXEL_SCALE, bool ignoreZero = false);
+    // Add samples to the histogram. Can be called at any time, the LUT only changes on update()
+    void accumulate(const uint16_t *data, size_t size);
+    // Add another stretch's histogram to this one
+    void merge(const PercentileStretch &other);
+    // Rebuild the LUT from the percentiles of everything accumulated so far
+    void update();
+    // Apply the LUT to samples, in place
+    void apply(uint16_t *data, size_t size) const;
+};
+
+// Stretch samples in place, in one go
+void stretchSamples(uint16_t *data, size_t size, double lowPercent, double highPercent, int scale = HRPT_PIXEL_SCALE, bool ignoreZero = false);
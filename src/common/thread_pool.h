@@ -0,0 +1,121 @@
+#pragma once
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// Fixed-size pool of worker threads, running tasks in submission order
+class ThreadPool
+{
+private:
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex queue_mutex;
+    std::condition_variable queue_condition;
+    bool stopping;
+
+    // Set on the pool's own threads
+    static bool &workerFlag()
+    {
+        thread_local bool worker = false;
+        return worker;
+    }
+
+    // Worker loop, pops and runs tasks until the pool is destroyed
+    void work()
+    {
+        workerFlag() = true;
+        while (true)
+        {
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(queue_mutex);
+                queue_condition.wait(lock, [this] { return stopping || !tasks.empty(); });
+                if (stopping && tasks.empty())
+                    return;
+                task = std::move(tasks.front());
+                tasks.pop();
+            }
+            task();
+        }
+    }
+
+public:
+    // Constructor, defaults to one thread per core
+    ThreadPool(int threadCount = 0) : stopping{false}
+    {
+        if (threadCount <= 0)
+            threadCount = std::max(1u, std::thread::hardware_concurrency());
+        for (int i = 0; i < threadCount; i++)
+            workers.emplace_back(&ThreadPool::work, this);
+    }
+
+    // Everything submitted is completed before returning
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            stopping = true;
+        }
+        queue_condition.notify_all();
+        for (std::thread &worker : workers)
+            worker.join();
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    // Queue a task, its result (or exception) coming back through the future
+    template <typename Function>
+    auto submit(Function function) -> std::future<decltype(function())>
+    {
+        auto task = std::make_shared<std::packaged_task<decltype(function())()>>(std::move(function));
+        std::future<decltype(function())> result = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock(queue_mutex);
+            tasks.emplace([task] { (*task)(); });
+        }
+        queue_condition.notify_one();
+        return result;
+    }
+
+    // Wait for a result of this pool, running queued tasks meanwhile. Tasks can then wait on tasks they submitted
+    // themselves without every worker ending up blocked
+    template <typename Result>
+    void wait(const std::future<Result> &result)
+    {
+        while (result.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        {
+            std::function<void()> task;
+            {
+                std::lock_guard<std::mutex> lock(queue_mutex);
+                if (!tasks.empty())
+                {
+                    task = std::move(tasks.front());
+                    tasks.pop();
+                }
+            }
+            if (task)
+                task();
+            else
+                result.wait_for(std::chrono::milliseconds(1));
+        }
+    }
+
+    // Whether the calling thread is a worker of some pool, that shouldn't start threads of its own
+    static bool onWorkerThread()
+    {
+        return workerFlag();
+    }
+
+    int getThreadCount()
+    {
+        return workers.size();
+    }
+};
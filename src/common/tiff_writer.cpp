@@ -0,0 +1,201 @@
+#include "tiff_writer.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <future>
+#include <stdexcept>
+#include <vector>
+#include <zlib.h>
+
+// Field types
+const uint16_t TIFF_SHORT = 3;
+const uint16_t TIFF_LONG = 4;
+// Tags values we use
+const uint16_t TIFF_COMPRESSION_DEFLATE = 8;
+const uint16_t TIFF_PHOTOMETRIC_GRAY = 1;
+const uint16_t TIFF_PHOTOMETRIC_RGB = 2;
+const uint16_t TIFF_PLANAR_SEPARATE = 2;
+const uint16_t TIFF_PREDICTOR_HORIZONTAL = 2;
+const uint16_t TIFF_EXTRA_SAMPLE_UNSPECIFIED = 0;
+
+// An IFD entry, values being stored as SHORT or LONG
+struct TIFFEntry
+{
+    uint16_t tag;
+    uint16_t type;
+    std::vector<uint32_t> values;
+};
+
+// Write a value in native byte order, which the header advertises
+template <typename T>
+void writeValue(std::ofstream &output, T value)
+{
+    output.write((const char *)&value, sizeof(T));
+}
+
+// Cut a tile out of a plane, applying orientation and padding what's outside the image, then compress it
+std::vector<uint8_t> compressTile(const uint16_t *plane, int width, int height, int tileX, int tileY, Orientation orientation)
+{
+    std::vector<uint16_t> tile(TIFF_TILE_SIZE * TIFF_TILE_SIZE, 0);
+    int tileWidth = std::min(TIFF_TILE_SIZE, width - tileX * TIFF_TILE_SIZE);
+    int tileHeight = std::min(TIFF_TILE_SIZE, height - tileY * TIFF_TILE_SIZE);
+
+    for (int y = 0; y < tileHeight; y++)
+    {
+        int row = tileY * TIFF_TILE_SIZE + y;
+        const uint16_t *source = &plane[(size_t)(orientationReversesRows(orientation) ? height - row - 1 : row) * width];
+        uint16_t *line = &tile[y * TIFF_TILE_SIZE];
+
+        for (int x = 0; x < tileWidth; x++)
+        {
+            int column = tileX * TIFF_TILE_SIZE + x;
+            line[x] = source[orientationReversesPixels(orientation) ? width - column - 1 : column];
+        }
+
+        // Horizontal differencing predictor, done backwards so each difference uses the original neighbour
+        for (int x = TIFF_TILE_SIZE - 1; x > 0; x--)
+            line[x] -= line[x - 1];
+    }
+
+    uLongf compressedSize = compressBound(tile.size() * sizeof(uint16_t));
+    std::vector<uint8_t> compressed(compressedSize);
+    if (compress2(compressed.data(), &compressedSize, (const Bytef *)tile.data(), tile.size() * sizeof(uint16_t), Z_DEFAULT_COMPRESSION) != Z_OK)
+        throw std::runtime_error("Could not compress TIFF tile");
+    compressed.resize(compressedSize);
+    return compressed;
+}
+
+// Write a planar 16-bits image as a tiled, deflate-compressed TIFF. Every tile is compressed on its own
+// on the thread pool, so readers get random access to any of them. 3 samples are stored as RGB, anything
+// else as grayscale with extra samples. Orientation is applied while cutting tiles
+void saveTIFF(const std::string &path, const uint16_t *data, int width, int height, int samples, ThreadPool &pool, Orientation orientation)
+{
+    std::ofstream output(path, std::ios::binary);
+    if (!output)
+        throw std::runtime_error("Could not open " + path + " for writing");
+
+    const int tilesAcross = (width + TIFF_TILE_SIZE - 1) / TIFF_TILE_SIZE;
+    const int tilesDown = (height + TIFF_TILE_SIZE - 1) / TIFF_TILE_SIZE;
+    const size_t planeSize = (size_t)width * height;
+
+    // Compress all tiles in parallel. Planes are stored separately, each as a full set of tiles
+    std::vector<std::future<std::vector<uint8_t>>> tiles;
+    for (int sample = 0; sample < samples; sample++)
+        for (int tileY = 0; tileY < tilesDown; tileY++)
+            for (int tileX = 0; tileX < tilesAcross; tileX++)
+                tiles.push_back(pool.submit([=] { return compressTile(&data[sample * planeSize], width, height, tileX, tileY, orientation); }));
+
+    // Classic TIFF uses 32-bits offsets. Past them, the partial file goes, once no tile task uses data any more
+    auto tooLarge = [&]() {
+        for (std::future<std::vector<uint8_t>> &tile : tiles)
+            if (tile.valid())
+                pool.wait(tile);
+        output.close();
+        std::remove(path.c_str());
+        return std::runtime_error("TIFF output over 4GB");
+    };
+
+    // Header, in our own byte order. The IFD offset gets filled at the end
+    const uint16_t byteOrderProbe = 1;
+    output.write(*(const uint8_t *)&byteOrderProbe == 1 ? "II" : "MM", 2);
+    writeValue<uint16_t>(output, 42);
+    writeValue<uint32_t>(output, 0);
+
+    // Tiles go to the file in order, as they complete
+    std::vector<uint32_t> tileOffsets, tileByteCounts;
+    uint64_t position = 8;
+    for (std::future<std::vector<uint8_t>> &tile : tiles)
+    {
+        pool.wait(tile);
+        std::vector<uint8_t> compressed = tile.get();
+        if (position + compressed.size() > UINT32_MAX)
+            throw tooLarge();
+        tileOffsets.push_back(position);
+        tileByteCounts.push_back(compressed.size());
+        output.write((const char *)compressed.data(), compressed.size());
+        position += compressed.size();
+    }
+
+    // Keep the IFD word-aligned
+    if (position % 2)
+    {
+        output.put(0);
+        position++;
+    }
+
+    // Tags, sorted as required
+    uint16_t photometric = samples == 3 ? TIFF_PHOTOMETRIC_RGB : TIFF_PHOTOMETRIC_GRAY;
+    int extraSamples = samples - (samples == 3 ? 3 : 1);
+    std::vector<TIFFEntry> entries = {
+        {256, TIFF_LONG, {(uint32_t)width}},
+        {257, TIFF_LONG, {(uint32_t)height}},
+        {258, TIFF_SHORT, std::vector<uint32_t>(samples, 16)},
+        {259, TIFF_SHORT, {TIFF_COMPRESSION_DEFLATE}},
+        {262, TIFF_SHORT, {photometric}},
+        {277, TIFF_SHORT, {(uint32_t)samples}},
+        {284, TIFF_SHORT, {TIFF_PLANAR_SEPARATE}},
+        {317, TIFF_SHORT, {TIFF_PREDICTOR_HORIZONTAL}},
+        {322, TIFF_LONG, {TIFF_TILE_SIZE}},
+        {323, TIFF_LONG, {TIFF_TILE_SIZE}},
+        {324, TIFF_LONG, tileOffsets},
+        {325, TIFF_LONG, tileByteCounts},
+    };
+    if (extraSamples > 0)
+        entries.push_back({338, TIFF_SHORT, std::vector<uint32_t>(extraSamples, TIFF_EXTRA_SAMPLE_UNSPECIFIED)});
+
+    // Values that don't fit in an entry go right after the IFD
+    uint64_t ifdPosition = position;
+    uint64_t valuesPosition = ifdPosition + 2 + entries.size() * 12 + 4;
+    std::vector<uint64_t> valueOffsets;
+    for (TIFFEntry &entry : entries)
+    {
+        size_t valueSize = entry.values.size() * (entry.type == TIFF_SHORT ? 2 : 4);
+        valueOffsets.push_back(valueSize > 4 ? valuesPosition : 0);
+        if (valueSize > 4)
+            valuesPosition += valueSize;
+    }
+
+    if (valuesPosition > UINT32_MAX)
+        throw tooLarge();
+
+    // IFD
+    writeValue<uint16_t>(output, entries.size());
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        TIFFEntry &entry = entries[i];
+        writeValue<uint16_t>(output, entry.tag);
+        writeValue<uint16_t>(output, entry.type);
+        writeValue<uint32_t>(output, entry.values.size());
+
+        if (valueOffsets[i] != 0)
+            writeValue<uint32_t>(output, valueOffsets[i]);
+        else if (entry.type == TIFF_LONG)
+            writeValue<uint32_t>(output, entry.values[0]);
+        else
+            for (int j = 0; j < 2; j++) // Up to 2 SHORTs, left-justified
+                writeValue<uint16_t>(output, j < (int)entry.values.size() ? entry.values[j] : 0);
+    }
+    writeValue<uint32_t>(output, 0); // No next IFD
+
+    // Out-of-line values
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        if (valueOffsets[i] == 0)
+            continue;
+
+        for (uint32_t value : entries[i].values)
+        {
+            if (entries[i].type == TIFF_LONG)
+                writeValue<uint32_t>(output, value);
+            else
+                writeValue<uint16_t>(output, value);
+        }
+    }
+
+    // Now we know where the IFD is
+    output.seekp(4);
+    writeValue<uint32_t>(output, ifdPosition);
+
+    if (!output)
+        throw std::runtime_error("Failed writing " + path);
+}
@@ -0,0 +1,14 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include "png_writer.h"
+#include "thread_pool.h"
+
+// Side of the square TIFF tiles
+#define TIFF_TILE_SIZE 256
+
+// Write a planar 16-bits image as a tiled, deflate-compressed TIFF. Every tile is compressed on its own
+// on the thread pool, so readers get random access to any of them. 3 samples are stored as RGB, anything
+// else as grayscale with extra samples. Orientation is applied while cutting tiles
+void saveTIFF(const std::string &path, const uint16_t *data, int width, int height, int samples, ThreadPool &pool,
+              Orientation orientation = ORIENTATION_NORMAL);
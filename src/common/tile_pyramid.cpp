@@ -0,0 +1,194 @@
+#include "tile_pyramid.h"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <stdexcept>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#include "parallel.h"
+
+#if defined(__SSE2__)
+// 2x2 box averages of 8 pixels from 2 rows, as 4 32-bits values
+inline __m128i boxAverage4(const uint16_t *row0, const uint16_t *row1)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i top = _mm_loadu_si128((const __m128i *)row0);
+    __m128i bottom = _mm_loadu_si128((const __m128i *)row1);
+
+    // Vertical sums, widened
+    __m128i low = _mm_add_epi32(_mm_unpacklo_epi16(top, zero), _mm_unpacklo_epi16(bottom, zero));
+    __m128i high = _mm_add_epi32(_mm_unpackhi_epi16(top, zero), _mm_unpackhi_epi16(bottom, zero));
+
+    // Horizontal pair sums end up in lanes 0 and 2, gather them
+    low = _mm_shuffle_epi32(_mm_add_epi32(low, _mm_srli_epi64(low, 32)), _MM_SHUFFLE(3, 3, 2, 0));
+    high = _mm_shuffle_epi32(_mm_add_epi32(high, _mm_srli_epi64(high, 32)), _MM_SHUFFLE(3, 3, 2, 0));
+    __m128i sums = _mm_unpacklo_epi64(low, high);
+
+    return _mm_srli_epi32(_mm_add_epi32(sums, _mm_set1_epi32(2)), 2);
+}
+#endif
+
+// Halve a plane with a 2x2 box filter, in bands on pool. Odd edges reuse their last row / column
+void downsamplePlane(const uint16_t *input, int width, int height, uint16_t *output, ThreadPool &pool)
+{
+    const int outputWidth = (width + 1) / 2;
+    const int outputHeight = (height + 1) / 2;
+
+    parallelBands(outputHeight, [&](size_t start, size_t end) {
+        for (size_t y = start; y < end; y++)
+        {
+            const uint16_t *row0 = &input[2 * y * width];
+            const uint16_t *row1 = &input[std::min<size_t>(2 * y + 1, height - 1) * width];
+            uint16_t *outputRow = &output[y * outputWidth];
+            int x = 0;
+
+#if defined(__SSE2__)
+            // 16 pixels in, 8 out. SSE2 can only pack to signed 16-bits, so values are biased around it
+            const __m128i bias32 = _mm_set1_epi32(32768);
+            const __m128i bias16 = _mm_set1_epi16((short)0x8000);
+            for (; 2 * x + 16 <= width; x += 8)
+            {
+                __m128i first = _mm_sub_epi32(boxAverage4(&row0[2 * x], &row1[2 * x]), bias32);
+                __m128i second = _mm_sub_epi32(boxAverage4(&row0[2 * x + 8], &row1[2 * x + 8]), bias32);
+                _mm_storeu_si128((__m128i *)&outputRow[x], _mm_xor_si128(_mm_packs_epi32(first, second), bias16));
+            }
+#endif
+
+            for (; x < outputWidth; x++)
+            {
+                int x0 = 2 * x, x1 = std::min(2 * x + 1, width - 1);
+                outputRow[x] = (row0[x0] + row0[x1] + row1[x0] + row1[x1] + 2) >> 2;
+            }
+        }
+    },
+                  pool, std::max(1, (1 << 16) / outputWidth));
+}
+
+// Flip / rotate planes in place, before they get cut into tiles
+void orientPlanes(uint16_t *data, int width, int height, int channels, Orientation orientation)
+{
+    const size_t planeSize = (size_t)width * height;
+    for (int channel = 0; channel < channels; channel++)
+    {
+        uint16_t *plane = &data[channel * planeSize];
+
+        // Reversing both ways is reversing the whole plane
+        if (orientation == ORIENTATION_ROTATE_180)
+            std::reverse(plane, plane + planeSize);
+        else if (orientation == ORIENTATION_FLIP_HORIZONTAL)
+            for (int row = 0; row < height; row++)
+                std::reverse(&plane[(size_t)row * width], &plane[(size_t)(row + 1) * width]);
+        else if (orientation == ORIENTATION_FLIP_VERTICAL)
+            for (int row = 0; row < height / 2; row++)
+                std::swap_ranges(&plane[(size_t)row * width], &plane[(size_t)(row + 1) * width], &plane[(size_t)(height - row - 1) * width]);
+    }
+}
+
+// Cut a tile out of a level and write it
+void writeTile(const std::string &path, const uint16_t *planes, int width, int height, int channels, int tileX, int tileY, TileFormat format)
+{
+    const int tileWidth = std::min(PYRAMID_TILE_SIZE, width - tileX * PYRAMID_TILE_SIZE);
+    const int tileHeight = std::min(PYRAMID_TILE_SIZE, height - tileY * PYRAMID_TILE_SIZE);
+
+    // Tiles are planar too, edge ones being cropped
+    std::vector<uint16_t> tile((size_t)tileWidth * tileHeight * channels);
+    for (int channel = 0; channel < channels; channel++)
+        for (int y = 0; y < tileHeight; y++)
+        {
+            const uint16_t *source = &planes[((size_t)channel * height + tileY * PYRAMID_TILE_SIZE + y) * width + tileX * PYRAMID_TILE_SIZE];
+            std::copy_n(source, tileWidth, &tile[((size_t)channel * tileHeight + y) * tileWidth]);
+        }
+
+    if (format == TILE_PNG)
+    {
+        savePNG(path, tile.data(), tileWidth, tileHeight, channels);
+    }
+    else
+    {
+        std::ofstream output(path, std::ios::binary);
+        output.write((const char *)tile.data(), tile.size() * sizeof(uint16_t));
+        if (!output)
+            throw std::runtime_error("Failed writing " + path);
+    }
+}
+
+// Write a power-of-two tile pyramid to directory/{z}/{x}/{y}, plus a JSON manifest. The deepest level is full resolution,
+// and level 0 fits in a single tile. Each level is box-filtered from the one above, and its tiles encoded in parallel.
+// planes holds channels planar planes of width * height samples, and gets consumed
+void writeTilePyramid(const std::string &directory, std::vector<uint16_t> &&planes, int width, int height, const std::vector<int> &channels,
+                      TileFormat format, const std::string &satellite, ThreadPool &pool)
+{
+    const int channelCount = channels.size();
+    const std::string extension = format == TILE_PNG ? ".png" : ".raw";
+
+    // Halve until everything fits in a tile
+    int maxZoom = 0;
+    while ((std::max(width, height) - 1) >> maxZoom >= PYRAMID_TILE_SIZE)
+        maxZoom++;
+
+    std::vector<int> levelWidths(maxZoom + 1), levelHeights(maxZoom + 1);
+    std::vector<uint16_t> level = std::move(planes);
+    for (int zoom = maxZoom; zoom >= 0; zoom--)
+    {
+        levelWidths[zoom] = width;
+        levelHeights[zoom] = height;
+
+        // Encode all tiles of this level in parallel
+        const int columns = (width + PYRAMID_TILE_SIZE - 1) / PYRAMID_TILE_SIZE;
+        const int rows = (height + PYRAMID_TILE_SIZE - 1) / PYRAMID_TILE_SIZE;
+        std::vector<std::future<void>> results;
+        for (int tileX = 0; tileX < columns; tileX++)
+        {
+            std::string tileDirectory = directory + "/" + std::to_string(zoom) + "/" + std::to_string(tileX);
+            std::filesystem::create_directories(tileDirectory);
+
+            for (int tileY = 0; tileY < rows; tileY++)
+                results.push_back(pool.submit([&, tileDirectory, tileX, tileY, width, height] {
+                    writeTile(tileDirectory + "/" + std::to_string(tileY) + extension, level.data(), width, height, channelCount, tileX, tileY, format);
+                }));
+        }
+
+        // Next level can start once every tile is out, then replaces this one
+        std::vector<uint16_t> nextLevel;
+        if (zoom > 0)
+        {
+            int nextWidth = (width + 1) / 2, nextHeight = (height + 1) / 2;
+            nextLevel.resize((size_t)nextWidth * nextHeight * channelCount);
+            for (int channel = 0; channel < channelCount; channel++)
+                downsamplePlane(&level[(size_t)channel * width * height], width, height, &nextLevel[(size_t)channel * nextWidth * nextHeight], pool);
+            width = nextWidth;
+            height = nextHeight;
+        }
+
+        // Tasks use this level, let them all finish before reporting errors
+        for (std::future<void> &result : results)
+            pool.wait(result);
+        for (std::future<void> &result : results)
+            result.get();
+        level = std::move(nextLevel);
+    }
+
+    // Manifest for viewers
+    std::ofstream manifest(directory + "/manifest.json");
+    manifest << "{\n";
+    manifest << "    \"satellite\": \"" << satellite << "\",\n";
+    manifest << "    \"width\": " << levelWidths[maxZoom] << ",\n";
+    manifest << "    \"height\": " << levelHeights[maxZoom] << ",\n";
+    manifest << "    \"tile_size\": " << PYRAMID_TILE_SIZE << ",\n";
+    manifest << "    \"format\": \"" << (format == TILE_PNG ? "png" : "raw") << "\",\n";
+    manifest << "    \"sample_type\": \"uint16\",\n";
+    manifest << "    \"channels\": [";
+    for (int i = 0; i < channelCount; i++)
+        manifest << (i > 0 ? ", " : "") << channels[i];
+    manifest << "],\n";
+    manifest << "    \"min_zoom\": 0,\n";
+    manifest << "    \"max_zoom\": " << maxZoom << ",\n";
+    manifest << "    \"path\": \"{z}/{x}/{y}" << extension << "\",\n";
+    manifest << "    \"levels\": [\n";
+    for (int zoom = 0; zoom <= maxZoom; zoom++)
+        manifest << "        {\"zoom\": " << zoom << ", \"width\": " << levelWidths[zoom] << ", \"height\": " << levelHeights[zoom] << "}" << (zoom < maxZoom ? "," : "") << "\n";
+    manifest << "    ]\n";
+    manifest << "}\n";
+}
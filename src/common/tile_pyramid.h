@@ -0,0 +1,28 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "png_writer.h"
+#include "thread_pool.h"
+
+// Side of the square pyramid tiles
+#define PYRAMID_TILE_SIZE 256
+
+// How tiles are stored
+enum TileFormat
+{
+    TILE_PNG, // 16-bits grayscale or RGB PNG
+    TILE_RAW, // Planar 16-bits samples, native byte order
+};
+
+// Halve a plane with a 2x2 box filter, in bands on pool. Odd edges reuse their last row / column
+void downsamplePlane(const uint16_t *input, int width, int height, uint16_t *output, ThreadPool &pool);
+
+// Flip / rotate planes in place, before they get cut into tiles
+void orientPlanes(uint16_t *data, int width, int height, int channels, Orientation orientation);
+
+// Write a power-of-two tile pyramid to directory/{z}/{x}/{y}, plus a JSON manifest. The deepest level is full resolution,
+// and level 0 fits in a single tile. Each level is box-filtered from the one above, and its tiles encoded in parallel.
+// planes holds channels planar planes of width * height samples, and gets consumed
+void writeTilePyramid(const std::string &directory, std::vector<uint16_t> &&planes, int width, int height, const std::vector<int> &channels,
+                      TileFormat format, const std::string &satellite, ThreadPool &pool);
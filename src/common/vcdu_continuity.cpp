@@ -0,0 +1,52 @@
+#include "vcdu_continuity.h"
+
+// Check a new VCDU's counter against the last one on its VCID
+VCDUContinuity VCDUContinuityTracker::push(int vcid, uint32_t counter)
+{
+    std::map<int, uint32_t>::iterator last = last_counters.find(vcid);
+
+    // First VCDU on this channel, nothing to compare to
+    if (last == last_counters.end())
+    {
+        last_counters[vcid] = counter;
+        return VCDU_CONTINUOUS;
+    }
+
+    if (counter == last->second)
+    {
+        duplicates[vcid]++;
+        return VCDU_DUPLICATE;
+    }
+
+    uint32_t expected = (last->second + 1) % VCDU_COUNTER_MODULO;
+    last->second = counter;
+
+    if (counter == expected)
+        return VCDU_CONTINUOUS;
+
+    // Counters wrap around, so does the gap length
+    uint32_t length = (counter + VCDU_COUNTER_MODULO - expected) % VCDU_COUNTER_MODULO;
+    gaps[vcid].push_back({expected, length});
+    return VCDU_GAP;
+}
+
+// Return the gap index of a VCID
+std::vector<VCDUGap> &VCDUContinuityTracker::getGaps(int vcid)
+{
+    return gaps[vcid];
+}
+
+// Return the total VCDU count lost on a VCID
+long VCDUContinuityTracker::getLostCount(int vcid)
+{
+    long lost = 0;
+    for (VCDUGap &gap : gaps[vcid])
+        lost += gap.length;
+    return lost;
+}
+
+// Return the duplicate VCDU count on a VCID
+int VCDUContinuityTracker::getDuplicateCount(int vcid)
+{
+    return duplicates[vcid];
+}
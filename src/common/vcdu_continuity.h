@@ -0,0 +1,46 @@
+#pragma once
+#include <cstdint>
+#include <map>
+#include <vector>
+
+// VCDU virtual channel frame counters are 24-bits
+#define VCDU_COUNTER_MODULO (1 << 24)
+
+// A run of missing VCDUs on a virtual channel
+struct VCDUGap
+{
+    // First missing counter value
+    uint32_t start;
+    // Number of missing VCDUs
+    uint32_t length;
+};
+
+// What a new VCDU means for its virtual channel
+enum VCDUContinuity
+{
+    VCDU_CONTINUOUS, // Counter follows the previous one (or first VCDU on this channel)
+    VCDU_GAP,        // Some VCDUs were lost before this one
+    VCDU_DUPLICATE,  // Same counter as the previous one
+};
+
+// Per-VCID frame counter tracking, building a gap index for the pass
+class VCDUContinuityTracker
+{
+private:
+    // Last counter seen on each VCID
+    std::map<int, uint32_t> last_counters;
+    // Gap index of each VCID
+    std::map<int, std::vector<VCDUGap>> gaps;
+    // Duplicate count of each VCID
+    std::map<int, int> duplicates;
+
+public:
+    // Check a new VCDU's counter against the last one on its VCID
+    VCDUContinuity push(int vcid, uint32_t counter);
+    // Return the gap index of a VCID
+    std::vector<VCDUGap> &getGaps(int vcid);
+    // Return the total VCDU count lost on a VCID
+    long getLostCount(int vcid);
+    // Return the duplicate VCDU count on a VCID
+    int getDuplicateCount(int vcid);
+};
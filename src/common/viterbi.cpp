@@ -0,0 +1,293 @@
+#include "viterbi.h"
+#include <cstring>
+#include <algorithm>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Renormalize metrics every so many steps. Max branch metric is 510, so the spread stays well below 32767
+const int VITERBI_NORM_INTERVAL = 16;
+// Largest branch metric, two symbols at 255
+const int VITERBI_MAX_BRANCH = 510;
+
+// Returns the parity of an integer
+inline int parity(int x)
+{
+    x ^= x >> 4;
+    x ^= x >> 2;
+    x ^= x >> 1;
+    return x & 1;
+}
+
+// Negate a soft symbol without overflowing
+inline int8_t negateSymbol(int8_t symbol)
+{
+    return symbol == -128 ? 127 : -symbol;
+}
+
+// Apply a phase ambiguity transform to a symbol pair
+inline void transformSymbols(ViterbiPhase phase, int8_t &a, int8_t &b)
+{
+    int8_t ta = a, tb = b;
+    switch (phase)
+    {
+    case VITERBI_PHASE_0:
+        break;
+    case VITERBI_PHASE_90:
+        a = tb;
+        b = negateSymbol(ta);
+        break;
+    case VITERBI_PHASE_CONJ:
+        b = negateSymbol(tb);
+        break;
+    case VITERBI_PHASE_SWAP:
+        a = tb;
+        b = ta;
+        break;
+    }
+}
+
+// Constructor
+ViterbiDecoder::ViterbiDecoder(ViterbiPhase phase, bool skipSymbol) : phase{phase}, skip_symbol{skipSymbol}, has_pending{false}, pending_symbol{0}, steps_since_norm{0}
+{
+    // Unknown start state, all equally likely
+    std::memset(metrics, 0, sizeof(metrics));
+
+    // Butterfly i goes from states 2i / 2i+1 to i / i+32. All 4 branches share the same
+    // expected symbols (or their complement), those of the register value 2i
+    for (int i = 0; i < VITERBI_STATES / 2; i++)
+    {
+        branch_mask_a[i] = parity((2 * i) & VITERBI_POLY_A) ? 255 : 0;
+        branch_mask_b[i] = parity((2 * i) & VITERBI_POLY_B) ? 255 : 0;
+    }
+
+    decisions.reserve(VITERBI_CHUNK_SIZE + VITERBI_TRACEBACK_DEPTH);
+}
+
+// One add-compare-select step, with already transformed symbols
+void ViterbiDecoder::addCompareSelect(int8_t symbolA, int8_t symbolB)
+{
+    uint64_t decision = 0;
+
+#if defined(__SSE2__)
+    // 64 states as 8 vectors of 8 16-bits metrics, 32 butterflies as 4 vectors
+    const __m128i costA = _mm_set1_epi16(symbolA + 128);
+    const __m128i costB = _mm_set1_epi16(symbolB + 128);
+    const __m128i maxBranch = _mm_set1_epi16(VITERBI_MAX_BRANCH);
+    __m128i *metricsVec = (__m128i *)metrics;
+    __m128i newLow[4], newHigh[4], decisionLow[4], decisionHigh[4];
+
+    for (int i = 0; i < 4; i++)
+    {
+        __m128i first = _mm_load_si128(&metricsVec[2 * i]);
+        __m128i second = _mm_load_si128(&metricsVec[2 * i + 1]);
+
+        // Split even and odd states. Metrics are always positive so the saturating pack is safe
+        __m128i even = _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(first, 16), 16), _mm_srai_epi32(_mm_slli_epi32(second, 16), 16));
+        __m128i odd = _mm_packs_epi32(_mm_srai_epi32(first, 16), _mm_srai_epi32(second, 16));
+
+        // Branch metric is the distance to the expected symbols, flipping the soft value when a 1 is expected
+        __m128i branch = _mm_add_epi16(_mm_xor_si128(costA, _mm_load_si128((__m128i *)&branch_mask_a[i * 8])),
+                                       _mm_xor_si128(costB, _mm_load_si128((__m128i *)&branch_mask_b[i * 8])));
+        __m128i branchComp = _mm_sub_epi16(maxBranch, branch);
+
+        // Input bit 0, states 0-31
+        __m128i fromEven = _mm_add_epi16(even, branch);
+        __m128i fromOdd = _mm_add_epi16(odd, branchComp);
+        newLow[i] = _mm_min_epi16(fromEven, fromOdd);
+        decisionLow[i] = _mm_cmpgt_epi16(fromEven, fromOdd);
+
+        // Input bit 1, states 32-63
+        fromEven = _mm_add_epi16(even, branchComp);
+        fromOdd = _mm_add_epi16(odd, branch);
+        newHigh[i] = _mm_min_epi16(fromEven, fromOdd);
+        decisionHigh[i] = _mm_cmpgt_epi16(fromEven, fromOdd);
+    }
+
+    for (int i = 0; i < 4; i++)
+    {
+        _mm_store_si128(&metricsVec[i], newLow[i]);
+        _mm_store_si128(&metricsVec[i + 4], newHigh[i]);
+    }
+
+    // Pack decisions, one bit per state
+    uint64_t low = (uint16_t)_mm_movemask_epi8(_mm_packs_epi16(decisionLow[0], decisionLow[1])) |
+                   (uint32_t)_mm_movemask_epi8(_mm_packs_epi16(decisionLow[2], decisionLow[3])) << 16;
+    uint64_t high = (uint16_t)_mm_movemask_epi8(_mm_packs_epi16(decisionHigh[0], decisionHigh[1])) |
+                    (uint32_t)_mm_movemask_epi8(_mm_packs_epi16(decisionHigh[2], decisionHigh[3])) << 16;
+    decision = low | high << 32;
+#else
+    const int costA = symbolA + 128;
+    const int costB = symbolB + 128;
+    int16_t newMetrics[VITERBI_STATES];
+
+    for (int i = 0; i < VITERBI_STATES / 2; i++)
+    {
+        int16_t branch = (costA ^ branch_mask_a[i]) + (costB ^ branch_mask_b[i]);
+        int16_t branchComp = VITERBI_MAX_BRANCH - branch;
+
+        // Input bit 0, states 0-31
+        int16_t fromEven = metrics[2 * i] + branch;
+        int16_t fromOdd = metrics[2 * i + 1] + branchComp;
+        newMetrics[i] = std::min(fromEven, fromOdd);
+        decision |= (uint64_t)(fromEven > fromOdd) << i;
+
+        // Input bit 1, states 32-63
+        fromEven = metrics[2 * i] + branchComp;
+        fromOdd = metrics[2 * i + 1] + branch;
+        newMetrics[i + 32] = std::min(fromEven, fromOdd);
+        decision |= (uint64_t)(fromEven > fromOdd) << (i + 32);
+    }
+
+    std::memcpy(metrics, newMetrics, sizeof(metrics));
+#endif
+
+    decisions.push_back(decision);
+
+    if (++steps_since_norm == VITERBI_NORM_INTERVAL)
+        renormalize();
+}
+
+void ViterbiDecoder::renormalize()
+{
+    int16_t minimum = *std::min_element(metrics, metrics + VITERBI_STATES);
+    for (int i = 0; i < VITERBI_STATES; i++)
+        metrics[i] -= minimum;
+    steps_since_norm = 0;
+}
+
+// Walk back through decisions, outputting the oldest outputCount bits
+void ViterbiDecoder::traceback(size_t outputCount, std::vector<uint8_t> &output)
+{
+    // Start from the best state
+    int state = std::min_element(metrics, metrics + VITERBI_STATES) - metrics;
+
+    // Walk back through the part we won't output
+    long step = decisions.size() - 1;
+    for (; step >= (long)outputCount; step--)
+        state = ((state << 1) & (VITERBI_STATES - 1)) | ((decisions[step] >> state) & 1);
+
+    // Now output the bits, in reverse
+    size_t outputStart = output.size();
+    output.resize(outputStart + outputCount);
+    for (; step >= 0; step--)
+    {
+        output[outputStart + step] = state >> (VITERBI_K - 2);
+        state = ((state << 1) & (VITERBI_STATES - 1)) | ((decisions[step] >> state) & 1);
+    }
+
+    decisions.erase(decisions.begin(), decisions.begin() + outputCount);
+}
+
+// Decode soft symbols, appending decoded bits to output
+void ViterbiDecoder::work(const int8_t *symbols, size_t count, std::vector<uint8_t> &output)
+{
+    size_t pos = 0;
+
+    // Drop a symbol to get in alignment if required
+    if (skip_symbol && count > 0)
+    {
+        skip_symbol = false;
+        pos++;
+    }
+
+    while (pos < count)
+    {
+        int8_t symbolA, symbolB;
+
+        // Complete a symbol pair started in the previous call
+        if (has_pending)
+        {
+            symbolA = pending_symbol;
+            symbolB = symbols[pos++];
+            has_pending = false;
+        }
+        else if (pos + 1 < count)
+        {
+            symbolA = symbols[pos];
+            symbolB = symbols[pos + 1];
+            pos += 2;
+        }
+        else
+        {
+            pending_symbol = symbols[pos++];
+            has_pending = true;
+            break;
+        }
+
+        transformSymbols(phase, symbolA, symbolB);
+        addCompareSelect(symbolA, symbolB);
+
+        if (decisions.size() == VITERBI_CHUNK_SIZE + VITERBI_TRACEBACK_DEPTH)
+            traceback(VITERBI_CHUNK_SIZE, output);
+    }
+}
+
+// Output all bits still held in the traceback buffer
+void ViterbiDecoder::flush(std::vector<uint8_t> &output)
+{
+    traceback(decisions.size(), output);
+}
+
+// Decode a few symbols with the given phase and alignment, and return the BER of the input against them re-encoded
+float ViterbiDecoder::measureBER(ViterbiPhase phase, bool skipSymbol, const int8_t *symbols, size_t count)
+{
+    ViterbiDecoder testDecoder(phase, skipSymbol);
+    std::vector<uint8_t> bits;
+    testDecoder.work(symbols, count, bits);
+    testDecoder.flush(bits);
+
+    // Re-encode, and compare with the hard-decided input symbols
+    int errors = 0, total = 0, state = 0;
+    for (size_t i = 0; i < bits.size(); i++)
+    {
+        int reg = bits[i] << (VITERBI_K - 1) | state;
+        state = reg >> 1;
+
+        // Wait for the encoder to be filled up
+        if (i < VITERBI_K - 1)
+            continue;
+
+        int8_t symbolA = symbols[skipSymbol + i * 2];
+        int8_t symbolB = symbols[skipSymbol + i * 2 + 1];
+        transformSymbols(phase, symbolA, symbolB);
+
+        errors += (symbolA >= 0) != parity(reg & VITERBI_POLY_A);
+        errors += (symbolB >= 0) != parity(reg & VITERBI_POLY_B);
+        total += 2;
+    }
+
+    return total > 0 ? (float)errors / total : 1.0f;
+}
+
+// Try all phase ambiguities and symbol alignments on a few symbols and keep the best one. Returns its BER
+float ViterbiDecoder::resolveAmbiguity(const int8_t *symbols, size_t count)
+{
+    float bestBER = 1.0f;
+
+    for (int testPhase = VITERBI_PHASE_0; testPhase <= VITERBI_PHASE_SWAP; testPhase++)
+    {
+        for (int testSkip = 0; testSkip < 2; testSkip++)
+        {
+            float ber = measureBER((ViterbiPhase)testPhase, testSkip, symbols, count);
+            if (ber < bestBER)
+            {
+                bestBER = ber;
+                phase = (ViterbiPhase)testPhase;
+                skip_symbol = testSkip;
+            }
+        }
+    }
+
+    return bestBER;
+}
+
+ViterbiPhase ViterbiDecoder::getPhase()
+{
+    return phase;
+}
+
+bool ViterbiDecoder::getSkipSymbol()
+{
+    return skip_symbol;
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// Constraint length and state count
+#define VITERBI_K 7
+#define VITERBI_STATES 64
+// CCSDS polynomials (171 / 133 octal), the current input bit being the MSB
+#define VITERBI_POLY_A 0x79
+#define VITERBI_POLY_B 0x5B
+// Decoded bits output per traceback, and traceback depth
+#define VITERBI_CHUNK_SIZE 16384
+#define VITERBI_TRACEBACK_DEPTH 96
+
+// Symbol transforms covering the QPSK phase / IQ ambiguities.
+// 180° rotations only invert the output and are left to the frame sync
+enum ViterbiPhase
+{
+    VITERBI_PHASE_0,       // (a, b)
+    VITERBI_PHASE_90,      // (b, -a)
+    VITERBI_PHASE_CONJ,    // (a, -b), eg, inverted G2
+    VITERBI_PHASE_SWAP,    // (b, a)
+};
+
+// Soft-decision Viterbi decoder for the CCSDS k=7, r=1/2 convolutional code
+// Takes signed 8-bit soft symbols (positive meaning 1), and outputs one decoded bit per byte
+class ViterbiDecoder
+{
+private:
+    // Path metrics, kept small and renormalized every few steps
+    alignas(16) int16_t metrics[VITERBI_STATES];
+    // Expected symbol masks (0 or 255) for each butterfly
+    alignas(16) int16_t branch_mask_a[VITERBI_STATES / 2];
+    alignas(16) int16_t branch_mask_b[VITERBI_STATES / 2];
+    // One 64-bit decision word per decoded bit
+    std::vector<uint64_t> decisions;
+    // Ambiguity settings
+    ViterbiPhase phase;
+    bool skip_symbol;
+    // Odd symbol left over from the previous work() call
+    bool has_pending;
+    int8_t pending_symbol;
+    // Steps since the last renormalization
+    int steps_since_norm;
+
+    // One add-compare-select step, with already transformed symbols
+    void addCompareSelect(int8_t symbolA, int8_t symbolB);
+    void renormalize();
+    // Walk back through decisions, outputting the oldest outputCount bits
+    void traceback(size_t outputCount, std::vector<uint8_t> &output);
+
+public:
+    // Constructor
+    ViterbiDecoder(ViterbiPhase phase = VITERBI_PHASE_0, bool skipSymbol = false);
+    // Decode a few symbols with the given phase and alignment, and return the BER of the input against them re-encoded
+    static float measureBER(ViterbiPhase phase, bool skipSymbol, const int8_t *symbols, size_t count);
+    // Try all phase ambiguities and symbol alignments on a few symbols and keep the best one. Returns its BER
+    float resolveAmbiguity(const int8_t *symbols, size_t count);
+    // Decode soft symbols, appending decoded bits to output
+    void work(const int8_t *symbols, size_t count, std::vector<uint8_t> &output);
+    // Output all bits still held in the traceback buffer
+    void flush(std::vector<uint8_t> &output);
+    ViterbiPhase getPhase();
+    bool getSkipSymbol();
+};
@@ -1,22 +1,28 @@
 #include <iostream>
 #include <fstream>
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+#include <sstream>
 #include "tclap/CmdLine.h"
-#define cimg_use_png
-#define cimg_display 0
-#include "CImg.h"
 
 #include "noaa/noaa.h"
 #include "meteor/meteor.h"
 #include "metop/metop.h"
+#include "common/products.h"
+#include "common/geolocation.h"
+#include "common/reprojection.h"
 
 int main(int argc, char *argv[])
 {
     TCLAP::CmdLine cmd("HRPT Decoder by Aang23", ' ', "1.0");
 
-    // Channel or mode selection
-    TCLAP::ValueArg<int> valueChannel("c", "channel", "Channel to extract", true, 0, "channel");
+    // Products to output, -c / -f / -d being shorthands for chN / rgb / dump
+    TCLAP::MultiArg<std::string> valueProducts("", "product", "Product to output : chN, rgb, rgbXYZ or dump. Can be repeated", false, "product");
+    TCLAP::ValueArg<int> valueChannel("c", "channel", "Channel to extract", false, 0, "channel");
     TCLAP::SwitchArg optionFalseColor("f", "falsecolor", "Produce false-color image");
     TCLAP::SwitchArg optionDumpChannels("d", "dump", "Dump all channels in grayscale");
+    TCLAP::MultiArg<std::string> valueComposites("", "composite", "Band maths composite, eg. \"r=ch2;g=ch2;b=(ch4-ch5)*3\" or a single expression for grayscale. Can be repeated", false, "definition");
 
     // IO arguments
     TCLAP::ValueArg<std::string> valueInput("i", "input", "Raw input file", true, "", "file");
@@ -34,20 +40,94 @@ int main(int argc, char *argv[])
     // Pass direction
     TCLAP::SwitchArg optionSouthbound("S", "southbound", "Southbound pass (defaults to Northbound)");
 
+    // Input format
+    TCLAP::SwitchArg optionSoftSymbols("", "soft", "Input is 8-bit soft symbols, Viterbi decoded internally (MetOp only)");
+
+    // Radiometric calibration
+    TCLAP::SwitchArg optionCalibrate("", "calibrate", "Output albedo (0.01 %) and brightness temperature (0.01 K) rather than counts (NOAA only)");
+    std::vector<std::string> spacecrafts;
+    spacecrafts.push_back("NOAA-15");
+    spacecrafts.push_back("NOAA-19");
+    TCLAP::ValuesConstraint<std::string> spacecraftsAllowed(spacecrafts);
+    TCLAP::ValueArg<std::string> valueSpacecraft("", "spacecraft", "Spacecraft whose calibration coefficients to use", false, "NOAA-19", &spacecraftsAllowed);
+
+    // Geolocation
+    TCLAP::ValueArg<std::string> valueTLE("", "tle", "TLE file, to write latitude / longitude planes next to the products", false, "", "file");
+    TCLAP::ValueArg<std::string> valueTLEName("", "tle-name", "Satellite to pick from the TLE file (defaults to the first one)", false, "", "name");
+    TCLAP::ValueArg<double> valueStartTime("", "start-time", "UNIX timestamp of the first line, for passes without timecodes (METEOR)", false, 0, "timestamp");
+
+    // Reprojection
+    std::vector<std::string> projections;
+    projections.push_back("equirectangular");
+    projections.push_back("polar");
+    TCLAP::ValuesConstraint<std::string> projectionsAllowed(projections);
+    TCLAP::ValueArg<std::string> valueProjection("", "projection", "Reproject products to a map grid, needs --tle", false, "equirectangular", &projectionsAllowed);
+    TCLAP::ValueArg<double> valueResolution("", "resolution", "Map resolution in km per pixel, at the equator or the pole", false, 1.0, "km");
+    std::vector<std::string> resamplings;
+    resamplings.push_back("nearest");
+    resamplings.push_back("bilinear");
+    TCLAP::ValuesConstraint<std::string> resamplingsAllowed(resamplings);
+    TCLAP::ValueArg<std::string> valueResampling("", "resampling", "Map resampling", false, "bilinear", &resamplingsAllowed);
+
+    // Mosaicking
+    TCLAP::ValueArg<std::string> valueMosaic("", "mosaic", "Merge the pass into a mosaic file (created if needed) and output the whole mosaic, needs --tle", false, "", "file");
+    std::vector<std::string> merges;
+    merges.push_back("newest");
+    merges.push_back("sun");
+    merges.push_back("ndvi");
+    TCLAP::ValuesConstraint<std::string> mergesAllowed(merges);
+    TCLAP::ValueArg<std::string> valueMerge("", "merge", "Which pass mosaic pixels come from : the newest, the one with the highest Sun, or the greenest", false, "newest", &mergesAllowed);
+
+    // Output format
+    std::vector<std::string> formats;
+    formats.push_back("png");
+    formats.push_back("raw");
+    formats.push_back("npy");
+    formats.push_back("envi");
+    formats.push_back("tiff");
+    formats.push_back("tiles");
+    formats.push_back("rawtiles");
+    TCLAP::ValuesConstraint<std::string> formatsAllowed(formats);
+    TCLAP::ValueArg<std::string> valueFormat("", "format", "Output format. raw, npy and envi hold unscaled planes, tiff is tiled, tiles and rawtiles write a tile pyramid to the output directory", false, "png", &formatsAllowed);
+
     // Other arguments
     TCLAP::ValueArg<int> valueEqualize("e", "equalization", "Equalization to apply", false, 200, "equalization");
+    TCLAP::ValueArg<std::string> valueStretch("", "stretch", "Linear contrast stretch between two percentiles, replacing equalization", false, "", "0.5:99.5");
+    TCLAP::ValueArg<double> valueClahe("", "clahe", "Contrast-limited adaptive histogram equalization, replacing equalization. Clip limit relative to the average histogram bin, eg. 3", false, 0, "clip");
+    TCLAP::ValueArg<std::string> valueLines("", "lines", "Only decode lines A (included) to B (excluded) of the pass, B being optional", false, "", "A:B");
+    TCLAP::ValueArg<std::string> valueTime("", "time", "Only decode lines scanned between two UNIX timestamps. METEOR needs --start-time", false, "", "T0:T1");
+    TCLAP::ValueArg<int> valuePreview("", "preview", "Quick look, decoding only every Nth line and keeping every Nth pixel", false, 1, "N");
+    TCLAP::SwitchArg optionStatistics("", "stats", "Write per-channel statistics (min, max, mean, histogram...) of the pass to a JSON file");
 
     // Register all of the above options
     cmd.add(satelliteArg);
     cmd.add(valueInput);
     cmd.add(valueOutput);
-    std::vector<TCLAP::Arg*> outputMode;
-    outputMode.push_back(&valueChannel);
-    outputMode.push_back(&optionFalseColor);
-    outputMode.push_back(&optionDumpChannels);
-    cmd.xorAdd(outputMode);
+    cmd.add(valueProducts);
+    cmd.add(valueChannel);
+    cmd.add(optionFalseColor);
+    cmd.add(optionDumpChannels);
+    cmd.add(valueComposites);
     cmd.add(optionSouthbound);
+    cmd.add(optionSoftSymbols);
+    cmd.add(optionCalibrate);
+    cmd.add(valueSpacecraft);
+    cmd.add(valueTLE);
+    cmd.add(valueTLEName);
+    cmd.add(valueStartTime);
+    cmd.add(valueProjection);
+    cmd.add(valueResolution);
+    cmd.add(valueResampling);
+    cmd.add(valueMosaic);
+    cmd.add(valueMerge);
     cmd.add(valueEqualize);
+    cmd.add(valueStretch);
+    cmd.add(valueClahe);
+    cmd.add(valueFormat);
+    cmd.add(optionStatistics);
+    cmd.add(valuePreview);
+    cmd.add(valueLines);
+    cmd.add(valueTime);
 
     // Parse
     try
@@ -60,9 +140,189 @@ int main(int argc, char *argv[])
         return 0;
     }
 
+    // Everything we have to output
+    std::vector<std::string> products = valueProducts.getValue();
+    if (valueChannel.isSet())
+        products.push_back("ch" + std::to_string(valueChannel.getValue()));
+    if (optionFalseColor.getValue())
+        products.push_back("rgb");
+    if (optionDumpChannels.getValue())
+        products.push_back("dump");
+    for (const std::string &composite : valueComposites.getValue())
+        products.push_back("composite:" + composite);
+
+    if (products.empty())
+    {
+        std::cout << "No product requested! Use -c, -f, -d, --product or --composite" << '\n';
+        return 0;
+    }
+
+    if ((valueProjection.isSet() || valueMosaic.isSet()) && !valueTLE.isSet())
+    {
+        std::cout << "Reprojecting needs a TLE! Use --tle" << '\n';
+        return 0;
+    }
+
+    // Parse a low:high range, high being NAN if left out
+    auto parseRange = [](const std::string &text, double &low, double &high) {
+        char separator = 0;
+        std::istringstream range(text);
+        if (!(range >> low >> separator) || separator != ':')
+            return false;
+        high = NAN;
+        if ((range >> std::ws).eof())
+            return true;
+        return (range >> high) && (range >> std::ws).eof();
+    };
+
+    // Percentiles to stretch between, if any
+    double stretchLow = 0, stretchHigh = 0;
+    if (valueStretch.isSet())
+    {
+        if (!parseRange(valueStretch.getValue(), stretchLow, stretchHigh) || !(stretchLow >= 0 && stretchHigh <= 100 && stretchHigh > stretchLow))
+        {
+            std::cout << "Invalid stretch " << valueStretch.getValue() << ", expected low:high percentiles, eg. 0.5:99.5" << '\n';
+            return 0;
+        }
+    }
+
+    const int preview = valuePreview.getValue();
+    if (preview < 1)
+    {
+        std::cout << "Invalid preview " << preview << ", it must be at least 1" << '\n';
+        return 0;
+    }
+
+    // Part of the pass to decode, every preview-th line of it
+    LineSelection selection = {0, -1, preview, NAN, NAN};
+    if (valueLines.isSet())
+    {
+        double first, last;
+        if (!parseRange(valueLines.getValue(), first, last) || first < 0 || first != std::floor(first) || (!std::isnan(last) && (last <= first || last != std::floor(last))))
+        {
+            std::cout << "Invalid lines " << valueLines.getValue() << ", expected first:last line numbers, eg. 1000:3000" << '\n';
+            return 0;
+        }
+        selection.first = first;
+        selection.last = std::isnan(last) ? -1 : (int)last;
+    }
+    if (valueTime.isSet() && (!parseRange(valueTime.getValue(), selection.startTime, selection.endTime) || selection.endTime <= selection.startTime))
+    {
+        std::cout << "Invalid time " << valueTime.getValue() << ", expected start:end UNIX timestamps" << '\n';
+        return 0;
+    }
+
+    if (valueClahe.isSet() && (valueClahe.getValue() < 1 || valueStretch.isSet()))
+    {
+        std::cout << "Invalid CLAHE clip limit, it must be at least 1 and can't go with --stretch" << '\n';
+        return 0;
+    }
+
+    // Orbit, for geolocation
+    TLE tle;
+    if (valueTLE.isSet())
+    {
+        try
+        {
+            tle = readTLE(valueTLE.getValue(), valueTLEName.getValue());
+        }
+        catch (std::runtime_error &e)
+        {
+            std::cout << e.what() << '\n';
+            return 0;
+        }
+    }
+
     // Variable we need watever we do
     std::ifstream input_file(valueInput.getValue(), std::ios::binary);
-    cimg_library::CImg<unsigned short> final_image;
+    ThreadPool pool;
+    ProductSettings settings = {valueFormat.getValue(), valueEqualize.getValue(), stretchLow, stretchHigh, valueClahe.getValue(), optionSouthbound.getValue() ? ORIENTATION_ROTATE_180 : ORIENTATION_NORMAL, satelliteArg.getValue(), false, false, optionStatistics.getValue()};
+
+    // Locate the pass, if a TLE was given. Previews keep every preview-th pixel of scanWidth ones. Returns nullptr if it can't be
+    auto locate = [&](const LineSource &source, double firstLineTimestamp, double lineDuration, double scanAngle, int scanWidth) -> std::unique_ptr<Geolocation> {
+        if (!valueTLE.isSet())
+            return nullptr;
+        if (std::isnan(firstLineTimestamp))
+        {
+            std::cout << "No line timestamps to geolocate from! Use --start-time" << '\n';
+            return nullptr;
+        }
+
+        std::cout << "Geolocating with " << (tle.name.empty() ? "TLE" : tle.name) << "..." << '\n';
+        try
+        {
+            return std::unique_ptr<Geolocation>(new Geolocation(tle, firstLineTimestamp, lineDuration, source.width, source.rows, scanAngle, scanWidth, preview));
+        }
+        catch (std::runtime_error &e)
+        {
+            std::cout << e.what() << '\n';
+            return nullptr;
+        }
+    };
+
+    // Write the products, either as decoded with latitude / longitude planes next to them, or reprojected to a map grid,
+    // on their own or merged into a mosaic
+    auto writeOutputs = [&](const FalseColorRecipe &recipe, LineSource source, PlaneDecoder decodePlane,
+                            int firstLine, double firstLineTimestamp, double lineDuration, double scanAngle) {
+        // Previews come with every Nth row already, thin columns out too
+        const int scanWidth = source.width;
+        if (preview > 1)
+        {
+            source = decimateColumns(source, preview);
+            decodePlane = [source](int channel, uint16_t *plane, int scale) { readPlane(source, channel, plane, scale); };
+        }
+
+        // The start time given is the pass one, rows begin at the first line the decoder selected
+        if (valueStartTime.isSet())
+            firstLineTimestamp = valueStartTime.getValue() + firstLine * lineDuration / selection.step;
+        std::unique_ptr<Geolocation> geolocation = locate(source, firstLineTimestamp, lineDuration, scanAngle, scanWidth);
+
+        if (!valueProjection.isSet() && !valueMosaic.isSet())
+        {
+            writeProducts(products, recipe, valueOutput.getValue(), source, decodePlane, settings, pool);
+            if (geolocation)
+                writeGeolocation(valueOutput.getValue(), *geolocation, settings);
+            return;
+        }
+
+        if (!geolocation)
+            return;
+
+        std::cout << "Reprojecting..." << '\n';
+        try
+        {
+            MapProjection projection = valueProjection.getValue() == "polar" ? PROJECTION_POLAR_STEREOGRAPHIC : PROJECTION_EQUIRECTANGULAR;
+            Resampling resampling = valueResampling.getValue() == "nearest" ? RESAMPLING_NEAREST : RESAMPLING_BILINEAR;
+            if (!valueMosaic.isSet())
+            {
+                Reprojection reprojection(*geolocation, projection, valueResolution.getValue(), pool);
+                writeReprojectedProducts(products, recipe, valueOutput.getValue(), source, settings, reprojection, resampling, pool);
+                return;
+            }
+
+            // An existing mosaic keeps its own grid
+            MosaicMerge merge = valueMerge.getValue() == "sun" ? MERGE_SUN_ANGLE : (valueMerge.getValue() == "ndvi" ? MERGE_NDVI : MERGE_NEWEST);
+            MosaicSettings mosaicSettings = {projection, true, valueResolution.getValue(), source.channels, source.scale, merge};
+            MapPole pole = POLE_NEAREST;
+            MosaicSettings existing;
+            if (readMosaicSettings(valueMosaic.getValue(), existing))
+            {
+                mosaicSettings.projection = existing.projection;
+                mosaicSettings.resolution = existing.resolution;
+                pole = existing.northPole ? POLE_NORTH : POLE_SOUTH;
+            }
+
+            Reprojection reprojection(*geolocation, mosaicSettings.projection, mosaicSettings.resolution, pool, pole);
+            mosaicSettings.northPole = reprojection.getGrid().northPole;
+            Mosaic mosaic(valueMosaic.getValue(), mosaicSettings);
+            writeMosaicProducts(products, recipe, valueOutput.getValue(), source, settings, reprojection, resampling, mosaic, firstLineTimestamp, lineDuration, pool);
+            std::cout << "Mosaic now holds " << mosaic.getPassCount() << " passes" << '\n';
+        }
+        catch (std::runtime_error &e)
+        {
+            std::cout << e.what() << '\n';
+        }
+    };
 
     if (satelliteArg.getValue() == "NOAA")
     {
@@ -70,40 +330,23 @@ int main(int argc, char *argv[])
         std::cout << "Decoding NOAA!" << '\n';
 
         NOAADecoder decoder(input_file);
-        decoder.processHRPT();
+        decoder.processHRPT(selection);
 
         if(decoder.getTotalFrameCount() <= 0) {
             std::cout << "No frame found! Exiting!" << '\n';
             exit(0);
         }
 
-        final_image = cimg_library::CImg<unsigned short>(2048, decoder.getTotalFrameCount(), 1, 3);
-
-        if (optionFalseColor.getValue())
+        double firstLineTimestamp = valueTLE.isSet() ? decoder.getFirstLineTimestamp(tle.epoch) : NAN;
+        if (optionCalibrate.getValue())
         {
-            cimg_library::CImg<unsigned short> img1 = decoder.decodeChannel(1);
-            cimg_library::CImg<unsigned short> img2 = decoder.decodeChannel(2);
-            cimg_library::CImg<unsigned short> img3 = decoder.decodeChannel(3);
-
-            final_image.draw_image(0, 0, 0, 0, img2);
-            final_image.draw_image(0, 0, 0, 1, img2);
-            final_image.draw_image(0, 0, 0, 2, img1);
-        }
-        else if(optionDumpChannels.getValue())
-        {
-            // NOAA HRPT has 5 channels
-            for(int i = 1; i <= 5; i++)
-            {
-                final_image = decoder.decodeChannel(i);
-                final_image.save_png((valueOutput.getValue() + "-" + std::to_string(i)).c_str());
-            }
-
-            input_file.close();
-            return 0;
+            settings.calibrated = true;
+            LineSource source = decoder.getCalibratedLineSource(getAVHRRCoefficients(valueSpacecraft.getValue()));
+            writeOutputs(NOAA_FALSE_COLOR, source, [&](int channel, uint16_t *plane, int scale) { readPlane(source, channel, plane, scale); }, decoder.getFirstLine(), firstLineTimestamp, decoder.getLineDuration(), AVHRR_SCAN_ANGLE);
         }
         else
         {
-            final_image = decoder.decodeChannel(valueChannel.getValue());
+            writeOutputs(NOAA_FALSE_COLOR, decoder.getLineSource(), [&](int channel, uint16_t *plane, int scale) { decoder.decodeChannelInto(channel, plane, scale); }, decoder.getFirstLine(), firstLineTimestamp, decoder.getLineDuration(), AVHRR_SCAN_ANGLE);
         }
     }
     else if (satelliteArg.getValue() == "METEOR")
@@ -112,42 +355,34 @@ int main(int argc, char *argv[])
         std::cout << "Decoding METEOR! /!\\ METEOR support still unreliable /!\\" << '\n';
 
         METEORDecoder decoder(input_file);
-        decoder.processHRPT();
-
-        if(decoder.getTotalFrameCount() <= 0) {
-            std::cout << "No frame found! Exiting!" << '\n';
-            exit(0);
-        }
-
-        final_image = cimg_library::CImg<unsigned short>(1572, decoder.getTotalFrameCount(), 1, 3);
-
-        if (optionFalseColor.getValue())
-        {
-            cimg_library::CImg<unsigned short> img1 = decoder.decodeChannel(1);
-            cimg_library::CImg<unsigned short> img2 = decoder.decodeChannel(2);
-            cimg_library::CImg<unsigned short> img3 = decoder.decodeChannel(3);
 
-            final_image.draw_image(0, 0, 0, 0, img3);
-            final_image.draw_image(0, 0, 0, 1, img2);
-            final_image.draw_image(0, 0, 0, 2, img1);
-        }
-        else if(optionDumpChannels.getValue())
+        // No timecodes, times are lines from the start time given
+        if (valueTime.isSet())
         {
-            // Meteor HRPT has 6 channels
-            for(int i = 1; i <= 6; i++)
+            if (!valueStartTime.isSet())
             {
-                final_image = decoder.decodeChannel(i);
-                final_image.save_png((valueOutput.getValue() + "-" + std::to_string(i)).c_str());
+                std::cout << "Selecting METEOR times needs the pass start time! Use --start-time" << '\n';
+                return 0;
             }
-
-            input_file.close();
-            return 0;
+            const double lineDuration = decoder.getLineDuration();
+            selection.first = std::max<double>(selection.first, std::ceil((selection.startTime - valueStartTime.getValue()) / lineDuration - 1e-6));
+            if (!std::isnan(selection.endTime))
+            {
+                int last = std::max<double>(0, std::floor((selection.endTime - valueStartTime.getValue()) / lineDuration + 1e-6) + 1);
+                selection.last = selection.last < 0 ? last : std::min(selection.last, last);
+            }
+            selection.startTime = selection.endTime = NAN;
         }
-        else
-        {
-            final_image = decoder.decodeChannel(valueChannel.getValue());
+
+        decoder.processHRPT(selection);
+
+        if(decoder.getTotalFrameCount() <= 0) {
+            std::cout << "No frame found! Exiting!" << '\n';
+            exit(0);
         }
 
+        writeOutputs(METEOR_FALSE_COLOR, decoder.getLineSource(), [&](int channel, uint16_t *plane, int scale) { decoder.decodeChannelInto(channel, plane, scale); }, decoder.getFirstLine(), NAN, decoder.getLineDuration(), MSUMR_SCAN_ANGLE);
+
         decoder.cleanupFiles();
     }
     else if (satelliteArg.getValue() == "MetOp")
@@ -155,52 +390,18 @@ int main(int argc, char *argv[])
         // METEOR Decoding! MN2x
         std::cout << "Decoding MetOp! /!\\ MetOp support still unreliable /!\\" << '\n';
 
-        METOPDecoder decoder(input_file);
-        decoder.processHRPT();
+        METOPDecoder decoder(input_file, optionSoftSymbols.getValue());
+        decoder.processHRPT(selection);
 
         if(decoder.getTotalFrameCount() <= 0) {
             std::cout << "No frame found! Exiting!" << '\n';
             exit(0);
         }
 
-        final_image = cimg_library::CImg<unsigned short>(2048, decoder.getTotalFrameCount(), 1, 3);
-
-        if (optionFalseColor.getValue())
-        {
-            cimg_library::CImg<unsigned short> img1 = decoder.decodeChannel(1);
-            cimg_library::CImg<unsigned short> img2 = decoder.decodeChannel(2);
-            cimg_library::CImg<unsigned short> img3 = decoder.decodeChannel(3);
-
-            final_image.draw_image(0, 0, 0, 0, img2);
-            final_image.draw_image(0, 0, 0, 1, img2);
-            final_image.draw_image(0, 0, 0, 2, img1);
-        }
-        else if(optionDumpChannels.getValue())
-        {
-            // MetOp HRPT has 5 channels
-            for(int i = 1; i <= 5; i++)
-            {
-                final_image = decoder.decodeChannel(i);
-                final_image.save_png((valueOutput.getValue() + "-" + std::to_string(i)).c_str());
-            }
-
-            input_file.close();
-            return 0;
-        }
-        else
-        {
-            final_image = decoder.decodeChannel(valueChannel.getValue());
-        }
+        writeOutputs(METOP_FALSE_COLOR, decoder.getLineSource(), [&](int channel, uint16_t *plane, int scale) { decoder.decodeChannelInto(channel, plane, scale); }, decoder.getFirstLine(), decoder.getFirstLineTimestamp(), decoder.getLineDuration(), AVHRR_SCAN_ANGLE);
 
         decoder.cleanupFiles();
     }
 
-    // Equalize and rotate if necessary
-    final_image.equalize(valueEqualize.getValue());
-    if (optionSouthbound.getValue())
-        final_image.rotate(180);
-
-    // Save our final image
-    final_image.save_png(valueOutput.getValue().c_str());
     input_file.close();
 }
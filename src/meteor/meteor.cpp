@@ -1,13 +1,12 @@
 #include "meteor.h"
 #include "manchester.h"
 #include <iostream>
+#include <algorithm>
 #include <cstdio>
+#include "common/cadu_framer.h"
+#include "common/hrpt.h"
 
 // Definitely still needs tuning
-#define TRANSPORT_THRESOLD_STATE_3 12
-#define TRANSPORT_THRESOLD_STATE_2 6
-#define TRANSPORT_THRESOLD_STATE_1 2
-#define TRANSPORT_THRESOLD_STATE_0 0
 #define MSU_MR_THRESOLD 13
 
 // Total world count
@@ -16,11 +15,22 @@ const int HRPT_TRANSPORT_SIZE = 1024;
 const int HRPT_NUM_CHANNELS = 6;
 // Single image scan word size
 const int HRPT_SCAN_WIDTH = 1572;
+// Time between two MSU-MR lines, 6 lines per second
+const double HRPT_LINE_DURATION = 1.0 / 6.0;
+// MSU-MR line size, and MSU-MR bytes each transport frame carries
+const int MSUMR_LINE_SIZE = 11850;
+const int MSUMR_BYTES_PER_FRAME = 948;
+// Transport frames Manchester decoded to find a first line, and around each of the next ones selected
+const int SELECTION_LOCK_FRAMES = 64;
+const int SELECTION_WINDOW_FRAMES = 17;
 // Sync marker word size
 const int HRPT_SYNC_SIZE = 4;
 // Sync marker
 static const uint8_t HRPT_SYNC[HRPT_SYNC_SIZE] = {0x1A, 0xCF, 0xFC, 0x1D};
 static const uint32_t HRPT_SYNC_BITS = HRPT_SYNC[0] << 24 | HRPT_SYNC[1] << 16 | HRPT_SYNC[2] << 8 | HRPT_SYNC[3];
+
+// METEOR transport frames, neither inverted nor randomized
+typedef CaduFramer<HRPT_SYNC_BITS, HRPT_TRANSPORT_SIZE, false, false> METEORFramer;
 // MSU-MR Sync marker
 const int HRPT_SYNC_SIZE_MSU_MR = 8;
 static const uint8_t HRPT_SYNC_MSU_MR[HRPT_SYNC_SIZE_MSU_MR] = {2, 24, 167, 163, 146, 221, 154, 191};
@@ -49,21 +59,6 @@ void bin(uint64_t n)
 }
 */
 
-// Compare 2 32-bits values bit per bit
-int checkSyncMarker(uint32_t marker, uint32_t totest)
-{
-    int errors = 0;
-    for (int i = 31; i >= 0; i--)
-    {
-        bool markerBit, testBit;
-        markerBit = getBit<uint32_t>(marker, i);
-        testBit = getBit<uint32_t>(totest, i);
-        if (markerBit != testBit)
-            errors++;
-    }
-    return errors;
-}
-
 // Compare 2 64-bits values bit per bit
 int checkMSUSyncMarker(uint64_t marker, uint64_t totest)
 {
@@ -79,23 +74,37 @@ int checkMSUSyncMarker(uint64_t marker, uint64_t totest)
     return errors;
 }
 
-// Takes 8 bits from a vector and makes a byte
-uint8_t convertBitsToByteAtPos(std::vector<bool> &bitvector, long pos)
+// Copy the MSU-MR bytes of a transport frame, its 4 data zones
+static void extractMSUMR(METEORFramer &framer, long bitPos, uint8_t *output)
 {
-    uint8_t value = bitvector[pos] << 7 |
-                    bitvector[pos + 1] << 6 |
-                    bitvector[pos + 2] << 5 |
-                    bitvector[pos + 3] << 4 |
-                    bitvector[pos + 4] << 3 |
-                    bitvector[pos + 5] << 2 |
-                    bitvector[pos + 6] << 1 |
-                    bitvector[pos + 7];
-    return value;
+    static const int zoneStarts[4] = {22, 278, 534, 790};
+    static const int zoneSizes[4] = {238, 238, 238, 234};
+    for (int zone = 0; zone < 4; zone++)
+        for (int byteReadPos = 0; byteReadPos < zoneSizes[zone]; byteReadPos++)
+            *output++ = framer.readRawByte(bitPos + (zoneStarts[zone] + byteReadPos) * 8);
 }
 
-// Function doing all the pre-frame work, that is, everything you'd need to do before being ready to read an image
-void METEORDecoder::processHRPT()
+// Whether an MSU-MR line starts with these bytes
+static bool isMSUSyncMarker(const uint8_t *bytes)
 {
+    uint64_t currentScanning = 0;
+    for (int i = 0; i < HRPT_SYNC_SIZE_MSU_MR; i++)
+        currentScanning = currentScanning << 8 | bytes[i];
+    return checkMSUSyncMarker(HRPT_SYNC_MSU_MR_BITS, currentScanning) < MSU_MR_THRESOLD;
+}
+
+// Function doing all the pre-frame work, that is, everything you'd need to do before being ready to read an image.
+// Unless the whole pass is selected, only the input around the lines selected gets Manchester decoded, lines being
+// found one after the other from the transport frame spacing. METEOR has no timecodes, selected times are ignored
+void METEORDecoder::processHRPT(const LineSelection &selection)
+{
+    line_step = selection.step;
+    if (!selectsWholePass(selection))
+    {
+        processSelection(selection);
+        return;
+    }
+
     // Manchester decoding
     std::cout << "Performing Manchester decoding... " << '\n';
     std::ofstream output_file("temp.man", std::ios::binary); // Open our output file
@@ -109,191 +118,20 @@ void METEORDecoder::processHRPT()
     // Transport frame sync.
     input_file = std::ifstream("temp.man", std::ios::binary); // Now we'e working Manchester-free
 
-    // Multiple variables we'll need
-    int frame_count = 0;
-    int thresold_state = 0;
-    std::vector<long> frame_starts;
-
     std::cout << "Reading file..." << '\n';
 
     // This may seem dumb at first, but considering decoded files are not several gigabytes... Working with a
     // vector eases the process a lot, and using RAM is also supposedly faster?
     // So here I'm read the entire file bit-per-bit into a vector of bools!
-    uint8_t bufferByte;
-    std::vector<bool> fileContentBin;
-    while (input_file.get((char &)bufferByte))
-    {
-        for (int i = 7; i >= 0; i--)
-        {
-            bool value = getBit<uint8_t>(bufferByte, i);
-            fileContentBin.push_back(value);
-        }
-    }
+    METEORFramer framer;
+    framer.loadFile(input_file);
 
     std::cout << "Searching for synchronization markers..." << '\n';
 
-    // Searching for sync markers... Implementation of http://www.sat.cc.ua/data/CADU%20Frame%20Synchro.pdf
+    // Searching for sync markers...
     // NOTE : Needs tuning? Is the implementation perfect? (Slight changes yield more frames)
-    {
-        uint32_t bitBuffer;
-        int bitsToIncrement = 1;
-        int errors = 0;
-        int sep_errors = 0;
-        int good = 0;
-        int state_2_bits_count = 0;
-        int last_state = 0;
-        std::cout << "NO LOCK" << std::flush;
-        for (long bitPos = 0; bitPos < fileContentBin.size() - 32; bitPos += bitsToIncrement)
-        {
-            // Well... Easier to work with a 32-bit value here... Needs to be build from the ground up.
-            bitBuffer = fileContentBin[bitPos] << 31 |
-                        fileContentBin[bitPos + 1] << 30 |
-                        fileContentBin[bitPos + 2] << 29 |
-                        fileContentBin[bitPos + 3] << 28 |
-                        fileContentBin[bitPos + 4] << 27 |
-                        fileContentBin[bitPos + 5] << 26 |
-                        fileContentBin[bitPos + 6] << 25 |
-                        fileContentBin[bitPos + 7] << 24 |
-                        fileContentBin[bitPos + 8] << 23 |
-                        fileContentBin[bitPos + 9] << 22 |
-                        fileContentBin[bitPos + 10] << 21 |
-                        fileContentBin[bitPos + 11] << 20 |
-                        fileContentBin[bitPos + 12] << 19 |
-                        fileContentBin[bitPos + 13] << 18 |
-                        fileContentBin[bitPos + 14] << 17 |
-                        fileContentBin[bitPos + 15] << 16 |
-                        fileContentBin[bitPos + 16] << 15 |
-                        fileContentBin[bitPos + 17] << 14 |
-                        fileContentBin[bitPos + 18] << 13 |
-                        fileContentBin[bitPos + 19] << 12 |
-                        fileContentBin[bitPos + 20] << 11 |
-                        fileContentBin[bitPos + 21] << 10 |
-                        fileContentBin[bitPos + 22] << 9 |
-                        fileContentBin[bitPos + 23] << 8 |
-                        fileContentBin[bitPos + 24] << 7 |
-                        fileContentBin[bitPos + 25] << 6 |
-                        fileContentBin[bitPos + 26] << 5 |
-                        fileContentBin[bitPos + 27] << 4 |
-                        fileContentBin[bitPos + 28] << 3 |
-                        fileContentBin[bitPos + 29] << 2 |
-                        fileContentBin[bitPos + 30] << 1 |
-                        fileContentBin[bitPos + 31];
-
-            // State 0 : Searches bit-per-bit for a perfect sync marker. If one is found, we jump to state 6!
-            if (thresold_state == TRANSPORT_THRESOLD_STATE_0)
-            {
-                if (checkSyncMarker(HRPT_SYNC_BITS, bitBuffer) <= thresold_state)
-                {
-                    frame_count++;
-                    frame_starts.push_back(bitPos);
-                    thresold_state = TRANSPORT_THRESOLD_STATE_1;
-                    bitsToIncrement = 1024 * 8;
-                    errors = 0;
-                    sep_errors = 0;
-                    good = 0;
-                }
-            }
-            // State 1 : Each header is expect 1024 bytes away. Only 6 mistmatches tolerated.
-            // If 5 consecutive good frames are found, we hop to state 22, though, 5 consecutive
-            // errors (here's why errors is reset each time a frame is good) means reset to state 0
-            // 2 frame errors pushes us to state 2
-            else if (thresold_state == TRANSPORT_THRESOLD_STATE_1)
-            {
-                if (checkSyncMarker(HRPT_SYNC_BITS, bitBuffer) <= thresold_state)
-                {
-                    frame_count++;
-                    frame_starts.push_back(bitPos);
-                    good++;
-                    errors = 0;
-
-                    if (good == 5)
-                    {
-                        thresold_state = TRANSPORT_THRESOLD_STATE_3;
-                        good = 0;
-                        errors = 0;
-                    }
-                }
-                else
-                {
-                    errors++;
-                    sep_errors++;
-
-                    if (errors == 5)
-                    {
-                        thresold_state = TRANSPORT_THRESOLD_STATE_0;
-                        bitsToIncrement = 1;
-                        errors = 0;
-                        sep_errors = 0;
-                        good = 0;
-                    }
-
-                    if (sep_errors == 2)
-                    {
-                        thresold_state = TRANSPORT_THRESOLD_STATE_2;
-                        state_2_bits_count = 0;
-                        bitsToIncrement = 1;
-                        errors = 0;
-                        sep_errors = 0;
-                        good = 0;
-                    }
-                }
-            }
-            // State 2 : Goes back to bit-per-bit syncing... 3 frame scanned and we got back to state 0, 1 good and back to 6!
-            else if (thresold_state == TRANSPORT_THRESOLD_STATE_2)
-            {
-                if (checkSyncMarker(HRPT_SYNC_BITS, bitBuffer) <= thresold_state)
-                {
-                    frame_count++;
-                    frame_starts.push_back(bitPos);
-                    thresold_state = TRANSPORT_THRESOLD_STATE_1;
-                    bitsToIncrement = 1024 * 8;
-                    errors = 0;
-                    sep_errors = 0;
-                    good = 0;
-                }
-                else
-                {
-                    state_2_bits_count++;
-                    errors++;
-
-                    if (state_2_bits_count >= 3072 * 8)
-                    {
-                        thresold_state = TRANSPORT_THRESOLD_STATE_0;
-                        bitsToIncrement = 1;
-                        errors = 0;
-                        sep_errors = 0;
-                        good = 0;
-                    }
-                }
-            }
-            // State 3 : We assume perfect lock and allow very high mismatchs.
-            // 1 error and back to state 6
-            // Note : Lowering the thresold seems to yield better of a sync
-            else if (thresold_state == TRANSPORT_THRESOLD_STATE_3)
-            {
-                if (checkSyncMarker(HRPT_SYNC_BITS, bitBuffer) <= thresold_state)
-                {
-                    frame_count++;
-                    frame_starts.push_back(bitPos);
-                }
-                else
-                {
-                    errors = 0;
-                    good = 0;
-                    sep_errors = 0;
-                    thresold_state = TRANSPORT_THRESOLD_STATE_1;
-                }
-            }
-
-            if (last_state != thresold_state)
-            {
-                std::cout << (thresold_state > 0 ? "\rLOCKED " : "\rNO LOCK") << std::flush;
-                last_state = thresold_state;
-            }
-        }
-    }
-    std::cout << '\n';
-    std::cout << "Found " << frame_count << " valid sync markers!" << '\n';
+    std::vector<long> &frame_starts = framer.findFrames();
+    std::cout << "Found " << frame_starts.size() << " valid sync markers!" << '\n';
 
     // Demultiplexing
     std::cout << "Demultiplexing MSU-MR..." << '\n';
@@ -302,35 +140,11 @@ void METEORDecoder::processHRPT()
 
     // Extracing MSU-MR data! Since we probably aren't in sync with byte spacing...
     // Still bit-per-bit and based on our frame starts saved earlier
+    uint8_t msu_mr_bytes[MSUMR_BYTES_PER_FRAME];
     for (long bitPos : frame_starts)
     {
-        int msu_mr_data_pos = bitPos + 22 * 8;
-        for (int byteReadPos = 0; byteReadPos < 238; byteReadPos++)
-        {
-            uint8_t byte = convertBitsToByteAtPos(fileContentBin, msu_mr_data_pos + byteReadPos * 8);
-            output_file.put(byte);
-        }
-
-        msu_mr_data_pos = bitPos + 278 * 8;
-        for (int byteReadPos = 0; byteReadPos < 238; byteReadPos++)
-        {
-            uint8_t byte = convertBitsToByteAtPos(fileContentBin, msu_mr_data_pos + byteReadPos * 8);
-            output_file.put(byte);
-        }
-
-        msu_mr_data_pos = bitPos + 534 * 8;
-        for (int byteReadPos = 0; byteReadPos < 238; byteReadPos++)
-        {
-            uint8_t byte = convertBitsToByteAtPos(fileContentBin, msu_mr_data_pos + byteReadPos * 8);
-            output_file.put(byte);
-        }
-
-        msu_mr_data_pos = bitPos + 790 * 8;
-        for (int byteReadPos = 0; byteReadPos < 234; byteReadPos++)
-        {
-            uint8_t byte = convertBitsToByteAtPos(fileContentBin, msu_mr_data_pos + byteReadPos * 8);
-            output_file.put(byte);
-        }
+        extractMSUMR(framer, bitPos, msu_mr_bytes);
+        output_file.write((char *)msu_mr_bytes, MSUMR_BYTES_PER_FRAME);
     }
 
     // Some cleanup...
@@ -380,21 +194,122 @@ void METEORDecoder::processHRPT()
     std::cout << "Found " << total_mru_frame_count << " valid MSU-MR sync markers!" << '\n';
 }
 
-// Function used to decode a choosen channel
-cimg_library::CImg<unsigned short> METEORDecoder::decodeChannel(int channel)
+// Counterpart of processHRPT for part of a pass, only Manchester decoding the input around the lines selected
+void METEORDecoder::processSelection(const LineSelection &selection)
 {
-    input_file.clear();
+    std::cout << "Decoding every " << line_step << " lines from line " << selection.first << ", Manchester decoding only around them..." << '\n';
+    input_file.seekg(0, std::ios::end);
+    const long decodedSize = (long)input_file.tellg() / 2;
+    std::ofstream output_file("temp.msumr", std::ios::binary);
+
+    // Last line found : decoded bit position of the transport frame it starts in, offset of its first byte
+    // in that frame's MSU-MR bytes, and index in the pass. Lines are numbered from the first one found
+    bool anchored = false;
+    long anchorBit = 0, anchorLine = 0;
+    int anchorOffset = 0;
+    // Next line wanted, and where windows start from. Without lock, larger windows follow each other until a line shows up
+    long line = 0, searchBit = 0;
+    bool locked = false;
+    std::vector<uint8_t> raw;
+    std::vector<uint8_t> msu_mr_buffer;
+    while (selection.last < 0 || line < selection.last)
+    {
+        // One frame of slack before the expected one
+        long windowStart = std::max(searchBit / 8 - HRPT_TRANSPORT_SIZE, 0L);
+        long windowSize = std::min<long>((locked ? SELECTION_WINDOW_FRAMES : SELECTION_LOCK_FRAMES) * HRPT_TRANSPORT_SIZE, decodedSize - windowStart);
+        if (windowSize < MSUMR_LINE_SIZE)
+            break;
+
+        // Manchester decoding of the window only
+        raw.resize(windowSize * 2);
+        readAt(windowStart * 2, (char *)raw.data(), raw.size());
+        METEORFramer framer;
+        for (long i = 0; i < windowSize; i++)
+            framer.pushByte(manchester_decode(raw[i * 2 + 1], raw[i * 2]));
+
+        std::vector<long> &frame_starts = framer.findFrames(false);
+        msu_mr_buffer.resize(frame_starts.size() * MSUMR_BYTES_PER_FRAME);
+        for (size_t frame = 0; frame < frame_starts.size(); frame++)
+            extractMSUMR(framer, frame_starts[frame], &msu_mr_buffer[frame * MSUMR_BYTES_PER_FRAME]);
+
+        // First complete line in there
+        long lineStart = -1;
+        for (long i = 0; i + MSUMR_LINE_SIZE <= (long)msu_mr_buffer.size(); i++)
+        {
+            if (isMSUSyncMarker(&msu_mr_buffer[i]))
+            {
+                lineStart = i;
+                break;
+            }
+        }
 
-    // Large passes are too good for the stack to take it...
-    unsigned short *imageBuffer = new unsigned short[total_mru_frame_count * HRPT_SCAN_WIDTH];
+        if (lineStart < 0)
+        {
+            // Lost, look again from there on, windows overlapping by a line
+            if (!locked)
+                searchBit += (long)(SELECTION_LOCK_FRAMES * HRPT_TRANSPORT_SIZE - MSUMR_LINE_SIZE - HRPT_TRANSPORT_SIZE) * 8;
+            locked = false;
+            continue;
+        }
+
+        // Which line that is, from its distance to the last one
+        long foundBit = windowStart * 8 + frame_starts[lineStart / MSUMR_BYTES_PER_FRAME];
+        int foundOffset = lineStart % MSUMR_BYTES_PER_FRAME;
+        long foundLine = 0;
+        if (anchored)
+        {
+            double bytes = (double)(foundBit - anchorBit) / (HRPT_TRANSPORT_SIZE * 8) * MSUMR_BYTES_PER_FRAME + foundOffset - anchorOffset;
+            foundLine = std::max(anchorLine + std::lround(bytes / MSUMR_LINE_SIZE), anchorLine + 1);
+        }
 
+        // Lines off the step grid, found after losing lock, only serve as anchors : rows must stay evenly spaced in time
+        const bool onGrid = foundLine >= selection.first && (foundLine - selection.first) % line_step == 0;
+        if (onGrid && (selection.last < 0 || foundLine < selection.last))
+        {
+            if (total_mru_frame_count == 0)
+                first_line = foundLine;
+            output_file.write((char *)&msu_mr_buffer[lineStart], MSUMR_LINE_SIZE);
+            msu_frame_starts.push_back((long)total_mru_frame_count * MSUMR_LINE_SIZE);
+            total_mru_frame_count++;
+        }
+
+        // Next lines are expected from this one, so drift never adds up
+        anchored = locked = true;
+        anchorBit = foundBit;
+        anchorOffset = foundOffset;
+        anchorLine = foundLine;
+        line = foundLine < selection.first ? selection.first : selection.first + ((foundLine - selection.first) / line_step + 1) * line_step;
+
+        long nextOffset = anchorOffset + (line - anchorLine) * MSUMR_LINE_SIZE;
+        searchBit = anchorBit + nextOffset / MSUMR_BYTES_PER_FRAME * HRPT_TRANSPORT_SIZE * 8;
+    }
+
+    output_file.close();
+    input_file.close();
+    input_file.open("temp.msumr", std::ios::binary);
+    std::cout << "Found " << total_mru_frame_count << " valid MSU-MR sync markers!" << '\n';
+}
+
+// Seek and read from the input, safe to call from several threads. Returns the byte count read
+size_t METEORDecoder::readAt(long position, char *buffer, size_t size)
+{
+    std::lock_guard<std::mutex> lock(input_mutex);
+    input_file.clear();
+    input_file.seekg(position);
+    input_file.read(buffer, size);
+    return input_file.gcount();
+}
+
+// Function used to decode a choosen channel into a caller-provided buffer of HRPT_SCAN_WIDTH * getTotalFrameCount() pixels.
+// Samples are multiplied by scale, 1 keeping the raw 10-bits values
+void METEORDecoder::decodeChannelInto(int channel, unsigned short *imageBuffer, int scale)
+{
     long linecount = 0;
     for (long frame_pos : msu_frame_starts)
     {
         /// Go at the beggining of the frame
         uint8_t msumr_frame_buffer[11850];
-        input_file.seekg(frame_pos);
-        input_file.read((char *)msumr_frame_buffer, sizeof(msumr_frame_buffer));
+        readAt(frame_pos, (char *)msumr_frame_buffer, sizeof(msumr_frame_buffer));
 
         uint16_t line_buffer[HRPT_SCAN_WIDTH];
 
@@ -418,18 +333,48 @@ cimg_library::CImg<unsigned short> METEORDecoder::decodeChannel(int channel)
             pixel4 = ((pixel_buffer_4[3] % 4) << 8) | pixel_buffer_4[4];
 
             int currentImagePixelPos = l * 4;
-            imageBuffer[linecount * HRPT_SCAN_WIDTH + currentImagePixelPos] = pixel1 * 60;
-            imageBuffer[linecount * HRPT_SCAN_WIDTH + currentImagePixelPos + 1] = pixel2 * 60;
-            imageBuffer[linecount * HRPT_SCAN_WIDTH + currentImagePixelPos + 2] = pixel3 * 60;
-            imageBuffer[linecount * HRPT_SCAN_WIDTH + currentImagePixelPos + 3] = pixel4 * 60;
+            imageBuffer[linecount * HRPT_SCAN_WIDTH + currentImagePixelPos] = pixel1 * scale;
+            imageBuffer[linecount * HRPT_SCAN_WIDTH + currentImagePixelPos + 1] = pixel2 * scale;
+            imageBuffer[linecount * HRPT_SCAN_WIDTH + currentImagePixelPos + 2] = pixel3 * scale;
+            imageBuffer[linecount * HRPT_SCAN_WIDTH + currentImagePixelPos + 3] = pixel4 * scale;
         }
         linecount++;
     }
+}
+
+// Function used to read the raw, channel-interleaved samples of an image row. Returns false if the row is missing
+bool METEORDecoder::readLine(int row, uint16_t *samples)
+{
+    if (row < 0 || row >= total_mru_frame_count)
+        return false;
+
+    /// Go at the beggining of the frame
+    uint8_t msumr_frame_buffer[11850];
+    readAt(msu_frame_starts[row], (char *)msumr_frame_buffer, sizeof(msumr_frame_buffer));
+
+    // Each 30 bytes group holds 4 pixels of all 6 channels, 5 bytes each
+    for (int l = 0; l < 393; l++)
+    {
+        for (int channel = 0; channel < HRPT_NUM_CHANNELS; channel++)
+        {
+            uint8_t *pixel_buffer_4 = &msumr_frame_buffer[50 + l * 30 + channel * 5];
+            uint16_t *pixels = &samples[l * 4 * HRPT_NUM_CHANNELS + channel];
+
+            // Convert 5 bytes to 4 10-bits values
+            pixels[0] = (pixel_buffer_4[0] << 2) | (pixel_buffer_4[1] >> 6);
+            pixels[HRPT_NUM_CHANNELS] = ((pixel_buffer_4[1] % 64) << 4) | (pixel_buffer_4[2] >> 4);
+            pixels[HRPT_NUM_CHANNELS * 2] = ((pixel_buffer_4[2] % 16) << 6) | (pixel_buffer_4[3] >> 2);
+            pixels[HRPT_NUM_CHANNELS * 3] = ((pixel_buffer_4[3] % 4) << 8) | pixel_buffer_4[4];
+        }
+    }
 
-    // Build an image and return it
-    cimg_library::CImg<unsigned short> channelImage(&imageBuffer[0], HRPT_SCAN_WIDTH, total_mru_frame_count);
-    delete[] imageBuffer; // Don't forget to free up the heap!
-    return channelImage;
+    return true;
+}
+
+// Return the pass as a line source, for streamed outputs
+LineSource METEORDecoder::getLineSource()
+{
+    return {HRPT_SCAN_WIDTH, total_mru_frame_count, HRPT_NUM_CHANNELS, HRPT_PIXEL_SCALE, [this](int row, uint16_t *samples) { return readLine(row, samples); }};
 }
 
 // Return total frame count
@@ -438,6 +383,18 @@ int METEORDecoder::getTotalFrameCount()
     return total_mru_frame_count;
 }
 
+// Return the time between two image rows
+double METEORDecoder::getLineDuration()
+{
+    return HRPT_LINE_DURATION * line_step;
+}
+
+// Return the line of the pass the first image row is
+int METEORDecoder::getFirstLine()
+{
+    return first_line;
+}
+
 // Perform a cleanup..
 void METEORDecoder::cleanupFiles()
 {
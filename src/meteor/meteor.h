@@ -1,8 +1,8 @@
 #include <fstream>
+#include <mutex>
 #include <vector>
-#define cimg_use_png
-#define cimg_display 0
-#include "CImg.h"
+#include "common/hrpt.h"
+#include "common/line_source.h"
 
 #define METEOR_HRPT_CHANNELS 6
 
@@ -11,6 +11,8 @@ class METEORDecoder
 private:
     // Our ifstream used... All the time
     std::ifstream &input_file;
+    // Lines can be read from several threads at once
+    std::mutex input_mutex;
     // Total frame count variable to be used later
     int total_frame_count = 0;
     // First frame position in file
@@ -18,16 +20,35 @@ private:
     long mru_first_frame_pos = -1;
     int total_mru_frame_count = 0;
     std::vector<long> msu_frame_starts;
+    // MSU-MR lines between two image rows, and line of the pass the first row is, when only part of it is selected
+    int line_step = 1;
+    int first_line = 0;
+
+    // Seek and read from the input, safe to call from several threads. Returns the byte count read
+    size_t readAt(long position, char *buffer, size_t size);
+    // Counterpart of processHRPT for part of a pass, only Manchester decoding the input around the lines selected
+    void processSelection(const LineSelection &selection);
 
 public:
     // Constructor
     METEORDecoder(std::ifstream &input);
-    // Function doing all the pre-frame work, that is, everything you'd need to do before being ready to read an image
-    void processHRPT();
-    // Function used to decode a choosen channel
-    cimg_library::CImg<unsigned short> decodeChannel(int channel);
+    // Function doing all the pre-frame work, that is, everything you'd need to do before being ready to read an image.
+    // Unless the whole pass is selected, only the input around the lines selected gets Manchester decoded, lines being
+    // found one after the other from the transport frame spacing. METEOR has no timecodes, selected times are ignored
+    void processHRPT(const LineSelection &selection = HRPT_WHOLE_PASS);
+    // Function used to decode a choosen channel into a caller-provided buffer of 1572 * getTotalFrameCount() pixels.
+    // Samples are multiplied by scale, 1 keeping the raw 10-bits values
+    void decodeChannelInto(int channel, unsigned short *imageBuffer, int scale = HRPT_PIXEL_SCALE);
+    // Function used to read the raw, channel-interleaved samples of an image row. Returns false if the row is missing
+    bool readLine(int row, uint16_t *samples);
+    // Return the pass as a line source, for streamed outputs
+    LineSource getLineSource();
     // Return total fram count
     int getTotalFrameCount();
+    // Return the time between two image rows
+    double getLineDuration();
+    // Return the line of the pass the first image row is
+    int getFirstLine();
     // File cleanup
     void cleanupFiles();
 };
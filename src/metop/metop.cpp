@@ -1,6 +1,12 @@
 #include "metop.h"
 #include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <climits>
 #include "CCSDS/CCSDSSpacePacket.hh"
+#include "common/viterbi.h"
+#include "common/cadu_framer.h"
+#include "common/hrpt.h"
 
 // HRPT channel count
 const int HRPT_NUM_CHANNELS = 5;
@@ -9,270 +15,165 @@ const int HRPT_SCAN_WIDTH = 2048;
 // Total word size from all channels
 const int HRPT_SCAN_SIZE = HRPT_SCAN_WIDTH * HRPT_NUM_CHANNELS;
 
-// Definitely still needs tuning
-#define TRANSPORT_THRESOLD_STATE_3 12
-#define TRANSPORT_THRESOLD_STATE_2 6
-#define TRANSPORT_THRESOLD_STATE_1 2
-#define TRANSPORT_THRESOLD_STATE_0 0
-
 // Sync marker word size
 const int HRPT_SYNC_SIZE = 4;
 // Sync marker
 static const uint8_t HRPT_SYNC[HRPT_SYNC_SIZE] = {0x1A, 0xCF, 0xFC, 0x1D};
 static const uint32_t HRPT_SYNC_BITS = HRPT_SYNC[0] << 24 | HRPT_SYNC[1] << 16 | HRPT_SYNC[2] << 8 | HRPT_SYNC[3];
+// CADU size
+const int HRPT_CADU_SIZE = 1024;
+
+// MetOp CADUs, hard input bits are inverted and randomized
+typedef CaduFramer<HRPT_SYNC_BITS, HRPT_CADU_SIZE, true, true> METOPFramer;
+
+// AVHRR data virtual channel
+const int AVHRR_VCID = 9;
+// Idle VCDUs, counters aren't meaningful there
+const int IDLE_VCID = 63;
+// M-PDU data zone size
+const int MPDU_DATA_SIZE = 882;
+
+// AVHRR/3 scan rate, 6 lines per second
+const double AVHRR_LINE_DURATION = 1.0 / 6.0;
+// Lines further away than this from the median time are considered corrupted
+const double AVHRR_MAX_PASS_TIME = 30 * 60;
+// Unpacked scanlines kept around for other consumers of the same lines
+const int UNPACKED_LINE_SLOTS = 64;
+// Days between the UNIX epoch and the CCSDS epoch used by MetOp (2000-01-01)
+const int CCSDS_EPOCH_DAYS = 10957;
+// End of the secondary header timecode, after the primary header
+const int CCSDS_TIMECODE_END = 14;
+
+// Soft symbols read at once
+const int SOFT_BUFFER_SIZE = 1024 * 1024;
+// Soft symbols used to find the phase ambiguity
+const int SOFT_AMBIGUITY_SYMBOLS = 16384;
+// Soft symbols between two checks of the phase ambiguity, and BER above which it's looked for again.
+// Noise, or wrong settings, still re-encode to a BER of 0.15 or so, good signals are well under 0.1
+const int SOFT_CHECK_SYMBOLS = 1 << 18;
+const float SOFT_MAX_BER = 0.1f;
 
 // Constructor
-METOPDecoder::METOPDecoder(std::ifstream &input) : input_file{input}
+METOPDecoder::METOPDecoder(std::ifstream &input, bool softSymbols) : input_file{input}, soft_symbols{softSymbols}
 {
-    // From gr-poes-weather (including comments!)
-    unsigned char feedbk, randm = 0xff;
-    // Original Polynomial is :  1 + x3 + x5 + x7 +x8
-    d_rantab[0] = 0;
-    d_rantab[1] = 0;
-    d_rantab[2] = 0;
-    d_rantab[3] = 0;
-    for (int i = 4; i < 1024; i++)
-    { //4ASM bytes + 1020bytes = 32 + 8160 bits in CADU packet
-
-        d_rantab[i] = 0;
-        for (int j = 0; j <= 7; j++)
-        {
-            d_rantab[i] = d_rantab[i] << 1;
-            if (randm & 0x80) //80h = 1000 0000b
-                d_rantab[i]++;
-
-            //Bit-Wise AND between: Fixed shift register(95h) and the state of the
-            // feedback register: randm
-            feedbk = randm & 0x95; //95h = 1001 0101--> bits 1,3,5,8
-            //feedback contains the contents of the registers masked by the polynomial
-            //  1 + x3 + x5 + xt +x8 = 95 h
-            randm = randm << 1;
-
-            if ((((feedbk & 0x80) ^ (0x80 & feedbk << 3)) ^ (0x80 & (feedbk << 5))) ^ (0x80 & (feedbk << 7)))
-                randm++;
-        }
-    }
+    unpacked_lines.reset(new UnpackedLine[UNPACKED_LINE_SLOTS]);
+    for (int slot = 0; slot < UNPACKED_LINE_SLOTS; slot++)
+        unpacked_lines[slot].samples.resize(HRPT_SCAN_SIZE);
 }
 
-// Returns the asked bit!
-template <typename T>
-inline bool getBit(T data, int bit)
+// Parse a CCSDS day-segmented timecode (2 bytes of day, 4 bytes of milliseconds, 2 bytes of microseconds) into a UNIX timestamp
+double parseCDSTimestamp(const uint8_t *data)
 {
-    return (data >> bit) & 1;
+    uint16_t days = data[0] << 8 | data[1];
+    uint32_t milliseconds = (uint32_t)data[2] << 24 | data[3] << 16 | data[4] << 8 | data[5];
+    uint16_t microseconds = data[6] << 8 | data[7];
+    return (double)(days + CCSDS_EPOCH_DAYS) * 86400.0 + milliseconds / 1e3 + microseconds / 1e6;
 }
 
-// Compare 2 32-bits values bit per bit
-int checkSyncMarker2(uint32_t marker, uint32_t totest)
+// Viterbi-decode 8-bit soft symbols into bits
+void METOPDecoder::viterbiDecode(std::vector<bool> &bits)
 {
-    int errors = 0;
-    for (int i = 31; i >= 0; i--)
+    std::cout << "Viterbi decoding soft symbols..." << '\n';
+
+    ViterbiDecoder viterbi;
+    std::vector<int8_t> symbolBuffer(SOFT_BUFFER_SIZE);
+    std::vector<uint8_t> decodedBits;
+    // Settings in use. Blocks of symbols being even-sized, the alignment holds from block to block
+    bool ambiguityResolved = false;
+    ViterbiPhase phase = VITERBI_PHASE_0;
+    bool skipSymbol = false;
+    long symbolPosition = 0;
+
+    while (input_file.read((char *)symbolBuffer.data(), SOFT_BUFFER_SIZE) || input_file.gcount() > 0)
+    {
+        size_t count = input_file.gcount();
+
+        for (size_t start = 0; start < count; start += SOFT_CHECK_SYMBOLS, symbolPosition += SOFT_CHECK_SYMBOLS)
+        {
+            const int8_t *block = &symbolBuffer[start];
+            size_t blockCount = std::min<size_t>(SOFT_CHECK_SYMBOLS, count - start);
+            size_t checkCount = std::min<size_t>(blockCount, SOFT_AMBIGUITY_SYMBOLS);
+
+            // Phase and symbol alignment are checked on every block, and looked for again when they stop fitting,
+            // the recording starting with noise or the demodulator slipping. The decoder restarts from that block
+            float ber = ambiguityResolved ? ViterbiDecoder::measureBER(phase, skipSymbol, block, checkCount) : 1.0f;
+            if (ber > SOFT_MAX_BER)
+            {
+                ViterbiDecoder candidate;
+                float candidateBER = candidate.resolveAmbiguity(block, checkCount);
+                if (!ambiguityResolved || (candidateBER <= SOFT_MAX_BER && (candidate.getPhase() != phase || candidate.getSkipSymbol() != skipSymbol)))
+                {
+                    if (ambiguityResolved)
+                    {
+                        decodedBits.clear();
+                        viterbi.flush(decodedBits);
+                        bits.insert(bits.end(), decodedBits.begin(), decodedBits.end());
+                    }
+
+                    phase = candidate.getPhase();
+                    skipSymbol = candidate.getSkipSymbol();
+                    viterbi = ViterbiDecoder(phase, skipSymbol);
+                    std::cout << "Phase " << phase << (skipSymbol ? ", shifted" : "") << ", estimated BER " << candidateBER << " from symbol " << symbolPosition << '\n';
+                    ambiguityResolved = true;
+                }
+            }
+
+            decodedBits.clear();
+            viterbi.work(block, blockCount, decodedBits);
+            bits.insert(bits.end(), decodedBits.begin(), decodedBits.end());
+        }
+    }
+
+    decodedBits.clear();
+    viterbi.flush(decodedBits);
+    bits.insert(bits.end(), decodedBits.begin(), decodedBits.end());
+
+    // A 180° rotation inverts all bits. Check which polarity the ASM shows up with
+    long normal = 0, inverted = 0;
+    uint32_t shifter = 0;
+    for (size_t i = 0; i < bits.size(); i++)
     {
-        bool markerBit, testBit;
-        markerBit = getBit<uint32_t>(marker, i);
-        testBit = getBit<uint32_t>(totest, i);
-        if (markerBit != testBit)
-            errors++;
+        shifter = shifter << 1 | bits[i];
+        if (shifter == HRPT_SYNC_BITS)
+            normal++;
+        else if (shifter == ~HRPT_SYNC_BITS)
+            inverted++;
     }
-    return errors;
+    if (inverted > normal)
+        bits.flip();
+
+    std::cout << "Done! Decoded " << bits.size() << " bits" << '\n';
 }
 
-// Takes 8 bits from a vector and makes a byte
-uint8_t convertBitsToByteAtPos2(std::vector<bool> &bitvector, long pos)
+// Median of timestamps
+static double medianTimestamp(std::vector<double> timestamps)
 {
-    uint8_t value = bitvector[pos] << 7 |
-                    bitvector[pos + 1] << 6 |
-                    bitvector[pos + 2] << 5 |
-                    bitvector[pos + 3] << 4 |
-                    bitvector[pos + 4] << 3 |
-                    bitvector[pos + 5] << 2 |
-                    bitvector[pos + 6] << 1 |
-                    bitvector[pos + 7];
-    return value;
+    if (timestamps.empty())
+        return NAN;
+    std::nth_element(timestamps.begin(), timestamps.begin() + timestamps.size() / 2, timestamps.end());
+    return timestamps[timestamps.size() / 2];
 }
 
-// Function doing all the pre-frame work, that is, everything you'd need to do before being ready to read an image
-void METOPDecoder::processHRPT()
+// Function doing all the pre-frame work, that is, everything you'd need to do before being ready to read an image.
+// Unless the whole pass is selected, AVHRR packets are first only located from their timecodes, and just the ones
+// selected get read and unpacked
+void METOPDecoder::processHRPT(const LineSelection &selection)
 {
+    line_step = selection.step;
     std::cout << "Reading file..." << '\n';
     // Here we load the entire file into RAM... Should be fine!
-    uint8_t bufferByte;
-    std::vector<bool> fileContentBin;
-    while (input_file.get((char &)bufferByte))
-    {
-        for (int i = 7; i >= 0; i--)
-        {
-            bool value = getBit<uint8_t>(bufferByte, i);
-            fileContentBin.push_back(!value); // Bit inversion
-        }
-    }
+    METOPFramer framer;
+    if (soft_symbols)
+        viterbiDecode(framer.getBits());
+    else
+        framer.loadFile(input_file);
     input_file.close();
 
     std::cout << "Detecting synchronization markers..." << '\n';
 
-    // A nice sync machine just like METEOR! 
-    int frame_count = 0;
-    int thresold_state = 0;
-    std::vector<long> frame_starts;
-    {
-        uint32_t bitBuffer;
-        int bitsToIncrement = 1;
-        int errors = 0;
-        int sep_errors = 0;
-        int good = 0;
-        int state_2_bits_count = 0;
-        int last_state = 0;
-        std::cout << "NO LOCK" << std::flush;
-        for (long bitPos = 0; bitPos < fileContentBin.size() - 32; bitPos += bitsToIncrement)
-        {
-            // Well... Easier to work with a 32-bit value here... Needs to be build from the ground up.
-            bitBuffer = fileContentBin[bitPos] << 31 |
-                        fileContentBin[bitPos + 1] << 30 |
-                        fileContentBin[bitPos + 2] << 29 |
-                        fileContentBin[bitPos + 3] << 28 |
-                        fileContentBin[bitPos + 4] << 27 |
-                        fileContentBin[bitPos + 5] << 26 |
-                        fileContentBin[bitPos + 6] << 25 |
-                        fileContentBin[bitPos + 7] << 24 |
-                        fileContentBin[bitPos + 8] << 23 |
-                        fileContentBin[bitPos + 9] << 22 |
-                        fileContentBin[bitPos + 10] << 21 |
-                        fileContentBin[bitPos + 11] << 20 |
-                        fileContentBin[bitPos + 12] << 19 |
-                        fileContentBin[bitPos + 13] << 18 |
-                        fileContentBin[bitPos + 14] << 17 |
-                        fileContentBin[bitPos + 15] << 16 |
-                        fileContentBin[bitPos + 16] << 15 |
-                        fileContentBin[bitPos + 17] << 14 |
-                        fileContentBin[bitPos + 18] << 13 |
-                        fileContentBin[bitPos + 19] << 12 |
-                        fileContentBin[bitPos + 20] << 11 |
-                        fileContentBin[bitPos + 21] << 10 |
-                        fileContentBin[bitPos + 22] << 9 |
-                        fileContentBin[bitPos + 23] << 8 |
-                        fileContentBin[bitPos + 24] << 7 |
-                        fileContentBin[bitPos + 25] << 6 |
-                        fileContentBin[bitPos + 26] << 5 |
-                        fileContentBin[bitPos + 27] << 4 |
-                        fileContentBin[bitPos + 28] << 3 |
-                        fileContentBin[bitPos + 29] << 2 |
-                        fileContentBin[bitPos + 30] << 1 |
-                        fileContentBin[bitPos + 31];
-
-            // State 0 : Searches bit-per-bit for a perfect sync marker. If one is found, we jump to state 6!
-            if (thresold_state == TRANSPORT_THRESOLD_STATE_0)
-            {
-                if (checkSyncMarker2(HRPT_SYNC_BITS, bitBuffer) <= thresold_state)
-                {
-                    frame_count++;
-                    frame_starts.push_back(bitPos);
-                    thresold_state = TRANSPORT_THRESOLD_STATE_1;
-                    bitsToIncrement = 1024 * 8;
-                    errors = 0;
-                    sep_errors = 0;
-                    good = 0;
-                }
-            }
-            // State 1 : Each header is expect 1024 bytes away. Only 6 mistmatches tolerated.
-            // If 5 consecutive good frames are found, we hop to state 22, though, 5 consecutive
-            // errors (here's why errors is reset each time a frame is good) means reset to state 0
-            // 2 frame errors pushes us to state 2
-            else if (thresold_state == TRANSPORT_THRESOLD_STATE_1)
-            {
-                if (checkSyncMarker2(HRPT_SYNC_BITS, bitBuffer) <= thresold_state)
-                {
-                    frame_count++;
-                    frame_starts.push_back(bitPos);
-                    good++;
-                    errors = 0;
-
-                    if (good == 5)
-                    {
-                        thresold_state = TRANSPORT_THRESOLD_STATE_3;
-                        good = 0;
-                        errors = 0;
-                    }
-                }
-                else
-                {
-                    errors++;
-                    sep_errors++;
-
-                    if (errors == 5)
-                    {
-                        thresold_state = TRANSPORT_THRESOLD_STATE_0;
-                        bitsToIncrement = 1;
-                        errors = 0;
-                        sep_errors = 0;
-                        good = 0;
-                    }
-
-                    if (sep_errors == 2)
-                    {
-                        thresold_state = TRANSPORT_THRESOLD_STATE_2;
-                        state_2_bits_count = 0;
-                        bitsToIncrement = 1;
-                        errors = 0;
-                        sep_errors = 0;
-                        good = 0;
-                    }
-                }
-            }
-            // State 2 : Goes back to bit-per-bit syncing... 3 frame scanned and we got back to state 0, 1 good and back to 6!
-            else if (thresold_state == TRANSPORT_THRESOLD_STATE_2)
-            {
-                if (checkSyncMarker2(HRPT_SYNC_BITS, bitBuffer) <= thresold_state)
-                {
-                    frame_count++;
-                    frame_starts.push_back(bitPos);
-                    thresold_state = TRANSPORT_THRESOLD_STATE_1;
-                    bitsToIncrement = 1024 * 8;
-                    errors = 0;
-                    sep_errors = 0;
-                    good = 0;
-                }
-                else
-                {
-                    state_2_bits_count++;
-                    errors++;
-
-                    if (state_2_bits_count >= 3072 * 8)
-                    {
-                        thresold_state = TRANSPORT_THRESOLD_STATE_0;
-                        bitsToIncrement = 1;
-                        errors = 0;
-                        sep_errors = 0;
-                        good = 0;
-                    }
-                }
-            }
-            // State 3 : We assume perfect lock and allow very high mismatchs.
-            // 1 error and back to state 6
-            // Note : Lowering the thresold seems to yield better of a sync
-            else if (thresold_state == TRANSPORT_THRESOLD_STATE_3)
-            {
-                if (checkSyncMarker2(HRPT_SYNC_BITS, bitBuffer) <= thresold_state)
-                {
-                    frame_count++;
-                    frame_starts.push_back(bitPos);
-                }
-                else
-                {
-                    errors = 0;
-                    good = 0;
-                    sep_errors = 0;
-                    thresold_state = TRANSPORT_THRESOLD_STATE_1;
-                }
-            }
-
-            if (last_state != thresold_state)
-            {
-                std::cout << (thresold_state > 0 ? "\rLOCKED " : "\rNO LOCK") << std::flush;
-                last_state = thresold_state;
-            }
-        }
-    }
-    std::cout << '\n';
-    std::cout << "Done! Found " << frame_count << " sync markers!" << '\n';
+    // A nice sync machine just like METEOR!
+    std::vector<long> &frame_starts = framer.findFrames();
+    std::cout << "Done! Found " << frame_starts.size() << " sync markers!" << '\n';
 
     std::cout << "Processing VCDUs and CCSDS frames..." << '\n';
 
@@ -280,49 +181,135 @@ void METOPDecoder::processHRPT()
 
     // We need to know where our frames are
     std::vector<long> ccsdsFrameStarts;
+    // Positions in the M-PDU stream right after a discontinuity, no packet may span them
+    std::vector<long> discontinuities;
     // Count of VCID 9 frame founds
     int count9 = 0;
+    // Reed-Solomon statistics
+    int rs_clean = 0, rs_corrected = 0, rs_uncorrectable = 0;
+    long rs_corrected_bytes = 0;
     for (long current_frame_pos : frame_starts)
     {
         std::vector<uint8_t> packetVec;
 
         // Read everything but the header
-        for (int u = 4; u < 1024; u++)
+        for (int u = 4; u < HRPT_CADU_SIZE; u++)
+            packetVec.push_back(framer.readByte(current_frame_pos, u));
+
+        // Reed-Solomon error correction, interleave 4. Clean frames only cost a syndrome check
+        RSFrameReport rsReport = reed_solomon.decodeInterleaved(packetVec.data(), 4);
+        rs_frame_results.push_back(rsReport.corrected);
+        if (rsReport.clean)
+            rs_clean++;
+        else if (rsReport.corrected >= 0)
+        {
+            rs_corrected++;
+            rs_corrected_bytes += rsReport.corrected;
+        }
+        else
         {
-            uint8_t dataByte = convertBitsToByteAtPos2(fileContentBin, current_frame_pos + u * 8);
-            dataByte = dataByte ^ d_rantab[u]; // Derandomize
-            packetVec.push_back(dataByte);
+            // Nothing in there can be trusted, treat it as lost
+            rs_uncorrectable++;
+            continue;
         }
 
         int vcid = (packetVec[1] % 64); // Extract VCID from header
+        uint32_t vcdu_counter = packetVec[2] << 16 | packetVec[3] << 8 | packetVec[4];
+
+        if (vcid == IDLE_VCID)
+            continue;
+
+        // Check continuity. Duplicates are dropped, gaps are recorded so no packet spans them
+        VCDUContinuity continuity = vcdu_continuity.push(vcid, vcdu_counter);
+        if (continuity == VCDU_DUPLICATE)
+            continue;
 
         // Select only AHRR data
-        if (vcid == 9)
+        if (vcid == AVHRR_VCID)
         {
             // Read M-PDU
             int mpdu_spare = (packetVec[8] >> 3);
             int mpdu_header = ((packetVec[8] % 8) << 8) | packetVec[9];
-            
+
+            if (continuity == VCDU_GAP)
+                discontinuities.push_back(count9 * MPDU_DATA_SIZE);
+
             // Write data into our buffer file
-            for (int i = 0; i < 882; i++)
+            for (int i = 0; i < MPDU_DATA_SIZE; i++)
                 output_file.put((char &)packetVec[10 + i]);
 
             // If there is a header, save its position
-            if (mpdu_spare == 0)
-                ccsdsFrameStarts.push_back(count9 * 882 + mpdu_header);
+            if (mpdu_spare == 0 && mpdu_header < MPDU_DATA_SIZE)
+                ccsdsFrameStarts.push_back(count9 * MPDU_DATA_SIZE + mpdu_header);
 
             count9++;
         }
     }
 
+    std::cout << "Reed-Solomon : " << rs_clean << " clean, " << rs_corrected << " corrected (" << rs_corrected_bytes << " bytes), " << rs_uncorrectable << " uncorrectable" << '\n';
     std::cout << "Found " << count9 << " VCDUs with VCID 9" << '\n';
+    std::cout << "VCID 9 continuity : " << vcdu_continuity.getGaps(AVHRR_VCID).size() << " gaps, " << vcdu_continuity.getLostCount(AVHRR_VCID) << " VCDUs lost, "
+              << vcdu_continuity.getDuplicateCount(AVHRR_VCID) << " duplicates" << '\n';
     std::cout << "Found " << ccsdsFrameStarts.size() << " CCDSDS frames headers declared" << '\n';
     output_file.close();
 
     input_file = std::ifstream("temp.ccsds", std::ios::binary);
 
+    // Lines selected, counted from the pass start and found from the timecodes alone
+    const bool wholePass = selectsWholePass(selection);
+    double passStart = 0;
+    long firstLine = 0, lastLine = LONG_MAX;
+    int firstPacket = 0, endPacket = ccsdsFrameStarts.size();
+    if (!wholePass)
+    {
+        std::vector<int> packets;
+        std::vector<double> packetTimestamps;
+        uint8_t header[CCSDS_TIMECODE_END];
+        for (int frame_num = 0; frame_num + 1 < (int)ccsdsFrameStarts.size(); frame_num++)
+        {
+            input_file.seekg(ccsdsFrameStarts[frame_num]);
+            if (!input_file.read((char *)header, sizeof(header)))
+                break;
+            int APID = (header[0] & 0x07) << 8 | header[1];
+            if (APID == 103 || APID == 104)
+            {
+                packets.push_back(frame_num);
+                packetTimestamps.push_back(parseCDSTimestamp(&header[6]));
+            }
+        }
+        input_file.clear();
+
+        double median = medianTimestamp(packetTimestamps);
+        passStart = median;
+        for (double timestamp : packetTimestamps)
+            if (std::abs(timestamp - median) <= AVHRR_MAX_PASS_TIME)
+                passStart = std::min(passStart, timestamp);
+
+        firstLine = std::max(selection.first, 0);
+        if (selection.last >= 0)
+            lastLine = selection.last;
+        if (!std::isnan(selection.startTime))
+            firstLine = std::max<long>(firstLine, std::ceil((selection.startTime - passStart) / AVHRR_LINE_DURATION - 1e-6));
+        if (!std::isnan(selection.endTime))
+            lastLine = std::min<long>(lastLine, std::floor((selection.endTime - passStart) / AVHRR_LINE_DURATION + 1e-6) + 1);
+
+        // Packets from the first to the last one selected
+        firstPacket = endPacket;
+        endPacket = 0;
+        for (size_t packet = 0; packet < packets.size(); packet++)
+        {
+            long line = std::lround((packetTimestamps[packet] - passStart) / AVHRR_LINE_DURATION);
+            if (std::abs(packetTimestamps[packet] - median) > AVHRR_MAX_PASS_TIME || line < firstLine || line >= lastLine)
+                continue;
+            firstPacket = std::min(firstPacket, packets[packet]);
+            endPacket = std::max(endPacket, packets[packet] + 1);
+        }
+    }
+
     // Now reading CCSDS frames found earlier
-    for (int frame_num = 0; frame_num < ccsdsFrameStarts.size(); frame_num++)
+    std::vector<long>::iterator nextDiscontinuity = discontinuities.begin();
+    int skipped_frames = 0;
+    for (int frame_num = firstPacket; frame_num < endPacket && frame_num + 1 < (int)ccsdsFrameStarts.size(); frame_num++)
     {
         long frame_start = ccsdsFrameStarts[frame_num];
         // Compute frame size
@@ -332,9 +319,37 @@ void METOPDecoder::processHRPT()
         if (frame_size <= 0)
             break;
 
+        // Skip packets that were spliced over lost VCDUs, reassembly restarts at the next header
+        while (nextDiscontinuity != discontinuities.end() && *nextDiscontinuity <= frame_start)
+            nextDiscontinuity++;
+        if (nextDiscontinuity != discontinuities.end() && *nextDiscontinuity < frame_start + frame_size)
+        {
+            skipped_frames++;
+            continue;
+        }
+
+        input_file.seekg(frame_start);
+
+        // Only the packets selected are read, from their APID and timecode
+        if (!wholePass)
+        {
+            uint8_t header[CCSDS_TIMECODE_END];
+            if (frame_size < CCSDS_TIMECODE_END)
+                continue;
+            if (!input_file.read((char *)header, sizeof(header)))
+                break;
+            int APID = (header[0] & 0x07) << 8 | header[1];
+            if (APID != 103 && APID != 104)
+                continue;
+            // Every line_step-th line from the first one, gaps included
+            long line = std::lround((parseCDSTimestamp(&header[6]) - passStart) / AVHRR_LINE_DURATION);
+            if (line < firstLine || line >= lastLine || (line - firstLine) % line_step != 0)
+                continue;
+            input_file.seekg(frame_start);
+        }
+
         // Buffer for CCSDS packet
         std::vector<uint8_t> ccsds_packet;
-        input_file.seekg(frame_start);
 
         // Fill our buffer
         for (int i = 0; i < frame_size; i++)
@@ -361,56 +376,94 @@ void METOPDecoder::processHRPT()
         // Only work on APID 103 and 104. Allowing both
         if (APID == 103 | APID == 104)
         {
-            total_frame_count++;
+            // The secondary header holds the line's timecode, right after the primary header
+            scanTimestamps.push_back(parseCDSTimestamp(&ccsds_packet[6]));
 
-            // We want the payload... So here we go!
+            // We want the payload... So here we go! It runs up to the end of the packet
             std::vector<uint8_t> *userData = truePacket.getUserDataField();
-            // Buffer for the current AVHRR scanline
-            std::array<uint16_t, 10240> line_buffer;
+            long userDataStart = frame_start + truePacket.getPrimaryHeader()->getPacketDataLength() + 1 + 6 - userData->size();
 
             // Apparently data is sometime shifted, what is indicated by the first byte's value...
             // Probably doing it wrong? But it works... Needs finer tuning
             int pos = (*userData)[0] > 20 ? 80 : 58;
 
-            // Read a scanline. 10-bits values again, may need a rewrite...
-            for (int i = 0; i < HRPT_SCAN_SIZE; i += 4)
-            {
-                uint16_t pixel1, pixel2, pixel3, pixel4;
-                pixel1 = ((*userData)[pos + 0] << 2) | ((*userData)[pos + 1] >> 6);
-                pixel2 = (((*userData)[pos + 1] % 64) << 4) | ((*userData)[pos + 2] >> 4);
-                pixel3 = (((*userData)[pos + 2] % 16) << 6) | ((*userData)[pos + 3] >> 2);
-                pixel4 = (((*userData)[pos + 3] % 4) << 8) | (*userData)[pos + 4];
-                pos += 5;
-
-                line_buffer[i] = pixel1;
-                line_buffer[i + 1] = pixel2;
-                line_buffer[i + 2] = pixel3;
-                line_buffer[i + 3] = pixel4;
-            }
-
-            scanLines.push_back(line_buffer);
+            // Samples are only unpacked when read, keeping memory flat whatever the pass length
+            scanLineStarts.push_back(userDataStart + pos);
         }
     }
     output_file.close();
 
-    std::cout << total_frame_count << " CCSDS frames of APID 103 or 104" << '\n';
+    std::cout << skipped_frames << " CCSDS frames spanning a discontinuity skipped" << '\n';
+    std::cout << scanLineStarts.size() << " CCSDS frames of APID 103 or 104" << '\n';
+
+    placeLines();
+    if (!wholePass && !scanTimestamps.empty())
+        first_line = std::lround((first_line_timestamp - passStart) / AVHRR_LINE_DURATION);
 }
 
-// Function used to decode a choosen channel
-cimg_library::CImg<unsigned short> METOPDecoder::decodeChannel(int channel)
+// Compute each scanline's row in the final image from its timestamp
+void METOPDecoder::placeLines()
 {
-    // Create a buffer for an entire line
-    std::array<uint16_t, 10240> line_buffer;
-    // Reset our ifstream
-    input_file.clear();
+    if (scanTimestamps.empty())
+        return;
 
-    // Large passes are too good for the stack to take it...
-    unsigned short *imageBuffer = new unsigned short[total_frame_count * HRPT_SCAN_WIDTH];
+    // Median time, so a few corrupted timestamps can't stretch the image
+    double median = medianTimestamp(scanTimestamps);
 
-    // Loop through all frames
-    for (int frame = 0; frame < total_frame_count; frame++)
+    // First and last valid lines
+    double lastTimestamp = first_line_timestamp = median;
+    for (double timestamp : scanTimestamps)
     {
-        line_buffer = scanLines[frame];
+        if (std::abs(timestamp - median) > AVHRR_MAX_PASS_TIME)
+            continue;
+        first_line_timestamp = std::min(first_line_timestamp, timestamp);
+        lastTimestamp = std::max(lastTimestamp, timestamp);
+    }
+
+    total_frame_count = std::lround((lastTimestamp - first_line_timestamp) / getLineDuration()) + 1;
+
+    // Each line goes straight to its row, gaps stay blank, duplicates land on the same row
+    int outliers = 0;
+    scanRows.clear();
+    for (double timestamp : scanTimestamps)
+    {
+        if (std::abs(timestamp - median) > AVHRR_MAX_PASS_TIME)
+        {
+            scanRows.push_back(-1);
+            outliers++;
+        }
+        else
+        {
+            scanRows.push_back(std::lround((timestamp - first_line_timestamp) / getLineDuration()));
+        }
+    }
+
+    // Reverse index for row-wise access, the last duplicate wins
+    rowLines.assign(total_frame_count, -1);
+    for (int line = 0; line < (int)scanRows.size(); line++)
+        if (scanRows[line] >= 0)
+            rowLines[scanRows[line]] = line;
+
+    std::cout << "Placed " << scanLineStarts.size() - outliers << " lines over " << total_frame_count << " rows (" << outliers << " with invalid timestamps)" << '\n';
+}
+
+// Function used to decode a choosen channel into a caller-provided buffer of HRPT_SCAN_WIDTH * getTotalFrameCount() pixels.
+// Samples are multiplied by scale, 1 keeping the raw 10-bits values
+void METOPDecoder::decodeChannelInto(int channel, unsigned short *imageBuffer, int scale)
+{
+    // Rows no scanline landed on are left blank
+    std::vector<bool> rowFilled(total_frame_count, false);
+
+    // Loop through all scanlines, writing each at its time-derived row
+    std::vector<uint16_t> line_buffer(HRPT_SCAN_SIZE);
+    for (int line = 0; line < (int)scanLineStarts.size(); line++)
+    {
+        int frame = scanRows[line];
+        if (frame < 0)
+            continue;
+
+        unpackLine(line, line_buffer.data());
+        rowFilled[frame] = true;
 
         // Loop through all pixels of the current line
         for (int pixel_pos = 0; pixel_pos < HRPT_SCAN_WIDTH; pixel_pos++)
@@ -419,15 +472,65 @@ cimg_library::CImg<unsigned short> METOPDecoder::decodeChannel(int channel)
             uint16_t pixel, pos;
             pos = channel - 1 + pixel_pos * HRPT_NUM_CHANNELS;
             pixel = line_buffer[pos];
-            imageBuffer[frame * HRPT_SCAN_WIDTH + pixel_pos] = pixel * 60;
+            imageBuffer[frame * HRPT_SCAN_WIDTH + pixel_pos] = pixel * scale;
         }
     }
 
-    // Build an image and return it
-    cimg_library::CImg<unsigned short> channelImage(&imageBuffer[0], HRPT_SCAN_WIDTH, total_frame_count);
-    delete[] imageBuffer; // Don't forget to free up the heap!
+    for (int frame = 0; frame < total_frame_count; frame++)
+        if (!rowFilled[frame])
+            std::fill_n(&imageBuffer[frame * HRPT_SCAN_WIDTH], HRPT_SCAN_WIDTH, 0);
+}
+
+// Function used to read the raw, channel-interleaved samples of an image row. Returns false if the row is missing
+bool METOPDecoder::readLine(int row, uint16_t *samples)
+{
+    if (row < 0 || row >= (int)rowLines.size() || rowLines[row] < 0)
+        return false;
+
+    unpackLine(rowLines[row], samples);
+    return true;
+}
+
+// Seek and read from the input, safe to call from several threads. Returns the byte count read
+size_t METOPDecoder::readAt(long position, char *buffer, size_t size)
+{
+    std::lock_guard<std::mutex> lock(input_mutex);
+    input_file.clear();
+    input_file.seekg(position);
+    input_file.read(buffer, size);
+    return input_file.gcount();
+}
+
+// Read a scanline's packed samples back from the CCSDS packets file and unpack them, safe to call from several threads
+void METOPDecoder::unpackLine(int line, uint16_t *samples)
+{
+    // Another consumer may just have needed it. Misses are handled under the slot's lock, so whoever waits on it gets a hit
+    UnpackedLine &unpacked = unpacked_lines[line % UNPACKED_LINE_SLOTS];
+    std::lock_guard<std::mutex> lock(unpacked.mutex);
+    uint16_t *slot = unpacked.samples.data();
+    if (unpacked.line != line)
+    {
+        // 10-bits values again, 4 samples in 5 bytes, may need a rewrite...
+        uint8_t packed[HRPT_SCAN_SIZE / 4 * 5];
+        size_t bytesRead = readAt(scanLineStarts[line], (char *)packed, sizeof(packed));
+        std::fill(packed + bytesRead, packed + sizeof(packed), 0);
+
+        for (int i = 0, pos = 0; i < HRPT_SCAN_SIZE; i += 4, pos += 5)
+        {
+            slot[i] = (packed[pos + 0] << 2) | (packed[pos + 1] >> 6);
+            slot[i + 1] = ((packed[pos + 1] % 64) << 4) | (packed[pos + 2] >> 4);
+            slot[i + 2] = ((packed[pos + 2] % 16) << 6) | (packed[pos + 3] >> 2);
+            slot[i + 3] = ((packed[pos + 3] % 4) << 8) | packed[pos + 4];
+        }
+        unpacked.line = line;
+    }
+    std::copy(slot, slot + HRPT_SCAN_SIZE, samples);
+}
 
-    return channelImage;
+// Return the pass as a line source, for streamed outputs
+LineSource METOPDecoder::getLineSource()
+{
+    return {HRPT_SCAN_WIDTH, total_frame_count, HRPT_NUM_CHANNELS, HRPT_PIXEL_SCALE, [this](int row, uint16_t *samples) { return readLine(row, samples); }};
 }
 
 // Return total fram count
@@ -436,6 +539,36 @@ int METOPDecoder::getTotalFrameCount()
     return total_frame_count;
 }
 
+// Return the timestamp of the first image row
+double METOPDecoder::getFirstLineTimestamp()
+{
+    return first_line_timestamp;
+}
+
+// Return the line of the pass the first image row is, counted from its first valid timestamp
+int METOPDecoder::getFirstLine()
+{
+    return first_line;
+}
+
+// Return the time between two image rows
+double METOPDecoder::getLineDuration()
+{
+    return AVHRR_LINE_DURATION * line_step;
+}
+
+// Return the VCDU continuity tracker, holding the gap index of each VCID
+VCDUContinuityTracker &METOPDecoder::getVCDUContinuity()
+{
+    return vcdu_continuity;
+}
+
+// Return the per-CADU Reed-Solomon report
+std::vector<int> &METOPDecoder::getRSFrameResults()
+{
+    return rs_frame_results;
+}
+
 // Perform a cleanup..
 void METOPDecoder::cleanupFiles()
 {
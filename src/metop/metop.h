@@ -1,9 +1,11 @@
 #include <fstream>
+#include <memory>
+#include <mutex>
 #include <vector>
-#include <array>
-#define cimg_use_png
-#define cimg_display 0
-#include "CImg.h"
+#include "common/hrpt.h"
+#include "common/line_source.h"
+#include "common/reedsolomon.h"
+#include "common/vcdu_continuity.h"
 
 #define METOP_HRPT_CHANNELS 5
 
@@ -16,20 +18,75 @@ private:
     int total_frame_count = 0;
     // First frame position in file
     long first_frame_pos = -1;
-    // Randomization table
-    uint8_t d_rantab[1024];
-    // CCSDS Frames vector
-    std::vector<std::array<uint16_t, 10240>> scanLines;
+    // Lines can be read from several threads at once
+    std::mutex input_mutex;
+    // Position of each scanline's packed samples in the CCSDS packets file
+    std::vector<long> scanLineStarts;
+    // A recently unpacked scanline, line being -1 until one is
+    struct UnpackedLine
+    {
+        std::mutex mutex;
+        int line = -1;
+        std::vector<uint16_t> samples;
+    };
+    // Recently unpacked scanlines, by line modulo their count. Consumers going over the same lines at about the same time
+    // only read and unpack each of them once
+    std::unique_ptr<UnpackedLine[]> unpacked_lines;
+    // Timestamp of each scanline, from the CCSDS secondary header
+    std::vector<double> scanTimestamps;
+    // Image row of each scanline, -1 if its timestamp is invalid
+    std::vector<int> scanRows;
+    // Scanline landing on each image row, -1 if none did
+    std::vector<int> rowLines;
+    // Timestamp of the first image row
+    double first_line_timestamp = 0;
+    // Reed-Solomon decoder for CADUs
+    ReedSolomon reed_solomon;
+    // Per-CADU RS report, corrected byte count or -1 if uncorrectable
+    std::vector<int> rs_frame_results;
+    // VCDU counters continuity and gap index
+    VCDUContinuityTracker vcdu_continuity;
+    // Input is soft symbols that need Viterbi decoding
+    bool soft_symbols;
+    // AVHRR lines between two image rows, and line of the pass the first row is, when only part of it is selected
+    int line_step = 1;
+    int first_line = 0;
+
+    // Seek and read from the input, safe to call from several threads. Returns the byte count read
+    size_t readAt(long position, char *buffer, size_t size);
+    // Read a scanline's packed samples back from the CCSDS packets file and unpack them, safe to call from several threads
+    void unpackLine(int line, uint16_t *samples);
+    // Viterbi-decode 8-bit soft symbols into bits
+    void viterbiDecode(std::vector<bool> &bits);
+    // Compute each scanline's row in the final image from its timestamp
+    void placeLines();
 
 public:
     // Constructor
-    METOPDecoder(std::ifstream &input);
-    // Function doing all the pre-frame work, that is, everything you'd need to do before being ready to read an image
-    void processHRPT();
-    // Function used to decode a choosen channel
-    cimg_library::CImg<unsigned short> decodeChannel(int channel);
-    // Return total fram count
+    METOPDecoder(std::ifstream &input, bool softSymbols = false);
+    // Function doing all the pre-frame work, that is, everything you'd need to do before being ready to read an image.
+    // Unless the whole pass is selected, AVHRR packets are first only located from their timecodes, and just the ones
+    // selected get read and unpacked
+    void processHRPT(const LineSelection &selection = HRPT_WHOLE_PASS);
+    // Function used to decode a choosen channel into a caller-provided buffer of 2048 * getTotalFrameCount() pixels.
+    // Samples are multiplied by scale, 1 keeping the raw 10-bits values
+    void decodeChannelInto(int channel, unsigned short *imageBuffer, int scale = HRPT_PIXEL_SCALE);
+    // Function used to read the raw, channel-interleaved samples of an image row. Returns false if the row is missing
+    bool readLine(int row, uint16_t *samples);
+    // Return the pass as a line source, for streamed outputs
+    LineSource getLineSource();
+    // Return total fram count, that is, the image height once lines are placed by time
     int getTotalFrameCount();
+    // Return the timestamp of the first image row
+    double getFirstLineTimestamp();
+    // Return the line of the pass the first image row is, counted from its first valid timestamp
+    int getFirstLine();
+    // Return the time between two image rows
+    double getLineDuration();
+    // Return the VCDU continuity tracker, holding the gap index of each VCID
+    VCDUContinuityTracker &getVCDUContinuity();
+    // Return the per-CADU Reed-Solomon report
+    std::vector<int> &getRSFrameResults();
     // File cleanup
     void cleanupFiles();
 };
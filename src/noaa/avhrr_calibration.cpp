@@ -0,0 +1,241 @@
+#include "avhrr_calibration.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+// Minor frame word positions (0-based) of the calibration data
+const int AVHRR_PRT_START = 17;
+const int AVHRR_PRT_COUNT = 3;
+const int AVHRR_BACKSCAN_START = 22;
+const int AVHRR_SPACE_START = 52;
+// Samples per channel in the backscan and space view data
+const int AVHRR_CALIBRATION_SAMPLES = 10;
+// PRT readings below this are the reference line starting each cycle of 4 PRTs
+const double AVHRR_PRT_REFERENCE_MAX = 50;
+// Channel 3 space counts above this mean it's in its 3B (thermal) mode
+const double AVHRR_3B_SPACE_MIN = 500;
+// Calibration data gets averaged over that many lines on each side
+const int AVHRR_SMOOTHING_RADIUS = 25;
+// Radiation constants, for radiances in mW/(m2.sr.cm-1)
+const double PLANCK_C1 = 1.1910427e-5;
+const double PLANCK_C2 = 1.4387752;
+
+// Pre-launch coefficients, from the NOAA KLM User's Guide appendix D
+static const AVHRRCoefficients AVHRR_COEFFICIENTS[] = {
+    {"NOAA-15",
+     {{276.60157, 0.051045, 1.36328e-6}, {276.62531, 0.050909, 1.47266e-6}, {276.67413, 0.050907, 1.47656e-6}, {276.59258, 0.050966, 1.47656e-6}},
+     {{0.0568, -2.1874, 0.1633, -54.9928, 500}, {0.0596, -2.4096, 0.1629, -55.1708, 500}, {0.0275, -1.0890, 0.1861, -79.4236, 500}},
+     {{2695.9743, 1.621256, 0.998015, 0, 0, 0, 0}, {925.4075, 0.337810, 0.998719, -4.50, 4.76, -0.0932, 0.0004524}, {839.8979, 0.304558, 0.999024, -3.61, 3.83, -0.0659, 0.0002811}}},
+    {"NOAA-19",
+     {{276.6067, 0.051111, 1.405783e-6}, {276.6119, 0.051090, 1.496037e-6}, {276.6311, 0.051033, 1.496990e-6}, {276.6268, 0.051058, 1.493110e-6}},
+     {{0.055091, -2.1415, 0.16253, -55.863, 496.43}, {0.054892, -2.1548, 0.16325, -56.445, 500.37}, {0.027174, -1.0800, 0.18472, -79.763, 496.11}},
+     {{2670.0, 1.67396, 0.997364, 0, 0, 0, 0}, {928.9, 0.53959, 0.998534, -5.49, 5.70, -0.11187, 0.00054668}, {831.9, 0.36064, 0.998913, -3.39, 3.58, -0.05991, 0.00024985}}},
+};
+
+// Look up a spacecraft's coefficients by name, eg "NOAA-19". Throws if unknown
+const AVHRRCoefficients &getAVHRRCoefficients(const std::string &spacecraft)
+{
+    for (const AVHRRCoefficients &coefficients : AVHRR_COEFFICIENTS)
+        if (coefficients.name == spacecraft)
+            return coefficients;
+    throw std::runtime_error("No AVHRR calibration for " + spacecraft);
+}
+
+// Radiance of a blackbody at a temperature, for a wavenumber
+inline double planckRadiance(double wavenumber, double temperature)
+{
+    return PLANCK_C1 * wavenumber * wavenumber * wavenumber / (std::exp(PLANCK_C2 * wavenumber / temperature) - 1);
+}
+
+// Temperature of a blackbody from its radiance, for a wavenumber
+inline double planckTemperature(double wavenumber, double radiance)
+{
+    return PLANCK_C2 * wavenumber / std::log(1 + PLANCK_C1 * wavenumber * wavenumber * wavenumber / radiance);
+}
+
+// Scale a calibrated value to output units, clamped to 16-bits
+inline uint16_t toCalibratedSample(double value)
+{
+    return std::clamp(std::lround(value * AVHRR_CALIBRATED_UNIT), 0L, (long)UINT16_MAX);
+}
+
+// Average of valid values over the lines within radius of each line. Lines without any valid neighbour get NAN
+static std::vector<double> smoothLines(const std::vector<double> &values, const std::vector<bool> &valid, int radius)
+{
+    const int rows = values.size();
+
+    // Prefix sums, so each window is 2 lookups
+    std::vector<double> sums(rows + 1, 0);
+    std::vector<int> counts(rows + 1, 0);
+    for (int row = 0; row < rows; row++)
+    {
+        sums[row + 1] = sums[row] + (valid[row] ? values[row] : 0);
+        counts[row + 1] = counts[row] + valid[row];
+    }
+
+    std::vector<double> smoothed(rows);
+    for (int row = 0; row < rows; row++)
+    {
+        int start = std::max(row - radius, 0), end = std::min(row + radius + 1, rows);
+        int count = counts[end] - counts[start];
+        smoothed[row] = count > 0 ? (sums[end] - sums[start]) / count : NAN;
+    }
+    return smoothed;
+}
+
+// Constructor, taking the AVHRR_HEADER_WORDS first words of each minor frame of the pass
+AVHRRCalibrator::AVHRRCalibrator(const AVHRRCoefficients &coefficients, const std::vector<uint16_t> &headers, int rows) : coefficients{coefficients}, lines(rows), has_thermal{false}
+{
+    // Visible LUTs, the same for every line
+    for (int channel = 0; channel < 3; channel++)
+    {
+        const AVHRRVisibleCoefficients &visible = coefficients.visible[channel];
+        visible_luts[channel].resize(AVHRR_COUNT_LEVELS);
+        for (int count = 0; count < AVHRR_COUNT_LEVELS; count++)
+            visible_luts[channel][count] = toCalibratedSample(count <= visible.intersection ? visible.slope1 * count + visible.intercept1
+                                                                                           : visible.slope2 * count + visible.intercept2);
+    }
+
+    // Each line holds 3 readings of one PRT. A reference line, reading 0, is followed by PRTs 1 to 4
+    std::vector<double> prtTemperatures[4];
+    std::vector<bool> prtValid[4];
+    // Blackbody and space counts of channels 3B, 4 and 5
+    std::vector<double> blackbodyCounts[3], spaceCounts[3];
+    std::vector<bool> countsValid[3];
+    for (int i = 0; i < 4; i++)
+    {
+        prtTemperatures[i].assign(rows, 0);
+        prtValid[i].assign(rows, false);
+    }
+    for (int i = 0; i < 3; i++)
+    {
+        blackbodyCounts[i].assign(rows, 0);
+        spaceCounts[i].assign(rows, 0);
+        countsValid[i].assign(rows, true);
+    }
+
+    int lastReference = -1;
+    for (int row = 0; row < rows; row++)
+    {
+        const uint16_t *header = &headers[(size_t)row * AVHRR_HEADER_WORDS];
+
+        // PRT reading
+        double prt = 0;
+        for (int i = 0; i < AVHRR_PRT_COUNT; i++)
+            prt += header[AVHRR_PRT_START + i] & 0x3FF;
+        prt /= AVHRR_PRT_COUNT;
+
+        int prtIndex = lastReference >= 0 ? row - lastReference - 1 : -1;
+        if (prt < AVHRR_PRT_REFERENCE_MAX)
+        {
+            lastReference = row;
+        }
+        else if (prtIndex >= 0 && prtIndex < 4)
+        {
+            const double *d = coefficients.prt[prtIndex];
+            prtTemperatures[prtIndex][row] = d[0] + d[1] * prt + d[2] * prt * prt;
+            prtValid[prtIndex][row] = true;
+            has_thermal = true;
+        }
+
+        // Backscan is 10 x (3B, 4, 5), space view 10 x (1, 2, 3, 4, 5)
+        for (int channel = 0; channel < 3; channel++)
+        {
+            for (int i = 0; i < AVHRR_CALIBRATION_SAMPLES; i++)
+            {
+                blackbodyCounts[channel][row] += header[AVHRR_BACKSCAN_START + i * 3 + channel] & 0x3FF;
+                spaceCounts[channel][row] += header[AVHRR_SPACE_START + i * 5 + 2 + channel] & 0x3FF;
+            }
+            blackbodyCounts[channel][row] /= AVHRR_CALIBRATION_SAMPLES;
+            spaceCounts[channel][row] /= AVHRR_CALIBRATION_SAMPLES;
+        }
+
+        // Channel 3A looks at space with its visible offset, 3B sees a cold target
+        lines[row].channel3B = spaceCounts[0][row] > AVHRR_3B_SPACE_MIN;
+        countsValid[0][row] = lines[row].channel3B;
+    }
+
+    // Smooth everything over neighbouring lines. The blackbody temperature is the mean of all 4 PRTs
+    std::vector<double> smoothedPRTs[4];
+    for (int i = 0; i < 4; i++)
+        smoothedPRTs[i] = smoothLines(prtTemperatures[i], prtValid[i], AVHRR_SMOOTHING_RADIUS);
+    for (int channel = 0; channel < 3; channel++)
+    {
+        std::vector<double> smoothedBlackbody = smoothLines(blackbodyCounts[channel], countsValid[channel], AVHRR_SMOOTHING_RADIUS);
+        std::vector<double> smoothedSpace = smoothLines(spaceCounts[channel], countsValid[channel], AVHRR_SMOOTHING_RADIUS);
+        for (int row = 0; row < rows; row++)
+        {
+            lines[row].blackbodyCounts[channel] = smoothedBlackbody[row];
+            lines[row].spaceCounts[channel] = smoothedSpace[row];
+        }
+    }
+
+    for (int row = 0; row < rows; row++)
+    {
+        double sum = 0;
+        int count = 0;
+        for (int i = 0; i < 4; i++)
+        {
+            if (std::isnan(smoothedPRTs[i][row]))
+                continue;
+            sum += smoothedPRTs[i][row];
+            count++;
+        }
+        lines[row].blackbodyTemperature = count > 0 ? sum / count : NAN;
+    }
+}
+
+// Build the thermal LUT of a line for channel 3B, 4 or 5
+void AVHRRCalibrator::buildThermalLUT(const LineCalibration &line, int thermalChannel, uint16_t *lut) const
+{
+    const AVHRRThermalCoefficients &thermal = coefficients.thermal[thermalChannel];
+    const double spaceCounts = line.spaceCounts[thermalChannel];
+    const double blackbodyCounts = line.blackbodyCounts[thermalChannel];
+
+    // Nothing to calibrate against
+    if (std::isnan(line.blackbodyTemperature) || std::isnan(spaceCounts) || std::isnan(blackbodyCounts) || spaceCounts == blackbodyCounts)
+    {
+        std::fill_n(lut, AVHRR_COUNT_LEVELS, 0);
+        return;
+    }
+
+    // Blackbody radiance, from its band-corrected temperature
+    const double blackbodyRadiance = planckRadiance(thermal.wavenumber, thermal.a + thermal.b * line.blackbodyTemperature);
+
+    for (int count = 0; count < AVHRR_COUNT_LEVELS; count++)
+    {
+        // Linear radiance between space and blackbody, then the nonlinearity correction
+        double linear = thermal.ns + (blackbodyRadiance - thermal.ns) * (spaceCounts - count) / (spaceCounts - blackbodyCounts);
+        double radiance = thermal.b0 + (1 + thermal.b1) * linear + thermal.b2 * linear * linear;
+
+        if (radiance <= 0)
+            lut[count] = 0;
+        else
+            lut[count] = toCalibratedSample((planckTemperature(thermal.wavenumber, radiance) - thermal.a) / thermal.b);
+    }
+}
+
+// Calibrate a row of 5-channels interleaved counts in place
+void AVHRRCalibrator::calibrateLine(int row, uint16_t *samples, int width) const
+{
+    const LineCalibration &line = lines[row];
+
+    // LUT of each channel for this line
+    uint16_t thermalLUTs[3][AVHRR_COUNT_LEVELS];
+    for (int channel = line.channel3B ? 0 : 1; channel < 3; channel++)
+        buildThermalLUT(line, channel, thermalLUTs[channel]);
+
+    const uint16_t *luts[5] = {visible_luts[0].data(), visible_luts[1].data(),
+                               line.channel3B ? thermalLUTs[0] : visible_luts[2].data(),
+                               thermalLUTs[1], thermalLUTs[2]};
+
+    for (int pixel = 0; pixel < width; pixel++)
+        for (int channel = 0; channel < 5; channel++)
+            samples[pixel * 5 + channel] = luts[channel][samples[pixel * 5 + channel] & 0x3FF];
+}
+
+// Whether thermal channels can be calibrated. If not, they come out as 0
+bool AVHRRCalibrator::hasThermal() const
+{
+    return has_thermal;
+}
@@ -0,0 +1,77 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Words from the start of a minor frame up to the end of the space view data
+#define AVHRR_HEADER_WORDS 102
+// Count range of an AVHRR sample
+#define AVHRR_COUNT_LEVELS 1024
+// Calibrated samples are albedos in 0.01 % and brightness temperatures in 0.01 K
+#define AVHRR_CALIBRATED_UNIT 100
+
+// Dual-gain visible channel coefficients, giving albedo in %. Counts above the intersection use the second line
+struct AVHRRVisibleCoefficients
+{
+    double slope1, intercept1;
+    double slope2, intercept2;
+    double intersection;
+};
+
+// Thermal channel coefficients : central wavenumber (cm-1), blackbody band correction and nonlinearity
+struct AVHRRThermalCoefficients
+{
+    double wavenumber, a, b;
+    double ns, b0, b1, b2;
+};
+
+// Everything needed to calibrate a spacecraft's AVHRR, from the NOAA KLM User's Guide
+struct AVHRRCoefficients
+{
+    std::string name;
+    // d0, d1, d2 for each of the 4 PRTs, giving their temperature from counts
+    double prt[4][3];
+    // Channels 1, 2 and 3A
+    AVHRRVisibleCoefficients visible[3];
+    // Channels 3B, 4 and 5
+    AVHRRThermalCoefficients thermal[3];
+};
+
+// Look up a spacecraft's coefficients by name, eg "NOAA-19". Throws if unknown
+const AVHRRCoefficients &getAVHRRCoefficients(const std::string &spacecraft);
+
+// Turns raw AVHRR counts into albedos and brightness temperatures.
+// Thermal calibration follows the blackbody (PRT) and space view counts of each line, smoothed over
+// neighbouring lines, and is done through a LUT built for each line
+class AVHRRCalibrator
+{
+private:
+    // Calibration state of a single line
+    struct LineCalibration
+    {
+        // Channel 3 was in its 3B (thermal) mode
+        bool channel3B;
+        // Smoothed blackbody temperature, and blackbody / space counts of channels 3B, 4 and 5
+        double blackbodyTemperature;
+        double blackbodyCounts[3];
+        double spaceCounts[3];
+    };
+
+    AVHRRCoefficients coefficients;
+    std::vector<LineCalibration> lines;
+    // Visible channels don't depend on the line, so they share a single LUT each
+    std::vector<uint16_t> visible_luts[3];
+    // Whether blackbody temperatures could be found at all
+    bool has_thermal;
+
+    // Build the thermal LUT of a line for channel 3B, 4 or 5
+    void buildThermalLUT(const LineCalibration &line, int thermalChannel, uint16_t *lut) const;
+
+public:
+    // Constructor, taking the AVHRR_HEADER_WORDS first words of each minor frame of the pass
+    AVHRRCalibrator(const AVHRRCoefficients &coefficients, const std::vector<uint16_t> &headers, int rows);
+    // Calibrate a row of 5-channels interleaved counts in place
+    void calibrateLine(int row, uint16_t *samples, int width) const;
+    // Whether thermal channels can be calibrated. If not, they come out as 0
+    bool hasThermal() const;
+};
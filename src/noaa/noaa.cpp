@@ -1,5 +1,11 @@
 #include "noaa.h"
 #include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <vector>
+#include "common/hrpt.h"
+#include "common/orbit.h"
 
 // Total world count
 const int HRPT_BLOCK_SIZE = 11090;
@@ -11,6 +17,12 @@ const int HRPT_SCAN_WIDTH = 2048;
 const int HRPT_SCAN_SIZE = HRPT_SCAN_WIDTH * HRPT_NUM_CHANNELS;
 // Image words position from frame sync
 const int HRPT_IMAGE_START = 750;
+// Time between two frames, 6 lines per second
+const double HRPT_LINE_DURATION = 1.0 / 6.0;
+// Timecode words position from frame sync
+const int HRPT_TIMECODE_START = 8;
+// Frames whose timecodes are looked at to select times
+const int HRPT_TIMECODE_FRAMES = 64;
 // Sync marker word size
 const int HRPT_SYNC_SIZE = 6;
 // Sync marker
@@ -21,9 +33,12 @@ NOAADecoder::NOAADecoder(std::ifstream &input) : input_file{input}
 {
 }
 
-// Function doing all the pre-frame work, that is, everything you'd need to do before being ready to read an image
-void NOAADecoder::processHRPT()
+// Function doing all the pre-frame work, that is, everything you'd need to do before being ready to read an image.
+// Unless the whole pass is selected, frames are jumped to straight away from the first one rather than searched for
+void NOAADecoder::processHRPT(const LineSelection &selection)
 {
+    const bool wholePass = selectsWholePass(selection);
+
     // Frame sync detection... Perfect markers everywhere so easy enough!
     std::cout << "Detecting synchronization markers..." << '\n';
 
@@ -50,29 +65,84 @@ void NOAADecoder::processHRPT()
             // First one detected, save it
             if (first_frame_pos == -1)
                 first_frame_pos = (long)input_file.tellg() - 12;
+
+            // Frames are evenly spaced from there, no need to look at the ones we skip
+            if (!wholePass)
+                break;
+        }
+    }
+
+    if (!wholePass && first_frame_pos != -1)
+    {
+        // Every frame whose sync marker is in the file can be a row, like when searching them all
+        input_file.clear();
+        input_file.seekg(0, std::ios::end);
+        const long availableFrames = ((long)input_file.tellg() - first_frame_pos - HRPT_SYNC_SIZE * 2) / ((long)HRPT_BLOCK_SIZE * 2) + 1;
+        long first = std::max(selection.first, 0);
+        long last = selection.last < 0 ? availableFrames : std::min<long>(selection.last, availableFrames);
+
+        // Times are turned to frames from the timecodes at the start of the pass
+        if (!std::isnan(selection.startTime) || !std::isnan(selection.endTime))
+        {
+            total_frame_count = std::min<long>(availableFrames, HRPT_TIMECODE_FRAMES);
+            double passStart = getFirstLineTimestamp(std::isnan(selection.startTime) ? selection.endTime : selection.startTime);
+            if (std::isnan(passStart))
+            {
+                std::cout << "No valid timecode to select times from!" << '\n';
+                total_frame_count = 0;
+                return;
+            }
+            if (!std::isnan(selection.startTime))
+                first = std::max<long>(first, std::ceil((selection.startTime - passStart) / HRPT_LINE_DURATION - 1e-6));
+            if (!std::isnan(selection.endTime))
+                last = std::min<long>(last, std::floor((selection.endTime - passStart) / HRPT_LINE_DURATION + 1e-6) + 1);
         }
+
+        first_frame = first;
+        frame_step = selection.step;
+        total_frame_count = first < last ? (last - first + frame_step - 1) / frame_step : 0;
+
+        // Check the markers where frames are expected
+        int goodMarkers = 0;
+        uint16_t marker[HRPT_SYNC_SIZE];
+        for (int row = 0; row < total_frame_count; row++)
+            if (readAt(framePosition(row), (char *)marker, sizeof(marker)) == sizeof(marker) && std::equal(marker, marker + HRPT_SYNC_SIZE, HRPT_SYNC))
+                goodMarkers++;
+        std::cout << "Done! Found " << goodMarkers << " sync markers out of " << total_frame_count << " frames, from frame " << first_frame << " every " << frame_step << '\n';
+        return;
     }
     std::cout << "Done! Found " << total_frame_count << " sync markers!" << '\n';
 }
 
-// Function used to decode a choosen channel
-cimg_library::CImg<unsigned short> NOAADecoder::decodeChannel(int channel)
+// Position in file of the frame holding an image row
+long NOAADecoder::framePosition(int row)
 {
-    // Create a buffer for an entire line
-    uint16_t line_buffer[HRPT_SCAN_SIZE];
-    // Reset our ifstream
+    return first_frame_pos + ((long)first_frame + (long)row * frame_step) * HRPT_BLOCK_SIZE * 2;
+}
+
+// Seek and read from the input, safe to call from several threads. Returns the byte count read
+size_t NOAADecoder::readAt(long position, char *buffer, size_t size)
+{
+    std::lock_guard<std::mutex> lock(input_mutex);
     input_file.clear();
+    input_file.seekg(position);
+    input_file.read(buffer, size);
+    return input_file.gcount();
+}
 
-    // Large passes are too good for the stack to take it...
-    unsigned short *imageBuffer = new unsigned short[total_frame_count * HRPT_SCAN_WIDTH];
+// Function used to decode a choosen channel into a caller-provided buffer of HRPT_SCAN_WIDTH * getTotalFrameCount() pixels.
+// Samples are multiplied by scale, 1 keeping the raw 10-bits values
+void NOAADecoder::decodeChannelInto(int channel, unsigned short *imageBuffer, int scale)
+{
+    // Create a buffer for an entire line
+    uint16_t line_buffer[HRPT_SCAN_SIZE];
 
     // Loop through all frames
     for (int frame = 0; frame < total_frame_count; frame++)
     {
         // Read a line from the current frame (AVHRR data)
-        long linePos = first_frame_pos + (HRPT_IMAGE_START + frame * HRPT_BLOCK_SIZE) * 2;
-        input_file.seekg(linePos);
-        input_file.read((char *)line_buffer, HRPT_SCAN_SIZE * 2);
+        long linePos = framePosition(frame) + HRPT_IMAGE_START * 2;
+        readAt(linePos, (char *)line_buffer, HRPT_SCAN_SIZE * 2);
 
         // Loop through all pixels of the current line
         for (int pixel_pos = 0; pixel_pos < HRPT_SCAN_WIDTH; pixel_pos++)
@@ -81,14 +151,65 @@ cimg_library::CImg<unsigned short> NOAADecoder::decodeChannel(int channel)
             uint16_t pixel, pos;
             pos = channel - 1 + pixel_pos * HRPT_NUM_CHANNELS;
             pixel = line_buffer[pos];
-            imageBuffer[frame * HRPT_SCAN_WIDTH + pixel_pos] = pixel * 60;
+            imageBuffer[frame * HRPT_SCAN_WIDTH + pixel_pos] = pixel * scale;
         }
     }
+}
+
+// Function used to read the raw, channel-interleaved samples of an image row. Returns false if the row is missing
+bool NOAADecoder::readLine(int row, uint16_t *samples)
+{
+    if (row < 0 || row >= total_frame_count)
+        return false;
+
+    // Each frame holds a line of AVHRR data
+    long linePos = framePosition(row) + HRPT_IMAGE_START * 2;
+    size_t bytesRead = readAt(linePos, (char *)samples, HRPT_SCAN_SIZE * 2);
+
+    // A truncated last frame gets padded
+    std::fill((char *)samples + bytesRead, (char *)(samples + HRPT_SCAN_SIZE), 0);
+    return true;
+}
+
+// Function used to read the first AVHRR_HEADER_WORDS words of a frame, up to the end of the space view data
+void NOAADecoder::readHeader(int row, uint16_t *words)
+{
+    readFrameHeader((long)row * frame_step, words);
+}
 
-    // Build an image and return it
-    cimg_library::CImg<unsigned short> channelImage(&imageBuffer[0], HRPT_SCAN_WIDTH, total_frame_count);
-    delete[] imageBuffer; // Don't forget to free up the heap!
-    return channelImage;
+// Read the header words of any frame, counted from the one of the first image row
+void NOAADecoder::readFrameHeader(long frame, uint16_t *words)
+{
+    size_t bytesRead = readAt(first_frame_pos + (first_frame + frame) * HRPT_BLOCK_SIZE * 2, (char *)words, AVHRR_HEADER_WORDS * 2);
+    std::fill((char *)words + bytesRead, (char *)(words + AVHRR_HEADER_WORDS), 0);
+}
+
+// Return the pass as a line source, for streamed outputs
+LineSource NOAADecoder::getLineSource()
+{
+    return {HRPT_SCAN_WIDTH, total_frame_count, HRPT_NUM_CHANNELS, HRPT_PIXEL_SCALE, [this](int row, uint16_t *samples) { return readLine(row, samples); }};
+}
+
+// Return the pass as a line source of calibrated samples (0.01 % albedo, 0.01 K brightness temperature)
+LineSource NOAADecoder::getCalibratedLineSource(const AVHRRCoefficients &coefficients)
+{
+    // Calibration data of the whole pass first, as it gets smoothed over neighbouring lines. The PRT cycle runs over
+    // consecutive frames, so every frame of the span is read even when only every frame_step-th one is a row
+    const int frames = total_frame_count > 0 ? (total_frame_count - 1) * frame_step + 1 : 0;
+    std::vector<uint16_t> headers((size_t)frames * AVHRR_HEADER_WORDS);
+    for (int frame = 0; frame < frames; frame++)
+        readFrameHeader(frame, &headers[(size_t)frame * AVHRR_HEADER_WORDS]);
+
+    std::shared_ptr<AVHRRCalibrator> calibrator = std::make_shared<AVHRRCalibrator>(coefficients, headers, frames);
+    if (!calibrator->hasThermal())
+        std::cout << "No PRT data found! Thermal channels won't be calibrated" << '\n';
+
+    return {HRPT_SCAN_WIDTH, total_frame_count, HRPT_NUM_CHANNELS, 1, [this, calibrator](int row, uint16_t *samples) {
+                if (!readLine(row, samples))
+                    return false;
+                calibrator->calibrateLine(row * frame_step, samples, HRPT_SCAN_WIDTH);
+                return true;
+            }};
 }
 
 // Return total fram count
@@ -96,3 +217,52 @@ int NOAADecoder::getTotalFrameCount()
 {
     return total_frame_count;
 }
+
+// Return the timestamp of the first image row, from the frame timecodes. Their median is used so a few corrupted
+// ones don't matter. Timecodes have no year, the one closest to referenceTimestamp is used. NAN if none is valid
+double NOAADecoder::getFirstLineTimestamp(double referenceTimestamp)
+{
+    const int referenceYear = timestampYear(referenceTimestamp);
+
+    // Start time implied by each frame
+    std::vector<double> startTimestamps;
+    uint16_t header[AVHRR_HEADER_WORDS];
+    for (int frame = 0; frame < total_frame_count; frame++)
+    {
+        readHeader(frame, header);
+
+        // 9 bits of day of year, then 27 bits of milliseconds of day
+        const uint16_t *timecode = &header[HRPT_TIMECODE_START];
+        int day = (timecode[0] >> 1) & 0x1FF;
+        long milliseconds = (long)(timecode[1] & 0x7F) << 20 | (timecode[2] & 0x3FF) << 10 | (timecode[3] & 0x3FF);
+        if (day < 1 || day > 366 || milliseconds >= 86400000)
+            continue;
+
+        double bestTimestamp = NAN;
+        for (int year = referenceYear - 1; year <= referenceYear + 1; year++)
+        {
+            double timestamp = dayOfYearTimestamp(year, day) + milliseconds / 1e3;
+            if (std::isnan(bestTimestamp) || std::abs(timestamp - referenceTimestamp) < std::abs(bestTimestamp - referenceTimestamp))
+                bestTimestamp = timestamp;
+        }
+        startTimestamps.push_back(bestTimestamp - frame * getLineDuration());
+    }
+
+    if (startTimestamps.empty())
+        return NAN;
+
+    std::nth_element(startTimestamps.begin(), startTimestamps.begin() + startTimestamps.size() / 2, startTimestamps.end());
+    return startTimestamps[startTimestamps.size() / 2];
+}
+
+// Return the time between two image rows
+double NOAADecoder::getLineDuration()
+{
+    return HRPT_LINE_DURATION * frame_step;
+}
+
+// Return the frame of the pass the first image row is
+int NOAADecoder::getFirstLine()
+{
+    return first_frame;
+}
@@ -1,7 +1,8 @@
 #include <fstream>
-#define cimg_use_png
-#define cimg_display 0
-#include "CImg.h"
+#include <mutex>
+#include "common/hrpt.h"
+#include "common/line_source.h"
+#include "avhrr_calibration.h"
 
 #define NOAA_HRPT_CHANNELS 5
 
@@ -10,18 +11,47 @@ class NOAADecoder
 private:
     // Our ifstream used... All the time
     std::ifstream &input_file;
+    // Lines can be read from several threads at once
+    std::mutex input_mutex;
     // Total frame count variable to be used later
     int total_frame_count = 0;
     // First frame position in file
     long first_frame_pos = -1;
+    // Frame of the first image row, and frames between two image rows, when only part of the pass is selected
+    int first_frame = 0;
+    int frame_step = 1;
+
+    // Seek and read from the input, safe to call from several threads. Returns the byte count read
+    size_t readAt(long position, char *buffer, size_t size);
+    // Position in file of the frame holding an image row
+    long framePosition(int row);
+    // Read the header words of any frame, counted from the one of the first image row
+    void readFrameHeader(long frame, uint16_t *words);
 
 public:
     // Constructor
     NOAADecoder(std::ifstream &input);
-    // Function doing all the pre-frame work, that is, everything you'd need to do before being ready to read an image
-    void processHRPT();
-    // Function used to decode a choosen channel
-    cimg_library::CImg<unsigned short> decodeChannel(int channel);
+    // Function doing all the pre-frame work, that is, everything you'd need to do before being ready to read an image.
+    // Unless the whole pass is selected, frames are jumped to straight away from the first one rather than searched for
+    void processHRPT(const LineSelection &selection = HRPT_WHOLE_PASS);
+    // Function used to decode a choosen channel into a caller-provided buffer of 2048 * getTotalFrameCount() pixels.
+    // Samples are multiplied by scale, 1 keeping the raw 10-bits values
+    void decodeChannelInto(int channel, unsigned short *imageBuffer, int scale = HRPT_PIXEL_SCALE);
+    // Function used to read the raw, channel-interleaved samples of an image row. Returns false if the row is missing
+    bool readLine(int row, uint16_t *samples);
+    // Function used to read the first AVHRR_HEADER_WORDS words of a frame, up to the end of the space view data
+    void readHeader(int row, uint16_t *words);
+    // Return the pass as a line source, for streamed outputs
+    LineSource getLineSource();
+    // Return the pass as a line source of calibrated samples (0.01 % albedo, 0.01 K brightness temperature)
+    LineSource getCalibratedLineSource(const AVHRRCoefficients &coefficients);
     // Return total fram count
     int getTotalFrameCount();
+    // Return the timestamp of the first image row, from the frame timecodes. Their median is used so a few corrupted
+    // ones don't matter. Timecodes have no year, the one closest to referenceTimestamp is used. NAN if none is valid
+    double getFirstLineTimestamp(double referenceTimestamp);
+    // Return the time between two image rows
+    double getLineDuration();
+    // Return the frame of the pass the first image row is
+    int getFirstLine();
 };